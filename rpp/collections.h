@@ -8,6 +8,11 @@
 #include <unordered_map>
 #include <numeric>
 #include <algorithm> // std::sort
+#include <atomic>
+#include <memory> // std::unique_ptr
+#include <new>
+#include <cstdint>
+#include <type_traits>
 
 namespace rpp
 {
@@ -493,4 +498,319 @@ namespace rpp
     //}
 
     /////////////////////////////////////////////////////////////////////////////////////
+
+    // keeps frequently written atomics on separate cache lines to avoid false sharing
+    static constexpr size_t cache_line_size = 64;
+
+    namespace detail
+    {
+        inline size_t ring_capacity(size_t capacity) noexcept
+        {
+            size_t pow2 = 2;
+            while (pow2 < capacity) pow2 <<= 1;
+            return pow2;
+        }
+    }
+
+    /**
+     * Bounded lock-free multi-producer multi-consumer ring (Dmitry Vyukov's algorithm).
+     * Every cell has a sequence number which tells producers and consumers whether
+     * the cell is free for the current lap, so the only contention is a single CAS
+     * on the enqueue or dequeue position, which live on separate cache lines.
+     * @code
+     * rpp::mpmc_ring<Job> jobs { 1024 };
+     * if (!jobs.try_push(move(job))) handle_full_queue();
+     * Job next;
+     * while (jobs.try_pop(next)) next.run();
+     * @endcode
+     */
+    template<class T> class mpmc_ring
+    {
+        struct cell
+        {
+            std::atomic<size_t> sequence;
+            std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+            T& item() noexcept { return *reinterpret_cast<T*>(&storage); }
+        };
+
+        const size_t mask;
+        std::unique_ptr<cell[]> cells;
+        alignas(cache_line_size) std::atomic<size_t> enqueuePos { 0 };
+        alignas(cache_line_size) std::atomic<size_t> dequeuePos { 0 };
+
+    public:
+        using value_type = T;
+
+        /**
+         * @param capacity Maximum number of items, rounded up to a power of two
+         */
+        explicit mpmc_ring(size_t capacity)
+            : mask{detail::ring_capacity(capacity) - 1}, cells{new cell[mask + 1]}
+        {
+            for (size_t i = 0; i <= mask; ++i)
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        ~mpmc_ring() noexcept
+        {
+            for (size_t pos = dequeuePos, end = enqueuePos; pos != end; ++pos)
+                cells[pos & mask].item().~T();
+        }
+
+        mpmc_ring(const mpmc_ring&) = delete;
+        mpmc_ring& operator=(const mpmc_ring&) = delete;
+
+        size_t capacity() const noexcept { return mask + 1; }
+
+        // number of items, only accurate if no other threads are using the ring
+        size_t size_approx() const noexcept
+        {
+            size_t tail = enqueuePos.load(std::memory_order_relaxed);
+            size_t head = dequeuePos.load(std::memory_order_relaxed);
+            return tail > head ? tail - head : 0;
+        }
+        bool empty_approx() const noexcept { return size_approx() == 0; }
+
+        /**
+         * @return FALSE if the ring is full, in which case item is not moved from
+         */
+        template<class U> bool try_push(U&& item)
+        {
+            size_t pos = enqueuePos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                cell& c = cells[pos & mask];
+                size_t seq = c.sequence.load(std::memory_order_acquire);
+                intptr_t diff = intptr_t(seq) - intptr_t(pos);
+                if (diff == 0) {
+                    if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        new (&c.item()) T{ std::forward<U>(item) };
+                        c.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0) return false; // full
+                else pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * @return FALSE if the ring is empty
+         */
+        bool try_pop(T& out)
+        {
+            size_t pos = dequeuePos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                cell& c = cells[pos & mask];
+                size_t seq = c.sequence.load(std::memory_order_acquire);
+                intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+                if (diff == 0) {
+                    if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        take(c, pos, out);
+                        return true;
+                    }
+                }
+                else if (diff < 0) return false; // empty
+                else pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+
+        /**
+         * Moves up to n items into the ring, claiming all free cells with a single CAS
+         * @return Number of items pushed, the first ones of the array
+         */
+        size_t push_n(T* items, size_t n)
+        {
+            size_t pos = enqueuePos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                // a free cell for this lap can only be filled by whoever claims its position
+                size_t count = 0;
+                for (; count < n; ++count)
+                {
+                    size_t seq = cells[(pos + count) & mask].sequence.load(std::memory_order_acquire);
+                    if (seq != pos + count) break;
+                }
+                if (count == 0) {
+                    size_t seq = cells[pos & mask].sequence.load(std::memory_order_acquire);
+                    if (intptr_t(seq) - intptr_t(pos) < 0) return 0; // full
+                    pos = enqueuePos.load(std::memory_order_relaxed);
+                    continue;
+                }
+                if (enqueuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                    for (size_t i = 0; i < count; ++i) {
+                        cell& c = cells[(pos + i) & mask];
+                        new (&c.item()) T{ std::move(items[i]) };
+                        c.sequence.store(pos + i + 1, std::memory_order_release);
+                    }
+                    return count;
+                }
+            }
+        }
+
+        /**
+         * Pops up to n items with a single CAS
+         * @return Number of items written to out
+         */
+        size_t pop_n(T* out, size_t n)
+        {
+            size_t pos = dequeuePos.load(std::memory_order_relaxed);
+            for (;;)
+            {
+                size_t count = 0;
+                for (; count < n; ++count)
+                {
+                    size_t seq = cells[(pos + count) & mask].sequence.load(std::memory_order_acquire);
+                    if (seq != pos + count + 1) break;
+                }
+                if (count == 0) {
+                    size_t seq = cells[pos & mask].sequence.load(std::memory_order_acquire);
+                    if (intptr_t(seq) - intptr_t(pos + 1) < 0) return 0; // empty
+                    pos = dequeuePos.load(std::memory_order_relaxed);
+                    continue;
+                }
+                if (dequeuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed)) {
+                    for (size_t i = 0; i < count; ++i)
+                        take(cells[(pos + i) & mask], pos + i, out[i]);
+                    return count;
+                }
+            }
+        }
+
+    private:
+        void take(cell& c, size_t pos, T& out)
+        {
+            out = std::move(c.item());
+            c.item().~T();
+            c.sequence.store(pos + mask + 1, std::memory_order_release); // free for the next lap
+        }
+    };
+
+    /////////////////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Bounded wait-free single-producer single-consumer ring. The producer only writes
+     * the tail and the consumer only writes the head, each on its own cache line
+     * together with a cached copy of the other side's position, so the shared
+     * line is only read again when the ring looks full or empty.
+     * @note Only one thread may push and only one thread may pop at a time
+     */
+    template<class T> class spsc_ring
+    {
+        const size_t mask;
+        std::unique_ptr<std::aligned_storage_t<sizeof(T), alignof(T)>[]> items;
+
+        alignas(cache_line_size) std::atomic<size_t> tail { 0 }; // written by producer
+        size_t cachedHead = 0; // producer's view of head
+
+        alignas(cache_line_size) std::atomic<size_t> head { 0 }; // written by consumer
+        size_t cachedTail = 0; // consumer's view of tail
+
+        T& at(size_t pos) noexcept { return *reinterpret_cast<T*>(&items[pos & mask]); }
+
+    public:
+        using value_type = T;
+
+        /**
+         * @param capacity Maximum number of items, rounded up to a power of two
+         */
+        explicit spsc_ring(size_t capacity)
+            : mask{detail::ring_capacity(capacity) - 1},
+              items{new std::aligned_storage_t<sizeof(T), alignof(T)>[mask + 1]}
+        {
+        }
+
+        ~spsc_ring() noexcept
+        {
+            for (size_t pos = head, end = tail; pos != end; ++pos)
+                at(pos).~T();
+        }
+
+        spsc_ring(const spsc_ring&) = delete;
+        spsc_ring& operator=(const spsc_ring&) = delete;
+
+        size_t capacity() const noexcept { return mask + 1; }
+
+        size_t size_approx() const noexcept
+        {
+            return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+        }
+        bool empty_approx() const noexcept { return size_approx() == 0; }
+
+        /**
+         * Producer only.
+         * @return FALSE if the ring is full, in which case item is not moved from
+         */
+        template<class U> bool try_push(U&& item)
+        {
+            size_t t = tail.load(std::memory_order_relaxed);
+            if (t - cachedHead > mask) {
+                cachedHead = head.load(std::memory_order_acquire);
+                if (t - cachedHead > mask) return false; // full
+            }
+            new (&at(t)) T{ std::forward<U>(item) };
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Consumer only.
+         * @return FALSE if the ring is empty
+         */
+        bool try_pop(T& out)
+        {
+            size_t h = head.load(std::memory_order_relaxed);
+            if (h == cachedTail) {
+                cachedTail = tail.load(std::memory_order_acquire);
+                if (h == cachedTail) return false; // empty
+            }
+            out = std::move(at(h));
+            at(h).~T();
+            head.store(h + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Producer only. Moves up to n items into the ring and publishes them at once
+         * @return Number of items pushed, the first ones of the array
+         */
+        size_t push_n(T* src, size_t n)
+        {
+            size_t t = tail.load(std::memory_order_relaxed);
+            size_t space = mask + 1 - (t - cachedHead);
+            if (space < n) {
+                cachedHead = head.load(std::memory_order_acquire);
+                space = mask + 1 - (t - cachedHead);
+            }
+            size_t count = n < space ? n : space;
+            for (size_t i = 0; i < count; ++i)
+                new (&at(t + i)) T{ std::move(src[i]) };
+            if (count) tail.store(t + count, std::memory_order_release);
+            return count;
+        }
+
+        /**
+         * Consumer only. Pops up to n items and releases their cells at once
+         * @return Number of items written to out
+         */
+        size_t pop_n(T* out, size_t n)
+        {
+            size_t h = head.load(std::memory_order_relaxed);
+            size_t avail = cachedTail - h;
+            if (avail < n) {
+                cachedTail = tail.load(std::memory_order_acquire);
+                avail = cachedTail - h;
+            }
+            size_t count = n < avail ? n : avail;
+            for (size_t i = 0; i < count; ++i) {
+                out[i] = std::move(at(h + i));
+                at(h + i).~T();
+            }
+            if (count) head.store(h + count, std::memory_order_release);
+            return count;
+        }
+    };
+
+    /////////////////////////////////////////////////////////////////////////////////////
 }
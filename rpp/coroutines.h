@@ -0,0 +1,322 @@
+#pragma once
+/**
+ * C++20 coroutine integration for rpp::thread_pool and rpp::cfuture, Copyright (c) 2017-2018, Jorma Rebane
+ * Distributed under MIT Software License
+ * @note Only available if the compiler has coroutine support (-std=c++20), check RPP_HAS_COROUTINES
+ */
+#include "future.h"
+#include <optional>
+
+#if __has_include(<coroutine>) && defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+#  include <coroutine>
+#  define RPP_HAS_COROUTINES 1
+#else
+#  define RPP_HAS_COROUTINES 0
+#endif
+
+#if RPP_HAS_COROUTINES
+namespace rpp
+{
+    template<class T = void> class task;
+
+    namespace detail
+    {
+        // blocking completion flag for non-coroutine callers. The notifier holds the lock
+        // while notifying, so the waiter can safely destroy this as soon as wait() returns
+        struct task_completion
+        {
+            mutex m;
+            condition_variable cv;
+            bool done = false;
+
+            void set() noexcept
+            {
+                lock_guard<mutex> lock{m};
+                done = true;
+                cv.notify_one();
+            }
+            void wait() noexcept
+            {
+                unique_lock<mutex> lock{m};
+                while (!done) cv.wait(lock);
+            }
+        };
+
+        struct task_promise_base
+        {
+            std::coroutine_handle<> continuation; // coroutine which is awaiting this task
+            task_delegate<void()> onDone; // otherwise called when the task finishes
+            exception_ptr error;
+
+            struct final_awaiter
+            {
+                bool await_ready() const noexcept { return false; }
+
+                template<class Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+                {
+                    task_promise_base& p = h.promise();
+                    if (p.continuation)
+                        return p.continuation; // symmetric transfer, no stack growth
+                    // onDone is allowed to destroy this coroutine, so don't touch p afterwards
+                    if (task_delegate<void()> done = move(p.onDone))
+                        done();
+                    return std::noop_coroutine();
+                }
+
+                void await_resume() const noexcept {}
+            };
+
+            std::suspend_always initial_suspend() const noexcept { return {}; }
+            final_awaiter final_suspend() const noexcept { return {}; }
+            void unhandled_exception() noexcept { error = std::current_exception(); }
+        };
+
+        template<class T> struct task_promise : task_promise_base
+        {
+            std::optional<T> value;
+
+            task<T> get_return_object() noexcept;
+
+            template<class U> void return_value(U&& result)
+            {
+                value.emplace(std::forward<U>(result));
+            }
+
+            T result()
+            {
+                if (error) rethrow_exception(error);
+                return move(*value);
+            }
+
+            void set_promise(cpromise<T>& p) { p.set_value(result()); }
+        };
+
+        template<> struct task_promise<void> : task_promise_base
+        {
+            task<void> get_return_object() noexcept;
+
+            void return_void() const noexcept {}
+
+            void result()
+            {
+                if (error) rethrow_exception(error);
+            }
+
+            void set_promise(cpromise<void>& p) { result(); p.set_value(); }
+        };
+    }
+
+
+    /**
+     * Lazily started coroutine task. The coroutine body starts running when the task
+     * is awaited, and resumes its awaiter directly when finished, without any extra threads.
+     * @code
+     * rpp::task<string> load_page(string url)
+     * {
+     *     co_await rpp::schedule_on(rpp::thread_pool::global()); // continue on a pool worker
+     *     string page = co_await rpp::async_task([=] { return download(url); });
+     *     co_return page;
+     * }
+     * rpp::task<int> handle_request(string url)
+     * {
+     *     string page = co_await load_page(url);
+     *     co_return (int)page.size();
+     * }
+     * int size = handle_request("https://example.com").get(); // blocks, only outside of coroutines
+     * @endcode
+     */
+    template<class T> class NODISCARD task
+    {
+    public:
+        using promise_type = detail::task_promise<T>;
+        using handle_type  = std::coroutine_handle<promise_type>;
+
+    private:
+        handle_type coro;
+
+    public:
+        task() noexcept = default;
+        explicit task(handle_type coro) noexcept : coro{coro} {}
+        task(task&& t) noexcept : coro{std::exchange(t.coro, {})} {}
+        task& operator=(task&& t) noexcept
+        {
+            if (this != &t) {
+                if (coro) coro.destroy();
+                coro = std::exchange(t.coro, {});
+            }
+            return *this;
+        }
+        task(const task&) = delete;
+        task& operator=(const task&) = delete;
+        ~task() noexcept
+        {
+            if (coro) coro.destroy();
+        }
+
+        bool valid() const noexcept { return (bool)coro; }
+        bool done() const noexcept { return !coro || coro.done(); }
+
+        struct awaiter
+        {
+            handle_type coro;
+
+            bool await_ready() const noexcept { return !coro || coro.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                coro.promise().continuation = awaiting;
+                return coro; // start the task right here
+            }
+
+            T await_resume()
+            {
+                if (!coro) throw std::future_error{std::future_errc::no_state};
+                return coro.promise().result();
+            }
+        };
+
+        // starts the task and suspends the awaiting coroutine until it finishes
+        awaiter operator co_await() const noexcept { return awaiter{ coro }; }
+
+        /**
+         * Starts the task on the calling thread and blocks until it finishes.
+         * @note Never call this from inside a coroutine, use co_await instead
+         * @throws Any exception thrown by the coroutine, or
+         *         std::future_error if the task is empty, for example after it was moved from
+         */
+        T get()
+        {
+            if (!coro)
+                throw std::future_error{std::future_errc::no_state};
+            if (!coro.done())
+            {
+                detail::task_completion completion;
+                coro.promise().onDone = [&completion] { completion.set(); };
+                coro.resume();
+                completion.wait();
+            }
+            return coro.promise().result();
+        }
+
+        /**
+         * Starts the task on the default global thread pool and returns a future
+         * for its result. The coroutine frame is freed as soon as it finishes.
+         * @throws std::future_error if the task is empty
+         */
+        cfuture<T> start_async() &&
+        {
+            if (!coro)
+                throw std::future_error{std::future_errc::no_state};
+            auto p = std::make_shared<cpromise<T>>();
+            cfuture<T> f = p->get_cfuture();
+            handle_type h = std::exchange(coro, {});
+            h.promise().onDone = [p, h] {
+                try { h.promise().set_promise(*p); }
+                catch (...) { p->set_exception(std::current_exception()); }
+                h.destroy();
+            };
+            rpp::parallel_task([h] { h.resume(); }, overflow_policy::caller_runs);
+            return f;
+        }
+    };
+
+    namespace detail
+    {
+        template<class T> task<T> task_promise<T>::get_return_object() noexcept
+        {
+            return task<T>{ std::coroutine_handle<task_promise<T>>::from_promise(*this) };
+        }
+
+        inline task<void> task_promise<void>::get_return_object() noexcept
+        {
+            return task<void>{ std::coroutine_handle<task_promise<void>>::from_promise(*this) };
+        }
+    }
+
+
+    /**
+     * Awaitable which resumes the awaiting coroutine on a worker of the given pool
+     */
+    struct schedule_awaiter
+    {
+        thread_pool& pool;
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(std::coroutine_handle<> h) noexcept
+        {
+            // the coroutine can finish on a worker before this returns, so this is the last use of *this
+            // if the pool's queue is full, don't suspend and keep running on the current thread
+            return pool.try_parallel_task([h] { h.resume(); });
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    /**
+     * Moves the rest of the coroutine onto a thread_pool worker
+     * @code
+     * rpp::task<> process(Image& img)
+     * {
+     *     co_await rpp::schedule_on(imagePool);
+     *     img.blur(); // now running on imagePool
+     * }
+     * @endcode
+     */
+    inline schedule_awaiter schedule_on(thread_pool& pool = thread_pool::global()) noexcept
+    {
+        return schedule_awaiter{ pool };
+    }
+
+
+    /**
+     * Awaitable for rpp::cfuture. Ready futures continue immediately, otherwise the coroutine
+     * is resumed by the thread which completes the future, without blocking any threads.
+     */
+    template<class T> struct cfuture_awaiter
+    {
+        cfuture<T> f;
+
+        bool await_ready() const
+        {
+            return f.wait_for(std::chrono::seconds{0}) == std::future_status::ready;
+        }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            f.on_ready([h] { h.resume(); });
+        }
+
+        T await_resume() { return f.get(); }
+    };
+
+    template<> struct cfuture_awaiter<void>
+    {
+        cfuture<void> f;
+
+        bool await_ready() const
+        {
+            return f.wait_for(std::chrono::seconds{0}) == std::future_status::ready;
+        }
+
+        void await_suspend(std::coroutine_handle<> h)
+        {
+            f.on_ready([h] { h.resume(); });
+        }
+
+        void await_resume() { f.get(); }
+    };
+
+    /**
+     * Allows co_await on cfutures: the result is returned and exceptions are rethrown
+     * @code
+     * string page = co_await rpp::async_task([=] { return download(url); });
+     * @endcode
+     */
+    template<class T> cfuture_awaiter<T> operator co_await(const cfuture<T>& f)
+    {
+        return cfuture_awaiter<T>{ f };
+    }
+}
+#endif // RPP_HAS_COROUTINES
@@ -52,9 +52,11 @@
  *  @endcode
  */
 #include <cstdlib> // malloc/free for event<()>
-#include <cstring> // memmove for event<()>
 #include <type_traits> // std::decay_t<>
 #include <cassert>
+#include <new> // placement new for inline functors
+#include <memory> // std::addressof
+#include <cstring> // memcpy for function_ref
 #include <utility> // std::forward
 #include "strview.h"
 
@@ -78,8 +80,8 @@ namespace rpp
     /**
      * @brief Function delegate to encapsulate global functions,
      *        instance member functions, lambdas and functors
-     * @note Lambda capture has optimizations for small captures,
-     *       but big lambda captures allocate a dynamic copy
+     * @note Small lambda captures and functors (up to delegate::inline_size bytes)
+     *       are stored inside the delegate, only big captures allocate a dynamic copy
      *
      * @note All delegate calls result in 2 virtual calls:
      *       callable_proxy(...) => myfuncptr(...)
@@ -103,6 +105,7 @@ namespace rpp
         using func_type = Ret (*)(Args...);
         using dtor_type = void (*)(void*);
         using copy_type = void (*)(void*, delegate&);
+        using move_type = void (*)(void* src, void* dst) noexcept; // relocates an inline functor
         struct dummy {};
         #if _MSC_VER  // VC++
             #if !RPP_64BIT // __thiscall only applies for 32-bit MSVC
@@ -129,17 +132,31 @@ namespace rpp
         void*     obj;
         dtor_type destructor;
         copy_type proxy_copy;
+        move_type proxy_move; // only set for functors stored inline
+        // big enough for an rpp::async_task capture: a cpromise and a small task
+        alignas(void*) char storage[6 * sizeof(void*)];
+
+        template<class Func> friend class unique_delegate; // adopts our functor without allocating
 
     public:
+        // max size of functors which are stored inside the delegate without allocating
+        static constexpr size_t inline_size = sizeof(storage);
+
+        // functors which fit are stored inline, they must be nothrow movable to keep delegate moves noexcept
+        template<class FunctorType>
+        static constexpr bool is_stored_inline = sizeof(FunctorType) <= inline_size
+                                              && alignof(FunctorType) <= alignof(void*)
+                                              && std::is_nothrow_move_constructible<FunctorType>::value;
+
         //////////////////////////////////////////////////////////////////////////////////////
 
         /** @brief Default constructor */
-        delegate() noexcept : func(nullptr), obj(nullptr), destructor(nullptr), proxy_copy(nullptr)
+        delegate() noexcept : func(nullptr), obj(nullptr), destructor(nullptr), proxy_copy(nullptr), proxy_move(nullptr)
         {
         }
 
         /** @brief Default constructor from nullptr */
-        explicit delegate(std::nullptr_t) noexcept : func(nullptr), obj(nullptr), destructor(nullptr), proxy_copy(nullptr)
+        explicit delegate(std::nullptr_t) noexcept : func(nullptr), obj(nullptr), destructor(nullptr), proxy_copy(nullptr), proxy_move(nullptr)
         {
         }
 
@@ -155,9 +172,7 @@ namespace rpp
         {
             if (destructor) // looks like we have a functor
             {
-                proxy_copy(obj, to);
-                to.func       = func;
-                to.proxy_copy = proxy_copy;
+                proxy_copy(obj, to); // sets up the functor copy, inline or dynamic
             }
             else
             {
@@ -167,7 +182,7 @@ namespace rpp
         }
 
         /** @brief Creates a copy of the delegate */
-        delegate(const delegate& d) noexcept : func(nullptr), obj(nullptr), destructor(nullptr), proxy_copy(nullptr)
+        delegate(const delegate& d) noexcept : func(nullptr), obj(nullptr), destructor(nullptr), proxy_copy(nullptr), proxy_move(nullptr)
         {
             d.copy(*this);
         }
@@ -176,45 +191,49 @@ namespace rpp
         {
             if (this != &d)
             {
-                this->~delegate();
+                reset();
                 d.copy(*this);
             }
             return *this;
         }
+    private:
+        // steals the state of `d` into this uninitialized delegate and clears `d`
+        void move_from(delegate& d) noexcept
+        {
+            func       = d.func;
+            obj        = d.obj;
+            destructor = d.destructor;
+            proxy_copy = d.proxy_copy;
+            proxy_move = d.proxy_move;
+            if (proxy_move) { // inline functor must be moved into our own storage
+                proxy_move(d.obj, storage);
+                obj = storage;
+            }
+            d.init_clear();
+        }
+
+    public:
         /** @brief Forward reference initialization (move) */
-        delegate(delegate&& d) noexcept 
-            : func      { d.func }, 
-              obj       { d.obj  },
-              destructor{ d.destructor },
-              proxy_copy{ d.proxy_copy }
+        delegate(delegate&& d) noexcept
         {
-            d.func       = nullptr;
-            d.obj        = nullptr;
-            d.destructor = nullptr;
-            d.proxy_copy = nullptr;
+            move_from(d);
         }
         /** @brief Forward reference assignment (swap) */
         delegate& operator=(delegate&& d) noexcept
         {
-            auto _func       = func;
-            auto _obj        = obj;
-            auto _destructor = destructor;
-            auto _proxy_copy = proxy_copy;
-            func       = d.func;
-            obj        = d.obj;
-            destructor = d.destructor;
-            proxy_copy = d.proxy_copy;
-            d.func       = _func;
-            d.obj        = _obj;
-            d.destructor = _destructor;
-            d.proxy_copy = _proxy_copy;
+            if (this != &d)
+            {
+                delegate tmp { std::move(d) };
+                d.move_from(*this);
+                move_from(tmp);
+            }
             return *this;
         }
 
         //////////////////////////////////////////////////////////////////////////////////////
 
         /** @brief Regular function constructor */
-        delegate(func_type function) noexcept : func(function), obj(nullptr), destructor(nullptr), proxy_copy(nullptr)
+        delegate(func_type function) noexcept : func(function), obj(nullptr), destructor(nullptr), proxy_copy(nullptr), proxy_move(nullptr)
         {
         }
 
@@ -260,6 +279,7 @@ namespace rpp
             #endif
             destructor = nullptr;
             proxy_copy = nullptr;
+            proxy_move = nullptr;
         }
         template<class IClass, class FClass> void init_method(const IClass& inst, Ret (FClass::*method)(Args...) const) noexcept
         {
@@ -273,6 +293,7 @@ namespace rpp
             #endif
             destructor = nullptr;
             proxy_copy = nullptr;
+            proxy_move = nullptr;
         }
 
         union method_helper
@@ -314,6 +335,7 @@ namespace rpp
             obj        = nullptr;
             destructor = nullptr;
             proxy_copy = nullptr;
+            proxy_move = nullptr;
         }
 
     public:
@@ -361,19 +383,38 @@ namespace rpp
         template<class Functor> void init_functor(Functor&& ftor) noexcept
         {
             typedef typename std::decay<Functor>::type FunctorType;
+            static_assert(std::is_copy_constructible<FunctorType>::value,
+                          "rpp::delegate is copyable, so it can't hold a move-only functor: use rpp::unique_delegate");
 
             dfunc = (dummy_type)&FunctorType::operator();
 
-            obj  = new FunctorType(std::forward<Functor>(ftor));
-            destructor = [](void* obj)
+            if constexpr (is_stored_inline<FunctorType>)
             {
-                auto* instance = (FunctorType*)obj;
-                delete instance;
-            };
+                obj = new (storage) FunctorType(std::forward<Functor>(ftor));
+                destructor = [](void* obj)
+                {
+                    ((FunctorType*)obj)->~FunctorType();
+                };
+                proxy_move = [](void* obj, void* dest) noexcept
+                {
+                    auto* instance = (FunctorType*)obj;
+                    new (dest) FunctorType(std::move(*instance));
+                    instance->~FunctorType();
+                };
+            }
+            else
+            {
+                obj = new FunctorType(std::forward<Functor>(ftor));
+                destructor = [](void* obj)
+                {
+                    auto* instance = (FunctorType*)obj;
+                    delete instance;
+                };
+                proxy_move = nullptr; // moving just steals the pointer
+            }
             proxy_copy = [](void* obj, delegate& dest)
             {
-                auto* instance = (FunctorType*)obj;
-                dest.reset(*instance);
+                dest.reset((const FunctorType&)*(FunctorType*)obj);
             };
         }
 
@@ -413,7 +454,7 @@ namespace rpp
         template<class Functor, typename = enable_if_callable_t<Functor>>
         delegate(Functor&& ftor) noexcept
         {
-            init_functor(std::move(ftor));
+            init_functor(std::forward<Functor>(ftor));
         }
 
         template<class Functor, typename = enable_if_callable_t<Functor>>
@@ -461,7 +502,7 @@ namespace rpp
         void reset(Functor&& ftor) noexcept
         {
             reset();
-            init_functor(std::move(ftor));
+            init_functor(std::forward<Functor>(ftor));
         }
         template<class Functor, typename = enable_if_callable_t<Functor>>
         void reset(const Functor& ftor) noexcept
@@ -477,6 +518,7 @@ namespace rpp
                 destructor(obj);
                 destructor = nullptr;
                 proxy_copy = nullptr;
+                proxy_move = nullptr;
             }
             func = nullptr;
             obj  = nullptr;
@@ -496,7 +538,8 @@ namespace rpp
             reset(function);
             return *this;
         }
-        template<class Functor> delegate& operator=(Functor&& functor)
+        template<class Functor, typename = enable_if_callable_t<Functor>>
+        delegate& operator=(Functor&& functor)
         {
             reset(std::forward<Functor>(functor));
             return *this;
@@ -603,6 +646,339 @@ namespace rpp
     }
 
 
+    /**
+     * @brief Move-only owning delegate for tasks and callbacks which capture
+     *        move-only state such as std::unique_ptr or rpp::socket
+     * @note Functors up to unique_delegate::inline_size bytes are stored inside
+     *       the delegate, only big captures allocate a dynamic copy
+     *
+     * @example
+     *
+     *        auto file = std::make_unique<File>("log.txt");
+     *        unique_delegate<void()> flush = [file=std::move(file)] { file->flush(); };
+     *        pool.parallel_task(std::move(flush));
+     */
+    template<class Func> class unique_delegate;
+    template<class Ret, class... Args> class unique_delegate<Ret(Args...)>
+    {
+    public:
+        using ret_type  = Ret;
+        using func_type = Ret (*)(Args...);
+        using call_type = Ret (*)(void*, Args...);
+        using dtor_type = void (*)(void*);
+        using move_type = void (*)(void* src, void* dst) noexcept; // relocates an inline functor
+
+    private:
+        call_type call;
+        void*     obj;
+        dtor_type destructor;
+        move_type proxy_move; // only set for functors stored inline
+        alignas(void*) char storage[6 * sizeof(void*)]; // same as delegate, fits async_task captures
+
+    public:
+        // max size of functors which are stored inside the delegate without allocating
+        static constexpr size_t inline_size = sizeof(storage);
+
+        template<class FunctorType>
+        static constexpr bool is_stored_inline = sizeof(FunctorType) <= inline_size
+                                              && alignof(FunctorType) <= alignof(void*)
+                                              && std::is_nothrow_move_constructible<FunctorType>::value;
+
+        // not unique_delegate or delegate and Functor matches `Ret(Args...)`
+        template<class Functor>
+        using enable_if_callable_t = std::enable_if_t<!std::is_same<std::decay_t<Functor>, unique_delegate>::value
+                                                   && !std::is_same<std::decay_t<Functor>, delegate<Ret(Args...)>>::value
+                                                   && std::is_invocable_r<Ret, std::decay_t<Functor>&, Args...>::value>;
+
+        unique_delegate() noexcept : call(nullptr), obj(nullptr), destructor(nullptr), proxy_move(nullptr)
+        {
+        }
+        unique_delegate(std::nullptr_t) noexcept : call(nullptr), obj(nullptr), destructor(nullptr), proxy_move(nullptr)
+        {
+        }
+        ~unique_delegate() noexcept
+        {
+            if (destructor) {
+                destructor(obj);
+            }
+        }
+
+        unique_delegate(const unique_delegate&) = delete;
+        unique_delegate& operator=(const unique_delegate&) = delete;
+
+        unique_delegate(unique_delegate&& d) noexcept
+        {
+            move_from(d);
+        }
+        /** @brief Move assignment, destroys the current functor first */
+        unique_delegate& operator=(unique_delegate&& d) noexcept
+        {
+            if (this != &d)
+            {
+                reset();
+                move_from(d);
+            }
+            return *this;
+        }
+
+        /** @brief Regular function constructor */
+        unique_delegate(func_type function) noexcept : unique_delegate()
+        {
+            if (function) init_functor(function);
+        }
+
+        /**
+         * @brief Object member function constructor
+         * @code
+         *   unique_delegate<void()> d(&myClass, &MyClass::method);
+         * @endcode
+         */
+        template<class IClass, class FClass>
+        unique_delegate(IClass* inst, Ret (FClass::*method)(Args...)) noexcept : unique_delegate()
+        {
+            if (inst) init_functor([inst, method](Args... args) -> Ret {
+                return (inst->*method)(std::forward<Args>(args)...);
+            });
+        }
+        template<class IClass, class FClass>
+        unique_delegate(const IClass* inst, Ret (FClass::*method)(Args...) const) noexcept : unique_delegate()
+        {
+            if (inst) init_functor([inst, method](Args... args) -> Ret {
+                return (inst->*method)(std::forward<Args>(args)...);
+            });
+        }
+        template<class IClass, class FClass>
+        unique_delegate(IClass& inst, Ret (FClass::*method)(Args...)) noexcept
+            : unique_delegate(&inst, method)
+        {
+        }
+        template<class IClass, class FClass>
+        unique_delegate(const IClass& inst, Ret (FClass::*method)(Args...) const) noexcept
+            : unique_delegate(&inst, method)
+        {
+        }
+
+        /**
+         * @brief Takes over the target of an rpp::delegate without allocating:
+         *        inline functors are moved into our own storage, dynamic ones are stolen
+         */
+        unique_delegate(delegate<Ret(Args...)>&& d) noexcept : unique_delegate()
+        {
+            adopt(d);
+        }
+        unique_delegate(const delegate<Ret(Args...)>& d) noexcept
+            : unique_delegate(delegate<Ret(Args...)>{ d })
+        {
+        }
+
+        /**
+         * @brief Functor constructor for lambdas, functors and function_ref
+         * @code
+         *   unique_delegate<void()> d = [sock=std::move(sock)] { sock.send("bye"); };
+         * @endcode
+         */
+        template<class Functor, typename = enable_if_callable_t<Functor>>
+        unique_delegate(Functor&& ftor) noexcept : unique_delegate()
+        {
+            init_functor(std::forward<Functor>(ftor));
+        }
+
+        template<class Functor, typename = enable_if_callable_t<Functor>>
+        unique_delegate& operator=(Functor&& ftor) noexcept
+        {
+            reset();
+            init_functor(std::forward<Functor>(ftor));
+            return *this;
+        }
+
+        /** @brief Resets the delegate to its default uninitialized state */
+        void reset() noexcept
+        {
+            if (destructor) {
+                destructor(obj);
+                destructor = nullptr;
+                proxy_move = nullptr;
+            }
+            call = nullptr;
+            obj  = nullptr;
+        }
+
+        /** @return true if this delegate is initialized and can be called */
+        explicit operator bool() const noexcept { return call != nullptr; }
+
+        bool operator==(std::nullptr_t) const noexcept { return call == nullptr; }
+        bool operator!=(std::nullptr_t) const noexcept { return call != nullptr; }
+
+        /**
+         * @brief Invoke the delegate with specified args list
+         */
+        Ret operator()(Args... args) const
+        {
+            return call(obj, std::forward<Args>(args)...);
+        }
+        Ret invoke(Args... args) const
+        {
+            return call(obj, std::forward<Args>(args)...);
+        }
+
+    private:
+        // steals the state of `d` into this uninitialized delegate and clears `d`
+        void move_from(unique_delegate& d) noexcept
+        {
+            call       = d.call;
+            obj        = d.obj;
+            destructor = d.destructor;
+            proxy_move = d.proxy_move;
+            if (proxy_move) { // inline functor must be moved into our own storage
+                proxy_move(d.obj, storage);
+                obj = storage;
+            }
+            d.call       = nullptr;
+            d.obj        = nullptr;
+            d.destructor = nullptr;
+            d.proxy_move = nullptr;
+        }
+
+        void adopt(delegate<Ret(Args...)>& d) noexcept
+        {
+            static_assert(inline_size >= delegate<Ret(Args...)>::inline_size,
+                          "inline delegate functors must fit into unique_delegate");
+            if (!d) return;
+            if (!d.obj) // regular function
+            {
+                init_functor(d.func);
+                d.init_clear();
+                return;
+            }
+        #if _MSC_VER // member function pointers can't be called through a plain function pointer
+            init_functor(std::move(d));
+        #else
+            call       = d.mfunc; // called exactly like delegate::operator() does
+            obj        = d.obj;
+            destructor = d.destructor;
+            proxy_move = d.proxy_move;
+            if (proxy_move) {
+                proxy_move(d.obj, storage);
+                obj = storage;
+            }
+            d.init_clear();
+        #endif
+        }
+
+        template<class Functor> void init_functor(Functor&& ftor) noexcept
+        {
+            using FunctorType = std::decay_t<Functor>;
+
+            call = [](void* obj, Args... args) -> Ret
+            {
+                return (Ret)(*(FunctorType*)obj)(std::forward<Args>(args)...);
+            };
+            if constexpr (is_stored_inline<FunctorType>)
+            {
+                obj = new (storage) FunctorType(std::forward<Functor>(ftor));
+                destructor = [](void* obj) noexcept
+                {
+                    ((FunctorType*)obj)->~FunctorType();
+                };
+                proxy_move = [](void* obj, void* dest) noexcept
+                {
+                    auto* instance = (FunctorType*)obj;
+                    new (dest) FunctorType(std::move(*instance));
+                    instance->~FunctorType();
+                };
+            }
+            else
+            {
+                obj = new FunctorType(std::forward<Functor>(ftor));
+                destructor = [](void* obj) noexcept
+                {
+                    delete (FunctorType*)obj;
+                };
+                proxy_move = nullptr; // moving just steals the pointer
+            }
+        }
+    };
+
+
+    /**
+     * @brief Non-owning reference to a callable, it never allocates and is
+     *        cheap to pass by value, for callbacks which are only used during a call
+     * @note The referenced callable must outlive the function_ref
+     *
+     * @example
+     *
+     *        void for_each_line(strview text, function_ref<void(strview)> callback);
+     *        for_each_line(text, [&](strview line) { lines.push_back(line); });
+     */
+    template<class Func> class function_ref;
+    template<class Ret, class... Args> class function_ref<Ret(Args...)>
+    {
+    public:
+        using ret_type  = Ret;
+        using func_type = Ret (*)(Args...);
+        using call_type = Ret (*)(void*, Args...);
+
+    private:
+        void*     obj; // referenced callable or the function pointer itself
+        call_type call;
+
+    public:
+        // not function_ref itself and Functor matches `Ret(Args...)`
+        template<class Functor>
+        using enable_if_callable_t = std::enable_if_t<!std::is_same<std::decay_t<Functor>, function_ref>::value
+                                                   && !std::is_pointer<std::decay_t<Functor>>::value
+                                                   && std::is_invocable_r<Ret, Functor&, Args...>::value>;
+
+        function_ref() noexcept : obj(nullptr), call(nullptr)
+        {
+        }
+
+        /** @brief Regular function constructor */
+        function_ref(func_type function) noexcept : obj(nullptr), call(nullptr)
+        {
+            static_assert(sizeof(func_type) == sizeof(void*), "function pointer must fit in obj");
+            memcpy(&obj, &function, sizeof(function));
+            if (function) call = [](void* obj, Args... args) -> Ret
+            {
+                func_type function;
+                memcpy(&function, &obj, sizeof(function));
+                return (Ret)function(std::forward<Args>(args)...);
+            };
+        }
+
+        /** @brief References a lambda or functor, which must outlive this function_ref */
+        template<class Functor, typename = enable_if_callable_t<Functor>>
+        function_ref(Functor&& ftor) noexcept : obj((void*)std::addressof(ftor))
+        {
+            call = [](void* obj, Args... args) -> Ret
+            {
+                return (Ret)(*(std::remove_reference_t<Functor>*)obj)(std::forward<Args>(args)...);
+            };
+        }
+
+        /** @return true if this function_ref references a callable */
+        explicit operator bool() const noexcept { return call != nullptr; }
+
+        /**
+         * @brief Invoke the referenced callable with specified args list
+         */
+        Ret operator()(Args... args) const
+        {
+            return call(obj, std::forward<Args>(args)...);
+        }
+        Ret invoke(Args... args) const
+        {
+            return call(obj, std::forward<Args>(args)...);
+        }
+    };
+
+    namespace detail
+    {
+        template<class T> struct is_function_ref : std::false_type {};
+        template<class Sig> struct is_function_ref<function_ref<Sig>> : std::true_type {};
+    }
+
+
 
     /**
      * @brief A delegate container object
@@ -707,11 +1083,20 @@ namespace rpp
             }
             else if (ptr->size == ptr->capacity)
             {
-                ptr->capacity += 3;
-                if (int rem = ptr->capacity % 4)
-                    ptr->capacity += 4 - rem;
-                ptr = (container*)realloc(ptr,
-                    sizeof(container) + sizeof(deleg) * (ptr->capacity - 1));
+                int capacity = ptr->capacity + 3;
+                if (int rem = capacity % 4)
+                    capacity += 4 - rem;
+                // delegates can hold their functor inline, so they are moved instead of realloc-ed
+                auto* grown = (container*)malloc(sizeof(container) + sizeof(deleg) * (capacity - 1));
+                grown->size = ptr->size;
+                grown->capacity = capacity;
+                for (int i = 0; i < ptr->size; ++i)
+                {
+                    new (&grown->data[i]) deleg((deleg&&)ptr->data[i]);
+                    ptr->data[i].~deleg();
+                }
+                free(ptr);
+                ptr = grown;
             }
         }
 
@@ -742,7 +1127,9 @@ namespace rpp
             {
                 if (data[i] == d)
                 {
-                    memmove(&data[i], &data[i + 1], sizeof(deleg)*(size - i - 1)); // unshift
+                    for (int j = i + 1; j < size; ++j) // unshift
+                        data[j - 1] = (deleg&&)data[j];
+                    data[size - 1].~deleg();
                     --ptr->size;
                     return;
                 }
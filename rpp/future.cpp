@@ -0,0 +1,24 @@
+#include "future.h"
+#include <cstdio>
+#if __has_include("debugging.h")
+# include "debugging.h"
+#endif
+
+namespace rpp
+{
+    ///////////////////////////////////////////////////////////////////////////////
+
+    namespace detail
+    {
+        void unhandled_continuation_exception(const char* what) noexcept
+        {
+        #ifdef LogWarning
+            LogWarning("cfuture continuation threw: %s", what);
+        #else
+            fprintf(stderr, "cfuture continuation threw: %s\n", what);
+        #endif
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+}
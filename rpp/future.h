@@ -8,6 +8,8 @@
 #include <future>
 #include "thread_pool.h"
 #include <type_traits>
+#include <tuple>
+#include <stdexcept> // std::invalid_argument
 
 namespace rpp
 {
@@ -22,9 +24,148 @@ namespace rpp
 
     ////////////////////////////////////////////////////////////////////////////////
 
+    namespace detail
+    {
+        // logs an exception thrown by a cfuture continuation, which has no caller to propagate to
+        RPPAPI void unhandled_continuation_exception(const char* what) noexcept;
+
+        /**
+         * Continuations registered on the futures of a single cpromise.
+         * They run on the thread which fulfills the promise, or on a pool worker
+         * if they were registered after the promise was already fulfilled.
+         * Completing a continuation's own promise runs the next ones inline as well,
+         * so past max_inline_depth the rest of a long then() chain continues on the
+         * pool instead of growing the stack of the completing thread.
+         * @note Exceptions thrown by continuations are caught and logged as warnings
+         */
+        struct cfuture_continuations
+        {
+            static constexpr int max_inline_depth = 16;
+
+            mutex m;
+            bool completed = false;
+            task_delegate<void()> first; // most futures only get a single then(), which doesn't need the vector
+            vector<task_delegate<void()>> continuations;
+
+            void add(task_delegate<void()>&& continuation) noexcept
+            {
+                { lock_guard<mutex> lock{m};
+                    if (!completed) {
+                        if (!first) first = move(continuation);
+                        else continuations.emplace_back(move(continuation));
+                        return;
+                    }
+                }
+                schedule(move(continuation));
+            }
+
+            void complete() noexcept
+            {
+                task_delegate<void()> head;
+                vector<task_delegate<void()>> ready;
+                { lock_guard<mutex> lock{m};
+                    completed = true;
+                    head = move(first);
+                    ready.swap(continuations);
+                }
+                if (head) run_or_schedule(head);
+                for (task_delegate<void()>& continuation : ready)
+                    run_or_schedule(continuation);
+            }
+
+            bool is_completed() noexcept
+            {
+                lock_guard<mutex> lock{m};
+                return completed;
+            }
+
+            // runs the continuation on the pool
+            static void schedule(task_delegate<void()>&& continuation) noexcept
+            {
+                rpp::parallel_task([c=move(continuation)] { run(c); }, overflow_policy::caller_runs);
+            }
+
+            // runs the continuation, any exception is reported instead of propagated
+            static void run(const task_delegate<void()>& continuation) noexcept
+            {
+                try {
+                    continuation();
+                } catch (const std::exception& e) {
+                    unhandled_continuation_exception(e.what());
+                } catch (...) {
+                    unhandled_continuation_exception("unknown exception");
+                }
+            }
+
+        private:
+            // runs the continuation inline, unless the chain is already max_inline_depth deep
+            static void run_or_schedule(task_delegate<void()>& continuation) noexcept
+            {
+                int& depth = inline_depth();
+                if (depth >= max_inline_depth) {
+                    schedule(move(continuation));
+                    return;
+                }
+                ++depth;
+                run(continuation);
+                --depth;
+            }
+
+            // number of nested complete() calls running continuations on this thread
+            static int& inline_depth() noexcept
+            {
+                static thread_local int depth = 0;
+                return depth;
+            }
+        };
+
+        using cfuture_continuations_ptr = std::shared_ptr<cfuture_continuations>;
+
+        // base of cpromise<T>, runs the registered continuations once the value is set
+        template<class T> struct cpromise_base : std::promise<T>
+        {
+            cfuture_continuations_ptr continuations = std::make_shared<cfuture_continuations>();
+
+            cpromise_base() = default;
+            cpromise_base(cpromise_base&&) noexcept = default;
+            cpromise_base& operator=(cpromise_base&&) noexcept = default;
+            ~cpromise_base() noexcept
+            {
+                // an abandoned promise must still release its continuations
+                if (continuations && !continuations->is_completed())
+                {
+                    try { std::promise<T>::set_exception(std::make_exception_ptr(
+                              std::future_error{std::future_errc::broken_promise})); }
+                    catch (...) {} // get_future() was never called
+                    continuations->complete();
+                }
+            }
 
-    template<class T> struct cpromise : std::promise<T>
+            // gets a cfuture which supports non-blocking then() and continue_with()
+            cfuture<T> get_cfuture();
+
+            void set_exception(exception_ptr e)
+            {
+                std::promise<T>::set_exception(e);
+                continuations->complete();
+            }
+        };
+    }
+
+    template<class T> struct cpromise : detail::cpromise_base<T>
     {
+        void set_value(T&& value)
+        {
+            std::promise<T>::set_value(move(value));
+            this->continuations->complete();
+        }
+
+        void set_value(const T& value)
+        {
+            std::promise<T>::set_value(value);
+            this->continuations->complete();
+        }
+
         template<class Task> void compose(Task& task)
         {
             T value = task();
@@ -34,12 +175,18 @@ namespace rpp
                 Task t = move(task);
                 (void)t;
             }
-            std::promise<T>::set_value(move(value));
+            set_value(move(value));
         }
     };
 
-    template<> struct cpromise<void> : std::promise<void>
+    template<> struct cpromise<void> : detail::cpromise_base<void>
     {
+        void set_value()
+        {
+            std::promise<void>::set_value();
+            this->continuations->complete();
+        }
+
         template<class Task> void compose(Task& task)
         {
             task();
@@ -49,7 +196,7 @@ namespace rpp
                 Task t = move(task);
                 (void)t;
             }
-            std::promise<void>::set_value();
+            set_value();
         }
     };
 
@@ -59,7 +206,7 @@ namespace rpp
     {
         using T = decltype(task());
         cpromise<T> p;
-        shared_future<T> f = p.get_future().share();
+        cfuture<T> f = p.get_cfuture();
         rpp::parallel_task([move_args(p, task)]() mutable
         {
             try {
@@ -67,6 +214,61 @@ namespace rpp
             } catch (...) {
                 p.set_exception(std::current_exception());
             }
+        }, overflow_policy::caller_runs); // a full queue must never leave the promise unset
+        return f;
+    }
+
+    /**
+     * Runs a cancellable async task. If the token is cancelled before the task
+     * starts, the task is skipped and the future fails with rpp::task_cancelled.
+     * Long running tasks can also poll token.throw_if_cancelled() themselves.
+     * @code
+     * rpp::cancellation_source disconnected;
+     * cfuture<Page> page = rpp::async_task([=] { return render(req); }, disconnected.token());
+     * @endcode
+     */
+    template<class Task>
+    auto async_task(Task&& task, cancellation_token token) -> cfuture<decltype(task())>
+    {
+        using T = decltype(task());
+        cpromise<T> p;
+        cfuture<T> f = p.get_cfuture();
+        rpp::parallel_task([move_args(p, task, token)]() mutable
+        {
+            try {
+                token.throw_if_cancelled();
+                p.compose(task);
+            } catch (...) {
+                p.set_exception(std::current_exception());
+            }
+        }, overflow_policy::caller_runs); // a full queue must never leave the promise unset
+        return f;
+    }
+
+
+    /**
+     * Runs the task on the default global thread pool once the delay has passed,
+     * and returns a future for its result. If the token is cancelled before
+     * the task comes due, the future fails with rpp::task_cancelled.
+     * @code
+     * cfuture<Status> status = rpp::async_task_after(5s, [=] { return poll(job); });
+     * @endcode
+     */
+    template<class Rep, class Period, class Task>
+    auto async_task_after(std::chrono::duration<Rep, Period> delay, Task&& task,
+                          cancellation_token token = {}) -> cfuture<decltype(task())>
+    {
+        using T = decltype(task());
+        cpromise<T> p;
+        cfuture<T> f = p.get_cfuture();
+        thread_pool::global().schedule_after(delay, [move_args(p, task, token)]() mutable
+        {
+            try {
+                token.throw_if_cancelled();
+                p.compose(task);
+            } catch (...) {
+                p.set_exception(std::current_exception());
+            }
         });
         return f;
     }
@@ -121,6 +323,18 @@ namespace rpp
         using future_type = std::decay_t<decltype(std::declval<Future>().get())>;
     }
 
+    namespace detail
+    {
+        // runs cont(f) once f is ready and returns a future for the result
+        template<class T, class Continuation>
+        auto chain_future(cfuture<T>&& f, Continuation&& cont)
+            -> cfuture<decltype(cont(std::declval<cfuture<T>&>()))>;
+
+        // runs cont(f) once f is ready
+        template<class T, class Continuation>
+        void chain_continuation(cfuture<T>&& f, Continuation&& cont);
+    }
+
 
     ////////////////////////////////////////////////////////////////////////////////
 
@@ -128,6 +342,8 @@ namespace rpp
     template<class T> class NODISCARD cfuture : public shared_future<T>
     {
         using super = shared_future<T>;
+        // only set for futures created through cpromise, such as rpp::async_task
+        detail::cfuture_continuations_ptr state;
     public:
         cfuture() noexcept = default;
         cfuture(future<T>&& f) noexcept : super(move(f))
@@ -136,29 +352,37 @@ namespace rpp
         cfuture(shared_future<T>&& f) noexcept : super(move(f))
         {
         }
-        cfuture(cfuture&& f) noexcept : super(move(f))
+        cfuture(shared_future<T>&& f, detail::cfuture_continuations_ptr state) noexcept
+            : super(move(f)), state(move(state))
         {
         }
-        cfuture(const cfuture& f) noexcept : super(f)
+        cfuture(cfuture&& f) noexcept : super(move(f)), state(move(f.state))
+        {
+        }
+        cfuture(const cfuture& f) noexcept : super(f), state(f.state)
         {
         }
         cfuture& operator=(future<T>&& f) noexcept
         {
             super::operator=(move(f));
+            state.reset();
             return *this;
         }
         cfuture& operator=(shared_future<T>&& f) noexcept
         {
             super::operator=(move(f));
+            state.reset();
             return *this;
         }
         cfuture& operator=(cfuture&& f) noexcept
         {
             super::operator=(move(f));
+            state = move(f.state);
             return *this;
         }
         cfuture& operator=(const cfuture& f) noexcept
         {
+            state = f.state;
             super::operator=(f);
             return *this;
         }
@@ -168,13 +392,30 @@ namespace rpp
                 this->wait();
         }
 
+        // continuation state shared with the cpromise, null if this future wasn't created by one
+        const detail::cfuture_continuations_ptr& continuations() const noexcept { return state; }
+
+        /**
+         * Runs the callback once this future is ready. Futures from cpromise/async_task
+         * don't occupy any threads while pending, others are waited on by a pool task.
+         * @note Exceptions thrown by the callback are caught and reported, never propagated
+         */
+        void on_ready(task_delegate<void()>&& callback) const
+        {
+            if (state) state->add(move(callback));
+            else rpp::parallel_task([f=*this, callback=move(callback)]() mutable {
+                f.wait();
+                detail::cfuture_continuations::run(callback);
+            }, overflow_policy::caller_runs);
+        }
+
         // downcast chain cfuture<T> to cfuture<void>
         cfuture<void> then();
 
         template<class Task>
         cfuture<ret_type<Task>> then(Task&& task)
         {
-            return rpp::async_task([f=move(*this), move_args(task)]() mutable {
+            return detail::chain_future(move(*this), [move_args(task)](cfuture& f) mutable {
                 return task(f.get());
             });
         }
@@ -183,7 +424,7 @@ namespace rpp
         cfuture<ret_type<Task>> then(Task&& task, ExceptHA&& exhA)
         {
             using ExceptA = first_arg_type<ExceptHA>;
-            return async_task([f=move(*this), move_args(task, exhA)]() mutable {
+            return detail::chain_future(move(*this), [move_args(task, exhA)](cfuture& f) mutable {
                 try { return task(f.get()); } 
                 catch (ExceptA& a) { return exhA(a); }
             });
@@ -194,7 +435,7 @@ namespace rpp
         {
             using ExceptA = first_arg_type<ExceptHA>;
             using ExceptB = first_arg_type<ExceptHB>;
-            return async_task([f=move(*this), move_args(task, exhA, exhB)]() mutable {
+            return detail::chain_future(move(*this), [move_args(task, exhA, exhB)](cfuture& f) mutable {
                 try { return task(f.get()); }
                 catch (ExceptA& a) { return exhA(a); }
                 catch (ExceptB& b) { return exhB(b); }
@@ -207,7 +448,7 @@ namespace rpp
             using ExceptA = first_arg_type<ExceptHA>;
             using ExceptB = first_arg_type<ExceptHB>;
             using ExceptC = first_arg_type<ExceptHC>;
-            return async_task([f=move(*this), move_args(task, exhA, exhB, exhC)]() mutable {
+            return detail::chain_future(move(*this), [move_args(task, exhA, exhB, exhC)](cfuture& f) mutable {
                 try { return task(f.get()); }
                 catch (ExceptA& a) { return exhA(a); }
                 catch (ExceptB& b) { return exhB(b); }
@@ -222,7 +463,7 @@ namespace rpp
             using ExceptB = first_arg_type<ExceptHB>;
             using ExceptC = first_arg_type<ExceptHC>;
             using ExceptD = first_arg_type<ExceptHD>;
-            return async_task([f = move(*this), move_args(task, exhA, exhB, exhC, exhD)]() mutable {
+            return detail::chain_future(move(*this), [move_args(task, exhA, exhB, exhC, exhD)](cfuture& f) mutable {
                 try { return task(f.get()); }
                 catch (ExceptA& a) { return exhA(a); }
                 catch (ExceptB& b) { return exhB(b); }
@@ -235,7 +476,7 @@ namespace rpp
         template<class Task>
         void continue_with(Task&& task)
         {
-            rpp::parallel_task([f=move(*this), move_args(task)]() mutable {
+            detail::chain_continuation(move(*this), [move_args(task)](cfuture& f) mutable {
                 (void)task(f.get());
             });
         }
@@ -244,7 +485,7 @@ namespace rpp
         void continue_with(Task&& task, ExceptHA&& exhA)
         {
             using ExceptA = first_arg_type<ExceptHA>;
-            rpp::parallel_task([f=move(*this), move_args(task, exhA)]() mutable {
+            detail::chain_continuation(move(*this), [move_args(task, exhA)](cfuture& f) mutable {
                 try { (void)task(f.get()); }
                 catch (ExceptA& a) { (void)exhA(a); }
             });
@@ -255,7 +496,7 @@ namespace rpp
         {
             using ExceptA = first_arg_type<ExceptHA>;
             using ExceptB = first_arg_type<ExceptHB>;
-            rpp::parallel_task([f=move(*this), move_args(task, exhA, exhB)]() mutable {
+            detail::chain_continuation(move(*this), [move_args(task, exhA, exhB)](cfuture& f) mutable {
                 try { (void)task(f.get()); }
                 catch (ExceptA& a) { (void)exhA(a); }
                 catch (ExceptB& b) { (void)exhB(b); }
@@ -268,7 +509,7 @@ namespace rpp
             using ExceptA = first_arg_type<ExceptHA>;
             using ExceptB = first_arg_type<ExceptHB>;
             using ExceptC = first_arg_type<ExceptHC>;
-            rpp::parallel_task([f=move(*this), move_args(task, exhA, exhB, exhC)]() mutable {
+            detail::chain_continuation(move(*this), [move_args(task, exhA, exhB, exhC)](cfuture& f) mutable {
                 try { (void)task(f.get()); }
                 catch (ExceptA& a) { (void)exhA(a); }
                 catch (ExceptB& b) { (void)exhB(b); }
@@ -283,7 +524,7 @@ namespace rpp
             using ExceptB = first_arg_type<ExceptHB>;
             using ExceptC = first_arg_type<ExceptHC>;
             using ExceptD = first_arg_type<ExceptHD>;
-            rpp::parallel_task([f = move(*this), move_args(task, exhA, exhB, exhC, exhD)]() mutable {
+            detail::chain_continuation(move(*this), [move_args(task, exhA, exhB, exhC, exhD)](cfuture& f) mutable {
                 try { (void)task(f.get()); }
                 catch (ExceptA& a) { (void)exhA(a); }
                 catch (ExceptB& b) { (void)exhB(b); }
@@ -295,7 +536,7 @@ namespace rpp
         // abandons this future and prevents any waiting in destructor
         void detach()
         {
-            if (this->valid()) rpp::parallel_task([f = move(*this)]() mutable {
+            if (this->valid()) detail::chain_continuation(move(*this), [](cfuture& f) {
                 try { (void)f.get(); }
                 catch (...) {}
             });
@@ -306,6 +547,8 @@ namespace rpp
     template<> class NODISCARD cfuture<void> : public shared_future<void>
     {
         using super = shared_future<void>;
+        // only set for futures created through cpromise, such as rpp::async_task
+        detail::cfuture_continuations_ptr state;
     public:
         cfuture() noexcept = default;
         cfuture(future<void>&& f) noexcept : super(move(f))
@@ -314,30 +557,38 @@ namespace rpp
         cfuture(shared_future<void>&& f) noexcept : super(move(f))
         {
         }
-        cfuture(cfuture&& f) noexcept : super(move(f))
+        cfuture(shared_future<void>&& f, detail::cfuture_continuations_ptr state) noexcept
+            : super(move(f)), state(move(state))
         {
         }
-        cfuture(const cfuture& f) noexcept : super(f)
+        cfuture(cfuture&& f) noexcept : super(move(f)), state(move(f.state))
+        {
+        }
+        cfuture(const cfuture& f) noexcept : super(f), state(f.state)
         {
         }
         cfuture& operator=(future<void>&& f) noexcept
         {
             super::operator=(move(f));
+            state.reset();
             return *this;
         }
         cfuture& operator=(shared_future<void>&& f) noexcept
         {
             super::operator=(move(f));
+            state.reset();
             return *this;
         }
         cfuture& operator=(cfuture&& f) noexcept
         {
             super::operator=(move(f));
+            state = move(f.state);
             return *this;
         }
         cfuture& operator=(const cfuture& f) noexcept
         {
-            super::operator=(move(f));
+            state = f.state;
+            super::operator=(f);
             return *this;
         }
         ~cfuture() noexcept // always block if future is still incomplete
@@ -346,12 +597,29 @@ namespace rpp
                 this->wait();
         }
 
+        // continuation state shared with the cpromise, null if this future wasn't created by one
+        const detail::cfuture_continuations_ptr& continuations() const noexcept { return state; }
+
+        /**
+         * Runs the callback once this future is ready. Futures from cpromise/async_task
+         * don't occupy any threads while pending, others are waited on by a pool task.
+         * @note Exceptions thrown by the callback are caught and reported, never propagated
+         */
+        void on_ready(task_delegate<void()>&& callback) const
+        {
+            if (state) state->add(move(callback));
+            else rpp::parallel_task([f=*this, callback=move(callback)]() mutable {
+                f.wait();
+                detail::cfuture_continuations::run(callback);
+            }, overflow_policy::caller_runs);
+        }
+
         cfuture<void> then() { return { move(*this) }; }
 
         template<class Task>
         cfuture<ret_type<Task>> then(Task&& task)
         {
-            return rpp::async_task([f=move(*this), move_args(task)]() mutable {
+            return detail::chain_future(move(*this), [move_args(task)](cfuture& f) mutable {
                 f.get();
                 return task();
             });
@@ -361,7 +629,7 @@ namespace rpp
         cfuture<ret_type<Task>> then(Task&& task, ExceptHA&& exhA)
         {
             using ExceptA = first_arg_type<ExceptHA>;
-            return async_task([f=move(*this), move_args(task, exhA)]() mutable {
+            return detail::chain_future(move(*this), [move_args(task, exhA)](cfuture& f) mutable {
                 try { f.get(); return task(); }
                 catch (ExceptA& a) { return exhA(a); }
             });
@@ -372,7 +640,7 @@ namespace rpp
         {
             using ExceptA = first_arg_type<ExceptHA>;
             using ExceptB = first_arg_type<ExceptHB>;
-            return async_task([f=move(*this), move_args(task, exhA, exhB)]() mutable {
+            return detail::chain_future(move(*this), [move_args(task, exhA, exhB)](cfuture& f) mutable {
                 try { f.get(); return task(); }
                 catch (ExceptA& a) { return exhA(a); }
                 catch (ExceptB& b) { return exhB(b); }
@@ -385,7 +653,7 @@ namespace rpp
             using ExceptA = first_arg_type<ExceptHA>;
             using ExceptB = first_arg_type<ExceptHB>;
             using ExceptC = first_arg_type<ExceptHC>;
-            return async_task([f=move(*this), move_args(task, exhA, exhB, exhC)]() mutable {
+            return detail::chain_future(move(*this), [move_args(task, exhA, exhB, exhC)](cfuture& f) mutable {
                 try { f.get(); return task(); }
                 catch (ExceptA& a) { return exhA(a); }
                 catch (ExceptB& b) { return exhB(b); }
@@ -400,7 +668,7 @@ namespace rpp
             using ExceptB = first_arg_type<ExceptHB>;
             using ExceptC = first_arg_type<ExceptHC>;
             using ExceptD = first_arg_type<ExceptHD>;
-            return async_task([f = move(*this), move_args(task, exhA, exhB, exhC, exhD)]() mutable {
+            return detail::chain_future(move(*this), [move_args(task, exhA, exhB, exhC, exhD)](cfuture& f) mutable {
                 try { f.get(); return task(); }
                 catch (ExceptA& a) { return exhA(a); }
                 catch (ExceptB& b) { return exhB(b); }
@@ -413,7 +681,7 @@ namespace rpp
         template<class Task>
         void continue_with(Task&& task)
         {
-            rpp::parallel_task([f=move(*this), move_args(task)]() mutable {
+            detail::chain_continuation(move(*this), [move_args(task)](cfuture& f) mutable {
                 f.get();
                 (void)task();
             });
@@ -423,7 +691,7 @@ namespace rpp
         void continue_with(Task&& task, ExceptHA&& exhA)
         {
             using ExceptA = first_arg_type<ExceptHA>;
-            rpp::parallel_task([f=move(*this), move_args(task, exhA)]() mutable {
+            detail::chain_continuation(move(*this), [move_args(task, exhA)](cfuture& f) mutable {
                 try { f.get(); (void)task(); }
                 catch (ExceptA& a) { (void)exhA(a); }
             });
@@ -434,7 +702,7 @@ namespace rpp
         {
             using ExceptA = first_arg_type<ExceptHA>;
             using ExceptB = first_arg_type<ExceptHB>;
-            rpp::parallel_task([f=move(*this), move_args(task, exhA, exhB)]() mutable {
+            detail::chain_continuation(move(*this), [move_args(task, exhA, exhB)](cfuture& f) mutable {
                 try { f.get(); (void)task(); }
                 catch (ExceptA& a) { (void)exhA(a); }
                 catch (ExceptB& b) { (void)exhB(b); }
@@ -447,7 +715,7 @@ namespace rpp
             using ExceptA = first_arg_type<ExceptHA>;
             using ExceptB = first_arg_type<ExceptHB>;
             using ExceptC = first_arg_type<ExceptHC>;
-            rpp::parallel_task([f=move(*this), move_args(task, exhA, exhB, exhC)]() mutable {
+            detail::chain_continuation(move(*this), [move_args(task, exhA, exhB, exhC)](cfuture& f) mutable {
                 try { f.get(); (void)task(); }
                 catch (ExceptA& a) { (void)exhA(a); }
                 catch (ExceptB& b) { (void)exhB(b); }
@@ -462,7 +730,7 @@ namespace rpp
             using ExceptB = first_arg_type<ExceptHB>;
             using ExceptC = first_arg_type<ExceptHC>;
             using ExceptD = first_arg_type<ExceptHD>;
-            rpp::parallel_task([f = move(*this), move_args(task, exhA, exhB, exhC, exhD)]() mutable {
+            detail::chain_continuation(move(*this), [move_args(task, exhA, exhB, exhC, exhD)](cfuture& f) mutable {
                 try { f.get(); (void)task(); }
                 catch (ExceptA& a) { (void)exhA(a); }
                 catch (ExceptB& b) { (void)exhB(b); }
@@ -474,7 +742,7 @@ namespace rpp
         // abandons this future and prevents any waiting in destructor
         void detach()
         {
-            if (this->valid()) rpp::parallel_task([f = move(*this)]() mutable {
+            if (this->valid()) detail::chain_continuation(move(*this), [](cfuture& f) {
                 try { f.get(); } catch (...) {}
             });
         }
@@ -482,33 +750,224 @@ namespace rpp
 
     template<class T> cfuture<void> cfuture<T>::then()
     {
-        return rpp::async_task([f=move(*this)]() mutable {
+        return detail::chain_future(move(*this), [](cfuture<T>& f) {
             (void)f.get();
         });
     }
 
+    namespace detail
+    {
+        template<class T> cfuture<T> cpromise_base<T>::get_cfuture()
+        {
+            return cfuture<T>{ this->get_future().share(), continuations };
+        }
+
+        template<class T, class Continuation>
+        auto chain_future(cfuture<T>&& f, Continuation&& cont)
+            -> cfuture<decltype(cont(std::declval<cfuture<T>&>()))>
+        {
+            using R = decltype(cont(std::declval<cfuture<T>&>()));
+            cfuture_continuations_ptr state = f.continuations();
+            auto run = [f=move(f), cont=std::forward<Continuation>(cont)]() mutable {
+                return cont(f);
+            };
+            if (!state) // not created by cpromise, so wait for it on a pool thread
+                return rpp::async_task(move(run));
+
+            cpromise<R> p;
+            cfuture<R> next = p.get_cfuture();
+            state->add([move_args(p, run)]() mutable {
+                try {
+                    p.compose(run);
+                } catch (...) {
+                    p.set_exception(std::current_exception());
+                }
+            });
+            return next;
+        }
+
+        template<class T, class Continuation>
+        void chain_continuation(cfuture<T>&& f, Continuation&& cont)
+        {
+            cfuture_continuations_ptr state = f.continuations();
+            auto run = [f=move(f), cont=std::forward<Continuation>(cont)]() mutable {
+                cont(f);
+            };
+            if (state) state->add(move(run));
+            else       rpp::parallel_task(move(run), overflow_policy::caller_runs);
+        }
+    }
+
 
     template<class T> cfuture<T> make_ready_future(T&& value)
     {
-        promise<T> p;
+        cpromise<T> p;
         p.set_value(move(value));
-        return p.get_future();
+        return p.get_cfuture();
     }
 
     inline cfuture<void> make_ready_future()
     {
-        promise<void> p;
+        cpromise<void> p;
         p.set_value();
-        return p.get_future();
+        return p.get_cfuture();
     }
 
     template<class T, class E> cfuture<T> make_exceptional_future(E&& e)
     {
-        promise<T> p;
+        cpromise<T> p;
         p.set_exception(std::make_exception_ptr(std::forward<E>(e)));
-        return p.get_future();
+        return p.get_cfuture();
     }
-    
+
+
+    /**
+     * Returns a future which completes once all of the futures are ready.
+     * Nothing blocks while waiting, the result is assembled by whichever
+     * thread completes the last future.
+     * @code
+     * vector<cfuture<Image>> loads = ...;
+     * rpp::when_all(move(loads)).continue_with([](vector<Image> images) { ... });
+     * @endcode
+     * @return All results in the original order. If any of the futures failed,
+     *         the exception of the first failed future (by index) is rethrown.
+     */
+    template<class T> cfuture<vector<T>> when_all(vector<cfuture<T>> futures)
+    {
+        struct all_state
+        {
+            cpromise<vector<T>> p;
+            vector<cfuture<T>> futures;
+            std::atomic<size_t> remaining;
+        };
+        if (futures.empty())
+            return make_ready_future(vector<T>{});
+
+        auto s = std::make_shared<all_state>();
+        s->futures = move(futures);
+        s->remaining = s->futures.size();
+        cfuture<vector<T>> all = s->p.get_cfuture();
+        for (cfuture<T>& f : s->futures)
+        {
+            f.on_ready([s] {
+                if (--s->remaining != 0)
+                    return;
+                try {
+                    vector<T> results;
+                    results.reserve(s->futures.size());
+                    for (cfuture<T>& ready : s->futures)
+                        results.emplace_back(ready.get());
+                    s->p.set_value(move(results));
+                } catch (...) {
+                    s->p.set_exception(std::current_exception());
+                }
+            });
+        }
+        return all;
+    }
+
+    inline cfuture<void> when_all(vector<cfuture<void>> futures)
+    {
+        struct all_state
+        {
+            cpromise<void> p;
+            vector<cfuture<void>> futures;
+            std::atomic<size_t> remaining;
+        };
+        if (futures.empty())
+            return make_ready_future();
+
+        auto s = std::make_shared<all_state>();
+        s->futures = move(futures);
+        s->remaining = s->futures.size();
+        cfuture<void> all = s->p.get_cfuture();
+        for (cfuture<void>& f : s->futures)
+        {
+            f.on_ready([s] {
+                if (--s->remaining != 0)
+                    return;
+                try {
+                    for (cfuture<void>& ready : s->futures)
+                        ready.get();
+                    s->p.set_value();
+                } catch (...) {
+                    s->p.set_exception(std::current_exception());
+                }
+            });
+        }
+        return all;
+    }
+
+    /**
+     * Returns a future of a tuple of results, once all of the futures are ready.
+     * @code
+     * auto both = rpp::when_all(loadUser(id), loadOrders(id));
+     * auto [user, orders] = both.get();
+     * @endcode
+     * @note cfuture<void> can't be a part of the tuple, use the vector overload instead
+     */
+    template<class T, class... Ts> cfuture<std::tuple<T, Ts...>> when_all(cfuture<T> first, cfuture<Ts>... rest)
+    {
+        using tuple_t = std::tuple<T, Ts...>;
+        struct all_state
+        {
+            cpromise<tuple_t> p;
+            std::tuple<cfuture<T>, cfuture<Ts>...> futures;
+            std::atomic<int> remaining { 1 + int(sizeof...(Ts)) };
+
+            all_state(cfuture<T>&& first, cfuture<Ts>&&... rest)
+                : futures{ move(first), move(rest)... } {}
+        };
+
+        auto s = std::make_shared<all_state>(move(first), move(rest)...);
+        cfuture<tuple_t> all = s->p.get_cfuture();
+        auto onReady = [s] {
+            if (--s->remaining != 0)
+                return;
+            try {
+                s->p.set_value(std::apply([](auto&... ready) {
+                    return tuple_t{ ready.get()... };
+                }, s->futures));
+            } catch (...) {
+                s->p.set_exception(std::current_exception());
+            }
+        };
+        // as_const: each future needs its own copy of the callback, a non-const lvalue would be moved from
+        std::apply([&](auto&... f) { (f.on_ready(std::as_const(onReady)), ...); }, s->futures);
+        return all;
+    }
+
+    /**
+     * Returns a future for the index of the first future which completes,
+     * either with a value or an exception. The futures themselves are not consumed,
+     * so the winning result can be read from futures[index].
+     * @code
+     * size_t fastest = rpp::when_any(mirrors).get();
+     * Data data = mirrors[fastest].get();
+     * @endcode
+     */
+    template<class T> cfuture<size_t> when_any(const vector<cfuture<T>>& futures)
+    {
+        struct any_state
+        {
+            cpromise<size_t> p;
+            std::atomic_bool done { false };
+        };
+        if (futures.empty())
+            return make_exceptional_future<size_t>(std::invalid_argument{"when_any: no futures"});
+
+        auto s = std::make_shared<any_state>();
+        cfuture<size_t> first = s->p.get_cfuture();
+        for (size_t i = 0; i < futures.size(); ++i)
+        {
+            futures[i].on_ready([s, i] {
+                if (!s->done.exchange(true))
+                    s->p.set_value(size_t(i));
+            });
+        }
+        return first;
+    }
+
     template<class T> void wait_all(const vector<cfuture<T>>& vf)
     {
         for (const cfuture<T>& f : vf)
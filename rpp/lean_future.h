@@ -0,0 +1,550 @@
+#pragma once
+/**
+ * Allocation-free single consumer futures, Copyright (c) 2017-2018, Jorma Rebane
+ * Distributed under MIT Software License
+ */
+#include "thread_pool.h"
+#include <optional>
+#include <future> // std::future_error
+#include <type_traits>
+#include <cstddef> // max_align_t
+
+namespace rpp
+{
+    template<class T> class lean_future;
+    template<class T> class lean_promise;
+
+    namespace detail
+    {
+        /**
+         * Type erased one-shot callback. Small callables are stored inline,
+         * bigger ones fall back to a heap allocated copy.
+         */
+        class lean_callback
+        {
+            static constexpr size_t inline_size = 6 * sizeof(void*);
+
+            // runs (if run == true) and destroys the callable
+            using invoke_type = void (*)(void* storage, bool run);
+
+            alignas(std::max_align_t) unsigned char storage[inline_size];
+            invoke_type invoke = nullptr;
+
+        public:
+            lean_callback() noexcept = default;
+            NOCOPY_NOMOVE(lean_callback)
+            ~lean_callback() noexcept { reset(); }
+
+            explicit operator bool() const noexcept { return invoke != nullptr; }
+
+            // @note The callable must not throw
+            template<class Func> void set(Func&& func)
+            {
+                using F = std::decay_t<Func>;
+                if constexpr (sizeof(F) <= inline_size && alignof(F) <= alignof(std::max_align_t)
+                              && std::is_nothrow_move_constructible_v<F>)
+                {
+                    new (storage) F{ std::forward<Func>(func) };
+                    invoke = [](void* storage, bool run) {
+                        F& f = *reinterpret_cast<F*>(storage);
+                        if (run) f();
+                        f.~F();
+                    };
+                }
+                else
+                {
+                    *reinterpret_cast<F**>(storage) = new F{ std::forward<Func>(func) };
+                    invoke = [](void* storage, bool run) {
+                        F* f = *reinterpret_cast<F**>(storage);
+                        if (run) (*f)();
+                        delete f;
+                    };
+                }
+            }
+
+            void operator()() noexcept
+            {
+                std::exchange(invoke, nullptr)(storage, true);
+            }
+
+            void reset() noexcept
+            {
+                if (invoke) std::exchange(invoke, nullptr)(storage, false);
+            }
+        };
+
+        struct lean_free_node { lean_free_node* next; };
+
+        /**
+         * Recycles freed shared states of a single size. Every thread keeps a small cache,
+         * overflowing caches are handed to a shared depot in batches, so states which are
+         * created on one thread and freed on another still get reused.
+         */
+        template<size_t Size> class lean_state_pool
+        {
+            static constexpr int cache_size = 64;
+
+            struct depot
+            {
+                mutex m;
+                lean_free_node* head = nullptr;
+                int count = 0;
+            };
+
+            struct thread_cache
+            {
+                lean_free_node* head = nullptr;
+                int count = 0;
+
+                ~thread_cache() noexcept
+                {
+                    cache_destroyed() = true;
+                    while (lean_free_node* n = head) {
+                        head = n->next;
+                        ::operator delete(n);
+                    }
+                    count = 0;
+                }
+            };
+
+            static depot& shared_depot() noexcept
+            {
+                static depot d;
+                return d;
+            }
+
+            static thread_cache& cache() noexcept
+            {
+                static thread_local thread_cache c;
+                return c;
+            }
+
+            // set when the thread's cache is destroyed. States can still be freed later
+            // during thread exit, by other thread_locals which own futures, and the flag
+            // must stay readable then, so it's a separate trivially destructible bool
+            static bool& cache_destroyed() noexcept
+            {
+                static thread_local bool destroyed = false;
+                return destroyed;
+            }
+
+        public:
+            static void* allocate()
+            {
+                if (cache_destroyed())
+                    return ::operator new(Size);
+
+                thread_cache& c = cache();
+                if (!c.head)
+                {
+                    depot& d = shared_depot();
+                    lock_guard<mutex> lock{d.m};
+                    for (; d.head && c.count < cache_size / 2; ++c.count)
+                    {
+                        lean_free_node* n = d.head;
+                        d.head = n->next;
+                        n->next = c.head;
+                        c.head = n;
+                        --d.count;
+                    }
+                }
+                if (lean_free_node* n = c.head)
+                {
+                    c.head = n->next;
+                    --c.count;
+                    return n;
+                }
+                return ::operator new(Size);
+            }
+
+            static void deallocate(void* ptr) noexcept
+            {
+                if (cache_destroyed()) {
+                    ::operator delete(ptr);
+                    return;
+                }
+                thread_cache& c = cache();
+                auto* n = static_cast<lean_free_node*>(ptr);
+                n->next = c.head;
+                c.head = n;
+                if (++c.count < cache_size)
+                    return;
+
+                // hand the whole cache over to the depot, unless it's already full
+                depot& d = shared_depot();
+                lean_free_node* tail = c.head;
+                while (tail->next) tail = tail->next;
+                { lock_guard<mutex> lock{d.m};
+                    if (d.count < cache_size * 16) {
+                        tail->next = d.head;
+                        d.head = c.head;
+                        d.count += c.count;
+                        c.head = nullptr;
+                        c.count = 0;
+                        return;
+                    }
+                }
+                while (lean_free_node* f = c.head) {
+                    c.head = f->next;
+                    ::operator delete(f);
+                }
+                c.count = 0;
+            }
+        };
+
+        struct lean_void {};
+
+        /**
+         * Shared state between a lean_promise and a lean_future.
+         * Holds one reference for the producer and one for the consumer.
+         */
+        template<class T> struct lean_state
+        {
+            using value_type = std::conditional_t<std::is_void_v<T>, lean_void, T>;
+
+            enum : int { pending, has_continuation, blocked, ready };
+
+            std::atomic<int> refs;
+            std::atomic<int> status { pending };
+            std::optional<value_type> value;
+            exception_ptr error;
+            lean_callback task;         // lean_async work, runs before the state becomes ready
+            lean_callback continuation; // then() or continue_with(), runs once ready
+            event_count readyEvent;     // only used if the consumer blocks in get()
+
+            explicit lean_state(int refs) noexcept : refs{refs} {}
+
+            static lean_state* create(int refs)
+            {
+                return new (lean_state_pool<sizeof(lean_state)>::allocate()) lean_state{refs};
+            }
+
+            void retain() noexcept { refs.fetch_add(1, std::memory_order_relaxed); }
+
+            void release() noexcept
+            {
+                if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                {
+                    this->~lean_state();
+                    lean_state_pool<sizeof(lean_state)>::deallocate(this);
+                }
+            }
+
+            // publishes the result and hands it over to the consumer
+            void finish() noexcept
+            {
+                int prev = status.exchange(ready, std::memory_order_acq_rel);
+                if (prev == has_continuation)
+                {
+                    continuation();
+                    release(); // the continuation owned the consumer reference
+                }
+                else if (prev == blocked)
+                {
+                    readyEvent.notify_one();
+                }
+            }
+
+            bool is_ready() const noexcept
+            {
+                return status.load(std::memory_order_acquire) == ready;
+            }
+
+            // consumes the consumer reference once the result is ready
+            template<class Func> void on_ready(Func&& func)
+            {
+                continuation.set(std::forward<Func>(func));
+                int expected = pending;
+                if (!status.compare_exchange_strong(expected, has_continuation,
+                                                    std::memory_order_acq_rel))
+                {
+                    continuation(); // already finished, run it right here
+                    release();
+                }
+            }
+
+            void wait() noexcept
+            {
+                int expected = pending;
+                if (status.compare_exchange_strong(expected, blocked, std::memory_order_acq_rel)
+                    || expected == blocked)
+                {
+                    for (;;)
+                    {
+                        event_count::key key = readyEvent.prepare_wait();
+                        if (is_ready()) {
+                            readyEvent.cancel_wait();
+                            break;
+                        }
+                        readyEvent.wait(key);
+                    }
+                }
+            }
+
+            // entry point for the thread pool, the delegate points to this method directly
+            void run_task() noexcept
+            {
+                task(); // stores the result and destroys the task before any continuation runs
+                finish();
+                release();
+            }
+        };
+    }
+
+
+    /**
+     * Lightweight single consumer future. Unlike rpp::cfuture, this does not
+     * wrap std::shared_future: the shared state is recycled from a pool and uses
+     * an intrusive reference count, the result is stored inline, and continuations
+     * are stored inline if their captures are small. In steady state
+     * rpp::lean_async and then() make no heap allocations at all.
+     *
+     * Single consumer: get(), then() and continue_with() consume the future.
+     * @code
+     * rpp::lean_future<int> size = rpp::lean_async([=] { return load(path); })
+     *     .then([](string data) { return (int)data.size(); });
+     * int result = size.get();
+     * @endcode
+     */
+    template<class T> class NODISCARD lean_future
+    {
+        using state_type = detail::lean_state<T>;
+        state_type* state = nullptr;
+
+        template<class U> friend class lean_future;
+        template<class U> friend class lean_promise;
+        template<class Task> friend auto lean_async(Task&& task) -> lean_future<decltype(task())>;
+
+        explicit lean_future(state_type* state) noexcept : state{state} {}
+
+    public:
+        lean_future() noexcept = default;
+        lean_future(lean_future&& f) noexcept : state{ std::exchange(f.state, nullptr) } {}
+        lean_future& operator=(lean_future&& f) noexcept
+        {
+            if (this != &f) {
+                reset();
+                state = std::exchange(f.state, nullptr);
+            }
+            return *this;
+        }
+        lean_future(const lean_future&) = delete;
+        lean_future& operator=(const lean_future&) = delete;
+        ~lean_future() noexcept { reset(); } // always block if future is still incomplete
+
+        bool valid() const noexcept { return state != nullptr; }
+        bool is_ready() const noexcept { return state && state->is_ready(); }
+
+        // blocks until the result is ready
+        void wait() const noexcept { if (state) state->wait(); }
+
+        /**
+         * Blocks until the result is ready and consumes this future.
+         * @throws std::future_error if this future is not valid
+         * @throws Any exception set by the promise
+         */
+        T get()
+        {
+            if (!state)
+                throw std::future_error{std::future_errc::no_state};
+            state->wait();
+            state_type* s = std::exchange(state, nullptr);
+            if (s->error) {
+                exception_ptr e = s->error;
+                s->release();
+                rethrow_exception(e);
+            }
+            if constexpr (std::is_void_v<T>) {
+                s->release();
+            } else {
+                T result = move(*s->value);
+                s->release();
+                return result;
+            }
+        }
+
+        /**
+         * Runs the continuation with the result once it's ready and consumes this future.
+         * The continuation runs on the thread which completes this future, or right here
+         * if the future is already finished. Exceptions skip the continuation and are
+         * propagated to the returned future.
+         * @code
+         * lean_future<string> text = rpp::lean_async([=] { return download(url); });
+         * lean_future<int> length = text.then([](string s) { return (int)s.size(); });
+         * @endcode
+         */
+        template<class Func> auto then(Func&& func)
+        {
+            using R = decltype(call(func, std::declval<state_type&>()));
+            auto* next = detail::lean_state<R>::create(2);
+            consume([next, func=std::forward<Func>(func)](state_type& s) mutable noexcept {
+                if (s.error) {
+                    next->error = s.error;
+                }
+                else try {
+                    if constexpr (std::is_void_v<R>) {
+                        call(func, s);
+                        next->value.emplace();
+                    } else {
+                        next->value.emplace(call(func, s));
+                    }
+                } catch (...) {
+                    next->error = std::current_exception();
+                }
+                next->finish();
+                next->release();
+            });
+            return lean_future<R>{ next };
+        }
+
+        /**
+         * Runs the continuation once the result is ready and consumes this future.
+         * Nothing waits for the continuation and its result is discarded.
+         * @note If the future failed, the continuation is not called and the exception is ignored
+         */
+        template<class Func> void continue_with(Func&& func)
+        {
+            consume([func=std::forward<Func>(func)](state_type& s) mutable noexcept {
+                if (!s.error) {
+                    try { call(func, s); }
+                    catch (...) {} // fire and forget
+                }
+            });
+        }
+
+    private:
+        template<class Func> static decltype(auto) call(Func& func, state_type& s)
+        {
+            if constexpr (std::is_void_v<T>) return func();
+            else return func(move(*s.value));
+        }
+
+        template<class Continuation> void consume(Continuation&& cont)
+        {
+            if (!state)
+                throw std::future_error{std::future_errc::no_state};
+            state_type* s = std::exchange(state, nullptr);
+            s->on_ready([s, cont=std::forward<Continuation>(cont)]() mutable noexcept {
+                cont(*s);
+            });
+        }
+
+        void reset() noexcept
+        {
+            if (state_type* s = std::exchange(state, nullptr)) {
+                s->wait();
+                s->release();
+            }
+        }
+    };
+
+
+    /**
+     * Producer side of a lean_future. A promise which is destroyed without
+     * setting a result fails its future with std::future_errc::broken_promise
+     */
+    template<class T> class lean_promise
+    {
+        using state_type = detail::lean_state<T>;
+        state_type* state;
+        bool futureRetrieved = false;
+
+    public:
+        lean_promise() : state{ state_type::create(1) } {}
+        lean_promise(lean_promise&& p) noexcept
+            : state{ std::exchange(p.state, nullptr) }, futureRetrieved{ p.futureRetrieved } {}
+        lean_promise& operator=(lean_promise&& p) noexcept
+        {
+            if (this != &p) {
+                abandon();
+                state = std::exchange(p.state, nullptr);
+                futureRetrieved = p.futureRetrieved;
+            }
+            return *this;
+        }
+        lean_promise(const lean_promise&) = delete;
+        lean_promise& operator=(const lean_promise&) = delete;
+        ~lean_promise() noexcept { abandon(); }
+
+        /**
+         * @throws std::future_error if the future was already retrieved
+         */
+        lean_future<T> get_future()
+        {
+            if (!state || futureRetrieved)
+                throw std::future_error{std::future_errc::future_already_retrieved};
+            futureRetrieved = true;
+            state->retain();
+            return lean_future<T>{ state };
+        }
+
+        template<class... U> void set_value(U&&... value)
+        {
+            check_state();
+            state->value.emplace(std::forward<U>(value)...);
+            finish();
+        }
+
+        void set_exception(exception_ptr e)
+        {
+            check_state();
+            state->error = move(e);
+            finish();
+        }
+
+    private:
+        void check_state() const
+        {
+            if (!state)
+                throw std::future_error{std::future_errc::promise_already_satisfied};
+        }
+
+        void finish() noexcept
+        {
+            state_type* s = std::exchange(state, nullptr);
+            s->finish();
+            s->release();
+        }
+
+        void abandon() noexcept
+        {
+            if (state_type* s = std::exchange(state, nullptr)) {
+                s->error = std::make_exception_ptr(
+                    std::future_error{std::future_errc::broken_promise});
+                s->finish();
+                s->release();
+            }
+        }
+    };
+
+
+    /**
+     * Runs the task on the default global thread pool and returns a lean_future for its result.
+     * The task and the shared state live in a recycled pool slot and the thread pool delegate
+     * points straight at it, so in steady state this does not allocate anything.
+     * @code
+     * int sum = rpp::lean_async([] { return 1 + 2; }).get();
+     * @endcode
+     */
+    template<class Task> auto lean_async(Task&& task) -> lean_future<decltype(task())>
+    {
+        using T = decltype(task());
+        using state_type = detail::lean_state<T>;
+        state_type* s = state_type::create(2);
+        s->task.set([s, task=std::forward<Task>(task)]() mutable noexcept {
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    task();
+                    s->value.emplace();
+                } else {
+                    s->value.emplace(task());
+                }
+            } catch (...) {
+                s->error = std::current_exception();
+            }
+        });
+        // caller_runs: a dropped task would leave ~lean_future waiting forever
+        rpp::parallel_task(task_delegate<void()>{ s, &state_type::run_task }, overflow_policy::caller_runs);
+        return lean_future<T>{ s };
+    }
+}
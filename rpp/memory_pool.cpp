@@ -0,0 +1,418 @@
+#include "memory_pool.h"
+#include <mutex>
+#include <atomic>
+#include <unordered_set>
+#include <cassert>
+#if _WIN32
+#  define WIN32_LEAN_AND_MEAN
+#  include <Windows.h> // VirtualAlloc
+#  include <malloc.h> // _aligned_malloc
+#else
+#  include <sys/mman.h> // mmap
+#endif
+
+namespace rpp
+{
+    ///////////////////////////////////////////////////////////////////////////////
+
+#if !_WIN32
+    static size_t huge_page_round(size_t size) noexcept
+    {
+        return (size + huge_page_size - 1) & ~(huge_page_size - 1);
+    }
+#endif
+
+    void prefault_pages(void* ptr, size_t size) noexcept
+    {
+        constexpr size_t PageSize = 4096;
+        volatile char* p = static_cast<char*>(ptr);
+        for (size_t offset = 0; offset < size; offset += PageSize)
+            p[offset] = p[offset]; // a write, so copy-on-write zero pages are replaced too
+    }
+
+    void* allocate_pages(size_t size, bool hugePages, bool prefault) noexcept
+    {
+        if (size == 0) return nullptr;
+    #if _WIN32
+        // large pages need SeLockMemoryPrivilege, which most processes don't have.
+        // They are always committed up front, so prefault isn't needed
+        if (hugePages) {
+            size_t large = GetLargePageMinimum();
+            if (large && size % large == 0)
+                if (void* ptr = VirtualAlloc(nullptr, size, MEM_RESERVE|MEM_COMMIT|MEM_LARGE_PAGES, PAGE_READWRITE))
+                    return ptr;
+        }
+        void* ptr = VirtualAlloc(nullptr, size, MEM_RESERVE|MEM_COMMIT, PAGE_READWRITE);
+        if (ptr && prefault) prefault_pages(ptr, size);
+        return ptr;
+    #else
+        #if defined(MAP_POPULATE)
+            const int populate = prefault ? MAP_POPULATE : 0;
+        #else
+            const int populate = 0;
+        #endif
+        if (!hugePages) {
+            void* ptr = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|populate, -1, 0);
+            if (ptr == MAP_FAILED) return nullptr;
+            if (prefault && !populate) prefault_pages(ptr, size);
+            return ptr;
+        }
+
+        size = huge_page_round(size);
+    #if defined(MAP_HUGETLB)
+        // explicit huge pages only work if the admin has reserved them (vm.nr_hugepages)
+        void* huge = mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|populate, -1, 0);
+        if (huge != MAP_FAILED)
+            return huge;
+    #endif
+        // otherwise map with huge page alignment, so transparent huge pages can back it
+        size_t mapped = size + huge_page_size;
+        void* ptr = mmap(nullptr, mapped, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) return nullptr;
+        char* begin = static_cast<char*>(ptr);
+        char* aligned = reinterpret_cast<char*>(huge_page_round(size_t(begin)));
+        if (aligned != begin)
+            munmap(begin, aligned - begin);
+        if (size_t tail = (begin + mapped) - (aligned + size))
+            munmap(aligned + size, tail);
+    #if defined(MADV_HUGEPAGE)
+        madvise(aligned, size, MADV_HUGEPAGE);
+    #endif
+        // populating before madvise would map small pages, so touch them afterwards
+        if (prefault) prefault_pages(aligned, size);
+        return aligned;
+    #endif
+    }
+
+    void free_pages(void* ptr, size_t size, bool hugePages) noexcept
+    {
+        if (!ptr) return;
+    #if _WIN32
+        (void)size; (void)hugePages;
+        VirtualFree(ptr, 0, MEM_RELEASE);
+    #else
+        munmap(ptr, hugePages ? huge_page_round(size) : size);
+    #endif
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    static void* aligned_block(size_t size, size_t align) noexcept
+    {
+    #if _WIN32
+        return _aligned_malloc(size, align);
+    #else
+        void* ptr = nullptr;
+        return posix_memalign(&ptr, align, size) == 0 ? ptr : nullptr;
+    #endif
+    }
+
+    static void free_aligned_block(void* ptr) noexcept
+    {
+    #if _WIN32
+        _aligned_free(ptr);
+    #else
+        free(ptr);
+    #endif
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    arena& scratch_arena() noexcept
+    {
+        static thread_local arena scratch;
+        return scratch;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    namespace detail
+    {
+        static constexpr int NumClasses = slab_allocator::num_size_classes;
+        static constexpr size_t SlabHeaderSize = 64; // keeps the first object cache line aligned
+        static_assert(SlabHeaderSize % slab_allocator::max_slab_align == 0, "slab objects must keep max_slab_align");
+
+        // slabs are aligned to slab_size, so the header of any object is found by masking its address
+        struct slab_header
+        {
+            int sizeClass; // -1 for a dedicated block
+            size_t blockSize;
+        };
+
+        struct slab_node { slab_node* next; };
+
+        struct slab_list
+        {
+            slab_node* head = nullptr;
+            int count = 0;
+
+            void push(void* ptr) noexcept
+            {
+                auto* node = static_cast<slab_node*>(ptr);
+                node->next = head;
+                head = node;
+                ++count;
+            }
+            void* pop() noexcept
+            {
+                slab_node* node = head;
+                head = node->next;
+                --count;
+                return node;
+            }
+            // detaches the first n nodes into a separate list
+            slab_list split(int n) noexcept
+            {
+                slab_list front { head, n };
+                slab_node* last = head;
+                for (int i = 1; i < n; ++i)
+                    last = last->next;
+                head = last->next;
+                last->next = nullptr;
+                count -= n;
+                return front;
+            }
+        };
+
+        static slab_header* header_of(const void* ptr) noexcept
+        {
+            return reinterpret_cast<slab_header*>(size_t(ptr) & ~(slab_allocator::slab_size - 1));
+        }
+
+        struct slab_core
+        {
+            const uint64 id;
+            std::mutex m;
+            std::vector<void*> slabs;
+            std::unordered_set<void*> dedicated;
+            char* bumpPtr[NumClasses] = {}; // uncarved space of the newest slab of each class
+            char* bumpEnd[NumClasses] = {};
+            std::vector<slab_list> depot[NumClasses]; // free objects returned by thread caches
+            std::atomic<size_t> reserved { 0 };
+
+            explicit slab_core(uint64 id) noexcept : id{id} {}
+
+            ~slab_core() noexcept
+            {
+                for (void* slab : slabs) free_aligned_block(slab);
+                for (void* block : dedicated) free_aligned_block(block);
+            }
+
+            // fills an empty thread cache list with a batch from the depot or from a slab
+            bool refill(int sizeClass, slab_list& list) noexcept
+            {
+                std::lock_guard<std::mutex> lock{m};
+                std::vector<slab_list>& freed = depot[sizeClass];
+                if (!freed.empty()) {
+                    list = freed.back();
+                    freed.pop_back();
+                    return true;
+                }
+
+                const size_t objectSize = slab_allocator::class_size(sizeClass);
+                char*& ptr = bumpPtr[sizeClass];
+                if (size_t(bumpEnd[sizeClass] - ptr) < objectSize)
+                {
+                    auto* slab = static_cast<char*>(aligned_block(slab_allocator::slab_size, slab_allocator::slab_size));
+                    if (!slab) return false;
+                    new (slab) slab_header{ sizeClass, slab_allocator::slab_size };
+                    slabs.push_back(slab);
+                    reserved += slab_allocator::slab_size;
+                    ptr = slab + SlabHeaderSize;
+                    bumpEnd[sizeClass] = slab + slab_allocator::slab_size;
+                }
+                const int batch = slab_allocator::batch_count(sizeClass);
+                for (int i = 0; i < batch && size_t(bumpEnd[sizeClass] - ptr) >= objectSize; ++i)
+                {
+                    list.push(ptr);
+                    ptr += objectSize;
+                }
+                return true;
+            }
+
+            void give_back(int sizeClass, slab_list batch) noexcept
+            {
+                std::lock_guard<std::mutex> lock{m};
+                depot[sizeClass].push_back(batch);
+            }
+
+            // allocates without a thread cache, the rest of the refilled batch goes straight back
+            void* allocate_uncached(int sizeClass) noexcept
+            {
+                slab_list list;
+                if (!refill(sizeClass, list))
+                    return nullptr;
+                void* ptr = list.pop();
+                if (list.count) give_back(sizeClass, list);
+                return ptr;
+            }
+
+            void* allocate_dedicated(size_t size, size_t align) noexcept
+            {
+                assert(align < slab_allocator::slab_size && "alignment must be smaller than slab_allocator::slab_size");
+                size_t offset = align > SlabHeaderSize ? align : SlabHeaderSize;
+                size_t blockSize = offset + size;
+                auto* block = static_cast<char*>(aligned_block(blockSize, slab_allocator::slab_size));
+                if (!block) return nullptr;
+                new (block) slab_header{ -1, blockSize };
+                { std::lock_guard<std::mutex> lock{m};
+                    dedicated.insert(block);
+                }
+                reserved += blockSize;
+                return block + offset;
+            }
+
+            void free_dedicated(slab_header* header) noexcept
+            {
+                reserved -= header->blockSize;
+                { std::lock_guard<std::mutex> lock{m};
+                    dedicated.erase(header);
+                }
+                free_aligned_block(header);
+            }
+        };
+
+        struct slab_thread_cache
+        {
+            uint64 poolId;
+            std::weak_ptr<slab_core> core;
+            slab_list lists[NumClasses];
+
+            void flush(slab_core& c) noexcept
+            {
+                for (int i = 0; i < NumClasses; ++i)
+                {
+                    if (lists[i].count) c.give_back(i, lists[i]);
+                    lists[i] = {};
+                }
+            }
+        };
+
+        // set when the thread's caches are destroyed. Objects can still be allocated or freed
+        // later during thread exit, by other thread_locals, and the flag must stay readable
+        // then, so it's a separate trivially destructible bool
+        static thread_local bool threadCachesDestroyed = false;
+
+        // all slab pool caches of the current thread, flushed back to live pools when the thread exits
+        struct slab_thread_caches
+        {
+            slab_thread_cache* last = nullptr;
+            std::vector<std::unique_ptr<slab_thread_cache>> caches;
+
+            ~slab_thread_caches() noexcept
+            {
+                threadCachesDestroyed = true;
+                for (auto& cache : caches)
+                    if (std::shared_ptr<slab_core> c = cache->core.lock())
+                        cache->flush(*c);
+            }
+
+            slab_thread_cache& get(const std::shared_ptr<slab_core>& core)
+            {
+                if (last && last->poolId == core->id)
+                    return *last;
+                for (auto& cache : caches)
+                    if (cache->poolId == core->id)
+                        return *(last = cache.get());
+
+                // pool ids are never reused, so caches of destroyed pools can simply be dropped
+                caches.erase(std::remove_if(caches.begin(), caches.end(), [](auto& cache) {
+                    return cache->core.expired();
+                }), caches.end());
+                caches.emplace_back(new slab_thread_cache{ core->id, core, {} });
+                return *(last = caches.back().get());
+            }
+        };
+
+        static thread_local slab_thread_caches threadCaches;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    static std::atomic<uint64> nextSlabPoolId { 1 };
+
+    namespace detail
+    {
+        slab_allocator::slab_allocator() : core{ std::make_shared<slab_core>(nextSlabPoolId++) }
+        {
+        }
+
+        slab_allocator::~slab_allocator() noexcept = default;
+
+        size_t slab_allocator::allocation_size(const void* ptr) noexcept
+        {
+            const slab_header* header = header_of(ptr);
+            if (header->sizeClass < 0)
+                return header->blockSize - size_t((const char*)ptr - (const char*)header);
+            return class_size(header->sizeClass);
+        }
+
+        size_t slab_allocator::capacity() const noexcept
+        {
+            return core ? core->reserved.load() : 0;
+        }
+
+        memory_pool_stats slab_allocator::block_stats() const
+        {
+            memory_pool_stats s;
+            if (core)
+            {
+                std::lock_guard<std::mutex> lock{core->m};
+                s.blocks = core->slabs.size() + core->dedicated.size();
+                s.block_bytes = core->reserved.load();
+            }
+            return s;
+        }
+
+        void* slab_allocator::allocate(size_t size, size_t align)
+        {
+            if (size == 0) size = 1;
+            if (align > 16 && align <= max_slab_align) // objects of classes which are multiples of align are aligned
+                size = (size + align - 1) & ~(align - 1);
+            if (size <= max_small_size)
+            {
+                int sizeClass = size_class(size);
+                if (align <= 16 || (align <= max_slab_align && class_size(sizeClass) % align == 0))
+                {
+                    if (threadCachesDestroyed)
+                        return core->allocate_uncached(sizeClass);
+                    slab_list& list = threadCaches.get(core).lists[sizeClass];
+                    if (!list.head && !core->refill(sizeClass, list))
+                        return nullptr;
+                    return list.pop();
+                }
+            }
+            return core->allocate_dedicated(size, align);
+        }
+
+        void slab_allocator::deallocate(void* ptr) noexcept
+        {
+            if (!ptr) return;
+            slab_header* header = header_of(ptr);
+            if (header->sizeClass < 0) {
+                core->free_dedicated(header);
+                return;
+            }
+            if (threadCachesDestroyed) {
+                slab_list single;
+                single.push(ptr);
+                core->give_back(header->sizeClass, single);
+                return;
+            }
+            slab_list& list = threadCaches.get(core).lists[header->sizeClass];
+            list.push(ptr);
+            int batch = batch_count(header->sizeClass);
+            if (list.count >= 2 * batch) // keep one batch for the next allocations
+                core->give_back(header->sizeClass, list.split(batch));
+        }
+
+        void slab_allocator::flush_thread_cache() noexcept
+        {
+            if (threadCachesDestroyed)
+                return;
+            threadCaches.get(core).flush(*core);
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+}
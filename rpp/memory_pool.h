@@ -1,11 +1,235 @@
 #pragma once
 #include <vector>
+#include <memory> // std::shared_ptr
+#include <atomic> // concurrent_pool_stats
+#include <new> // std::bad_alloc
 #include <cstdlib>
+#include <type_traits>
 #include <rpp/collections.h>
 #include "config.h"
 
 namespace rpp
 {
+    /**
+     * Reserves memory directly from the OS in whole pages, for large pool blocks.
+     * @param size Number of bytes. With huge pages this is rounded up to huge_page_size
+     * @param hugePages Try to back the memory with huge pages: MAP_HUGETLB first, then
+     *                  transparent huge pages via madvise(MADV_HUGEPAGE), and normal pages
+     *                  if neither is available
+     * @param prefault Map all pages right away, so the first access doesn't page fault
+     * @return Zeroed memory or nullptr if out of memory. Release with free_pages()
+     */
+    RPPAPI void* allocate_pages(size_t size, bool hugePages = false, bool prefault = false) noexcept;
+
+    // @param size The same size that was passed to allocate_pages()
+    RPPAPI void free_pages(void* ptr, size_t size, bool hugePages = false) noexcept;
+
+    // touches every page of the memory range, so the OS maps them all now instead of on first use
+    RPPAPI void prefault_pages(void* ptr, size_t size) noexcept;
+
+    static constexpr size_t huge_page_size = 2*1024*1024;
+
+    /**
+     * Where the blocks of linear pools and arenas get their memory from
+     */
+    enum class pool_backing
+    {
+        // malloc, best for small pools
+        heap,
+
+        // pages mapped directly from the OS
+        pages,
+
+        // huge pages if the system allows it, otherwise normal pages.
+        // Much fewer TLB misses for random access into big pools
+        huge_pages,
+    };
+
+    namespace detail
+    {
+        inline char* allocate_block(size_t size, pool_backing backing, bool prefault) noexcept
+        {
+            if (backing != pool_backing::heap)
+                return static_cast<char*>(allocate_pages(size, backing == pool_backing::huge_pages, prefault));
+            auto* block = static_cast<char*>(malloc(size));
+            if (block && prefault) prefault_pages(block, size);
+            return block;
+        }
+
+        inline void free_block(char* block, size_t size, pool_backing backing) noexcept
+        {
+            if (backing != pool_backing::heap)
+                free_pages(block, size, backing == pool_backing::huge_pages);
+            else
+                free(block);
+        }
+    }
+
+    /**
+     * Snapshot of memory pool statistics, for right-sizing blocks from real workloads
+     */
+    struct memory_pool_stats
+    {
+        // size class i counts allocations of up to 16 << i bytes, the last one everything bigger
+        static constexpr int num_size_classes = 16;
+
+        uint64 allocations = 0;
+        uint64 deallocations = 0;
+        uint64 bytes_allocated = 0;   // total bytes requested
+        uint64 bytes_in_use = 0;      // requested bytes not yet freed, rewound or reset
+        uint64 peak_bytes_in_use = 0;
+        uint64 alignment_waste = 0;   // padding bytes skipped to align allocations
+        uint64 blocks = 0;            // blocks currently reserved from the system
+        uint64 block_bytes = 0;
+        uint64 count_by_class[num_size_classes] = {};
+        uint64 bytes_by_class[num_size_classes] = {};
+
+        static constexpr int size_class(uint64 size) noexcept
+        {
+            int sizeClass = 0;
+            for (uint64 limit = 16; size > limit && sizeClass < num_size_classes - 1; limit <<= 1)
+                ++sizeClass;
+            return sizeClass;
+        }
+    };
+
+    /**
+     * Default statistics policy of the pools: records nothing and compiles away completely
+     */
+    struct no_pool_stats
+    {
+        static constexpr bool enabled = false;
+        static constexpr bool thread_safe = true;
+        uint64 bytes_in_use() const noexcept { return 0; }
+        void allocated(uint64, uint64) noexcept {}
+        void deallocated(uint64) noexcept {}
+        void rewound_to(uint64) noexcept {}
+        void block_added(uint64) noexcept {}
+        void block_freed(uint64) noexcept {}
+    };
+
+    /**
+     * Statistics policy which records memory_pool_stats. Like the pools, it's not thread safe
+     * @code
+     * rpp::basic_linear_dynamic_pool<rpp::counting_pool_stats> pool;
+     * ...
+     * rpp::memory_pool_stats stats = pool.stats();
+     * @endcode
+     */
+    class counting_pool_stats
+    {
+        memory_pool_stats s;
+
+    public:
+        static constexpr bool enabled = true;
+        static constexpr bool thread_safe = false;
+
+        memory_pool_stats snapshot() const noexcept { return s; }
+        uint64 bytes_in_use() const noexcept { return s.bytes_in_use; }
+
+        void allocated(uint64 size, uint64 alignmentWaste) noexcept
+        {
+            ++s.allocations;
+            s.bytes_allocated += size;
+            s.alignment_waste += alignmentWaste;
+            s.bytes_in_use += size;
+            if (s.bytes_in_use > s.peak_bytes_in_use)
+                s.peak_bytes_in_use = s.bytes_in_use;
+            int sizeClass = memory_pool_stats::size_class(size);
+            ++s.count_by_class[sizeClass];
+            s.bytes_by_class[sizeClass] += size;
+        }
+        void deallocated(uint64 size) noexcept
+        {
+            ++s.deallocations;
+            s.bytes_in_use -= size;
+        }
+        void rewound_to(uint64 bytesInUse) noexcept { s.bytes_in_use = bytesInUse; }
+        void block_added(uint64 bytes) noexcept { ++s.blocks; s.block_bytes += bytes; }
+        void block_freed(uint64 bytes) noexcept { --s.blocks; s.block_bytes -= bytes; }
+    };
+
+    /**
+     * Statistics policy which records memory_pool_stats with relaxed atomic counters,
+     * for pools which allocate and free from many threads at once, such as slab_pool
+     * @code
+     * rpp::basic_slab_pool<rpp::concurrent_pool_stats> pool;
+     * ...
+     * uint64 leaked = pool.stats().bytes_in_use;
+     * @endcode
+     */
+    class concurrent_pool_stats
+    {
+        using counter = std::atomic<uint64>;
+        counter allocations { 0 };
+        counter deallocations { 0 };
+        counter bytesAllocated { 0 };
+        counter bytesInUse { 0 };
+        counter peakBytesInUse { 0 };
+        counter alignmentWaste { 0 };
+        counter blocks { 0 };
+        counter blockBytes { 0 };
+        counter countByClass[memory_pool_stats::num_size_classes] = {};
+        counter bytesByClass[memory_pool_stats::num_size_classes] = {};
+
+        static void add(counter& c, uint64 n) noexcept { c.fetch_add(n, std::memory_order_relaxed); }
+        static uint64 load(const counter& c) noexcept { return c.load(std::memory_order_relaxed); }
+
+    public:
+        static constexpr bool enabled = true;
+        static constexpr bool thread_safe = true;
+
+        memory_pool_stats snapshot() const noexcept
+        {
+            memory_pool_stats s;
+            s.allocations = load(allocations);
+            s.deallocations = load(deallocations);
+            s.bytes_allocated = load(bytesAllocated);
+            s.bytes_in_use = load(bytesInUse);
+            s.peak_bytes_in_use = load(peakBytesInUse);
+            s.alignment_waste = load(alignmentWaste);
+            s.blocks = load(blocks);
+            s.block_bytes = load(blockBytes);
+            for (int i = 0; i < memory_pool_stats::num_size_classes; ++i)
+            {
+                s.count_by_class[i] = load(countByClass[i]);
+                s.bytes_by_class[i] = load(bytesByClass[i]);
+            }
+            return s;
+        }
+        uint64 bytes_in_use() const noexcept { return load(bytesInUse); }
+
+        void allocated(uint64 size, uint64 alignmentWaste) noexcept
+        {
+            add(allocations, 1);
+            add(bytesAllocated, size);
+            if (alignmentWaste) add(this->alignmentWaste, alignmentWaste);
+            raise_peak(bytesInUse.fetch_add(size, std::memory_order_relaxed) + size);
+            int sizeClass = memory_pool_stats::size_class(size);
+            add(countByClass[sizeClass], 1);
+            add(bytesByClass[sizeClass], size);
+        }
+        void deallocated(uint64 size) noexcept
+        {
+            add(deallocations, 1);
+            bytesInUse.fetch_sub(size, std::memory_order_relaxed);
+        }
+        void rewound_to(uint64 bytesInUse) noexcept { this->bytesInUse.store(bytesInUse, std::memory_order_relaxed); }
+        void block_added(uint64 bytes) noexcept { add(blocks, 1); add(blockBytes, bytes); }
+        void block_freed(uint64 bytes) noexcept
+        {
+            blocks.fetch_sub(1, std::memory_order_relaxed);
+            blockBytes.fetch_sub(bytes, std::memory_order_relaxed);
+        }
+
+    private:
+        void raise_peak(uint64 inUse) noexcept
+        {
+            uint64 peak = load(peakBytesInUse);
+            while (inUse > peak && !peakBytesInUse.compare_exchange_weak(peak, inUse, std::memory_order_relaxed)) {}
+        }
+    };
+
     /**
      * Provides necessary utilities for constructing C++ objects
      * directly from the pool.
@@ -71,54 +295,86 @@ namespace rpp
      * Simplest type of memory pool.
      * Has a predetermined static size.
      * There is no deallocate!
+     * @tparam Stats Statistics policy, no_pool_stats or counting_pool_stats
      */
-    class linear_static_pool : public pool_types_constructor<linear_static_pool>
+    template<class Stats = no_pool_stats>
+    class basic_linear_static_pool : public pool_types_constructor<basic_linear_static_pool<Stats>>, private Stats
     {
-        int Remaining;
+        int64 Remaining;
         char* Buffer;
         char* Ptr;
+        int64 BufferSize;
+        pool_backing Backing;
 
     public:
-        explicit linear_static_pool(int staticBlockSize)
-            : Remaining{staticBlockSize}, Buffer{(char*)malloc(staticBlockSize)}, Ptr{Buffer}
+        /**
+         * @param staticBlockSize Size of the pool in bytes, can be bigger than 2GB
+         * @param backing Where the memory comes from, use huge pages for big pools with random access
+         * @param prefault Map all pages up front instead of page faulting on first access
+         */
+        explicit basic_linear_static_pool(int64 staticBlockSize, pool_backing backing = pool_backing::heap,
+                                          bool prefault = false)
+            : Remaining{staticBlockSize},
+              Buffer{detail::allocate_block(size_t(staticBlockSize), backing, prefault)},
+              Ptr{Buffer}, BufferSize{staticBlockSize}, Backing{backing}
         {
+            if (!Buffer) {
+                Remaining = 0;
+                return;
+            }
+            Stats::block_added(uint64(staticBlockSize));
             if (int rem = size_t(Buffer) % 16) { // always align Ptr to 16 bytes
                 Remaining -= (16 - rem);
                 Ptr       += (16 - rem);
             }
         }
-        ~linear_static_pool() noexcept
+        ~basic_linear_static_pool() noexcept
         {
-            free(Buffer);
+            if (Buffer) detail::free_block(Buffer, size_t(BufferSize), Backing);
         }
 
-        linear_static_pool(linear_static_pool&& pool) noexcept
-            : Remaining{pool.Remaining},
+        basic_linear_static_pool(basic_linear_static_pool&& pool) noexcept
+            : Stats{static_cast<Stats&&>(pool)},
+              Remaining{pool.Remaining},
               Buffer{pool.Buffer},
-              Ptr{pool.Ptr}
+              Ptr{pool.Ptr},
+              BufferSize{pool.BufferSize},
+              Backing{pool.Backing}
         {
             pool.Remaining = 0;
             pool.Buffer = nullptr;
             pool.Ptr = nullptr;
+            pool.BufferSize = 0;
         }
-        linear_static_pool& operator=(linear_static_pool&& pool) noexcept
+        basic_linear_static_pool& operator=(basic_linear_static_pool&& pool) noexcept
         {
+            std::swap(static_cast<Stats&>(*this), static_cast<Stats&>(pool));
             std::swap(Remaining, pool.Remaining);
             std::swap(Buffer, pool.Buffer);
             std::swap(Ptr, pool.Ptr);
+            std::swap(BufferSize, pool.BufferSize);
+            std::swap(Backing, pool.Backing);
             return *this;
         }
         
-        linear_static_pool(const linear_static_pool&) = delete;
-        linear_static_pool& operator=(const linear_static_pool&) = delete;
+        basic_linear_static_pool(const basic_linear_static_pool&) = delete;
+        basic_linear_static_pool& operator=(const basic_linear_static_pool&) = delete;
 
-        int capacity()  const { return int(Ptr - Buffer) + Remaining; }
-        int available() const { return Remaining; }
+        int64 capacity()  const { return int64(Ptr - Buffer) + Remaining; }
+        int64 available() const { return Remaining; }
+        pool_backing backing() const { return Backing; }
 
-        NODISCARD void* allocate(int size, int align = 8)
+        // only available with the counting_pool_stats policy
+        memory_pool_stats stats() const
         {
-            int alignOffset = 0;
-            int alignedSize = size;
+            static_assert(Stats::enabled, "pool statistics need the counting_pool_stats policy");
+            return Stats::snapshot();
+        }
+
+        NODISCARD void* allocate(int64 size, int align = 8)
+        {
+            int64 alignOffset = 0;
+            int64 alignedSize = size;
             if (int rem = size_t(Ptr) % align)
             {
                 alignOffset = align - rem;
@@ -131,6 +387,7 @@ namespace rpp
             char* mem = Ptr + alignOffset;
             Ptr       += alignedSize;
             Remaining -= alignedSize;
+            Stats::allocated(uint64(size), uint64(alignOffset));
             return mem;
         }
 
@@ -138,59 +395,692 @@ namespace rpp
         void deallocate(void*) { }
     };
 
+    using linear_static_pool = basic_linear_static_pool<>;
+
 
     /**
      * A memory pool that allocates by `bump the pointer`
      * and grows in large dynamic chunks.
      * Chunk growth can be controlled
+     * @tparam Stats Statistics policy, no_pool_stats or counting_pool_stats
      */
-    class linear_dynamic_pool : public pool_types_constructor<linear_dynamic_pool>
+    template<class Stats = no_pool_stats>
+    class basic_linear_dynamic_pool : public pool_types_constructor<basic_linear_dynamic_pool<Stats>>, private Stats
     {
-        int BlockSize;
+        int64 BlockSize;
         float BlockGrowth;
+        pool_backing Backing;
+        bool Prefault;
         std::vector<linear_static_pool> Pools;
 
     public:
 
-        explicit linear_dynamic_pool(int initialBlockSize = 128*1024, float blockGrowth = 2.0f)
-            : BlockSize{initialBlockSize}, BlockGrowth{blockGrowth}
+        /**
+         * @param initialBlockSize Size of the first block in bytes
+         * @param blockGrowth Each new block is this much bigger than the previous one
+         * @param backing Where the memory of the blocks comes from
+         * @param prefault Map all pages of a new block up front
+         */
+        explicit basic_linear_dynamic_pool(int64 initialBlockSize = 128*1024, float blockGrowth = 2.0f,
+                                           pool_backing backing = pool_backing::heap, bool prefault = false)
+            : BlockSize{initialBlockSize}, BlockGrowth{blockGrowth}, Backing{backing}, Prefault{prefault}
         {
-            Pools.emplace_back(initialBlockSize);
+            Pools.emplace_back(initialBlockSize, backing, prefault);
+            Stats::block_added(uint64(initialBlockSize));
         }
 
-        int capacity() const
+        // only available with the counting_pool_stats policy
+        memory_pool_stats stats() const
         {
-            int cap = 0;
+            static_assert(Stats::enabled, "pool statistics need the counting_pool_stats policy");
+            return Stats::snapshot();
+        }
+
+        int64 capacity() const
+        {
+            int64 cap = 0;
             for (const linear_static_pool& pool : Pools)
                 cap += pool.capacity();
             return cap;
         }
 
-        int available() const
+        int64 available() const
         {
             return Pools.back().available();
         }
 
-        NODISCARD void* allocate(int size, int align = 8)
+        NODISCARD void* allocate(int64 size, int align = 8)
         {
             linear_static_pool* pool = &Pools.back();
-            int available = pool->available();
+            int64 available = pool->available();
             if (size > available)
             {
-                int newBlockSize = int(BlockSize * BlockGrowth);
+                int64 newBlockSize = int64(BlockSize * double(BlockGrowth));
                 if (size > newBlockSize)
                     return nullptr; // it will never fit!
 
                 BlockSize = newBlockSize;
-                Pools.emplace_back(newBlockSize);
+                Pools.emplace_back(newBlockSize, Backing, Prefault);
+                Stats::block_added(uint64(newBlockSize));
                 pool = &Pools.back();
             }
-            return pool->allocate(size, align);
+            if constexpr (Stats::enabled)
+            {
+                int64 before = pool->available();
+                void* mem = pool->allocate(size, align);
+                if (mem) Stats::allocated(uint64(size), uint64(before - pool->available() - size));
+                return mem;
+            }
+            else
+            {
+                return pool->allocate(size, align);
+            }
         }
 
         // There is no deallocate -- by design !!
         void deallocate(void*) { }
     };
 
+    using linear_dynamic_pool = basic_linear_dynamic_pool<>;
+
+
+    /**
+     * Bump allocator for request-scoped scratch memory which is released all at once.
+     * Unlike linear_dynamic_pool, it can be rewound to an earlier mark() or reset()
+     * completely, and it keeps its blocks for reuse, so a warmed up arena never touches
+     * malloc again. Requests bigger than half a block get a dedicated block, which is
+     * freed again when the arena is rewound past it.
+     * @code
+     * rpp::arena& tmp = rpp::scratch_arena();
+     * rpp::arena::scope scope { tmp }; // rewinds when the request is done
+     * char* buffer = tmp.allocate_array<char>(size);
+     * @endcode
+     * @tparam Stats Statistics policy, no_pool_stats or counting_pool_stats
+     */
+    template<class Stats = no_pool_stats>
+    class basic_arena : public pool_types_constructor<basic_arena<Stats>>, private Stats
+    {
+        struct block
+        {
+            char* data;
+            size_t size;
+        };
+
+        std::vector<block> Blocks; // retained, reused after rewind/reset
+        std::vector<block> Dedicated;
+        size_t Current = 0; // block which is being filled
+        char* Ptr = nullptr;
+        char* End = nullptr;
+        size_t BlockSize;
+        float BlockGrowth;
+        size_t MaxBlockSize;
+        pool_backing Backing;
+
+    public:
+        struct marker
+        {
+            size_t block;
+            size_t offset;
+            size_t dedicated;
+            uint64 bytesInUse; // only tracked with counting_pool_stats
+        };
+
+        // rewinds the arena to where it was when the scope was created
+        class scope
+        {
+            basic_arena& a;
+            marker m;
+        public:
+            explicit scope(basic_arena& a) noexcept : a{a}, m{a.mark()} {}
+            ~scope() noexcept { a.rewind(m); }
+            scope(const scope&) = delete;
+            scope& operator=(const scope&) = delete;
+        };
+
+        /**
+         * @param blockSize Size of the first block, which is only reserved on the first allocation
+         * @param blockGrowth Every new block is this much bigger than the previous one ...
+         * @param maxBlockSize ... until this size is reached
+         * @param backing Where the memory of the retained blocks comes from
+         */
+        explicit basic_arena(size_t blockSize = 64*1024, float blockGrowth = 2.0f, size_t maxBlockSize = 16*1024*1024,
+                             pool_backing backing = pool_backing::heap)
+            : BlockSize{blockSize}, BlockGrowth{blockGrowth}, MaxBlockSize{maxBlockSize}, Backing{backing}
+        {
+        }
+
+        ~basic_arena() noexcept
+        {
+            for (block& b : Blocks)    detail::free_block(b.data, b.size, Backing);
+            for (block& b : Dedicated) free(b.data);
+        }
+
+        basic_arena(basic_arena&& a) noexcept
+            : Stats{static_cast<Stats&&>(a)}, Blocks{std::move(a.Blocks)}, Dedicated{std::move(a.Dedicated)},
+              Current{a.Current}, Ptr{a.Ptr}, End{a.End}, BlockSize{a.BlockSize},
+              BlockGrowth{a.BlockGrowth}, MaxBlockSize{a.MaxBlockSize}, Backing{a.Backing}
+        {
+            a.Blocks.clear();
+            a.Dedicated.clear();
+            a.Current = 0;
+            a.Ptr = a.End = nullptr;
+        }
+        basic_arena& operator=(basic_arena&& a) noexcept
+        {
+            std::swap(static_cast<Stats&>(*this), static_cast<Stats&>(a));
+            std::swap(Blocks, a.Blocks);
+            std::swap(Dedicated, a.Dedicated);
+            std::swap(Current, a.Current);
+            std::swap(Ptr, a.Ptr);
+            std::swap(End, a.End);
+            std::swap(BlockSize, a.BlockSize);
+            std::swap(BlockGrowth, a.BlockGrowth);
+            std::swap(MaxBlockSize, a.MaxBlockSize);
+            std::swap(Backing, a.Backing);
+            return *this;
+        }
+
+        basic_arena(const basic_arena&) = delete;
+        basic_arena& operator=(const basic_arena&) = delete;
+
+        // total size of all blocks, including the retained free ones
+        size_t capacity() const
+        {
+            size_t cap = 0;
+            for (const block& b : Blocks)    cap += b.size;
+            for (const block& b : Dedicated) cap += b.size;
+            return cap;
+        }
+
+        // free bytes left in the current block
+        size_t available() const { return size_t(End - Ptr); }
+
+        int num_blocks() const { return int(Blocks.size()); }
+        int num_dedicated() const { return int(Dedicated.size()); }
+
+        // only available with the counting_pool_stats policy
+        memory_pool_stats stats() const
+        {
+            static_assert(Stats::enabled, "pool statistics need the counting_pool_stats policy");
+            return Stats::snapshot();
+        }
+
+        NODISCARD marker mark() const noexcept
+        {
+            size_t offset = Blocks.empty() ? 0 : size_t(Ptr - Blocks[Current].data);
+            return { Current, offset, Dedicated.size(), Stats::bytes_in_use() };
+        }
+
+        // frees everything allocated after the mark, but keeps the blocks
+        void rewind(const marker& m) noexcept
+        {
+            while (Dedicated.size() > m.dedicated) {
+                Stats::block_freed(Dedicated.back().size);
+                free(Dedicated.back().data);
+                Dedicated.pop_back();
+            }
+            Stats::rewound_to(m.bytesInUse);
+            if (Blocks.empty()) return;
+            Current = m.block;
+            Ptr = Blocks[Current].data + m.offset;
+            End = Blocks[Current].data + Blocks[Current].size;
+        }
+
+        // frees everything, but keeps the blocks
+        void reset() noexcept { rewind(marker{ 0, 0, 0, 0 }); }
+
+        NODISCARD void* allocate(size_t size, size_t align = 8)
+        {
+            if (void* mem = bump(size, align))
+                return mem;
+            if (size + align > BlockSize / 2)
+                return allocate_dedicated(size, align);
+
+            // move on to the next retained block, or add a new one
+            while (++Current < Blocks.size()) {
+                select(Current);
+                if (void* mem = bump(size, align))
+                    return mem;
+            }
+            if (!Blocks.empty()) // blocks are only added when all of them are in use
+                BlockSize = std::min(MaxBlockSize, std::max(BlockSize, size_t(Blocks.back().size * BlockGrowth)));
+            char* data = detail::allocate_block(BlockSize, Backing, false);
+            if (!data) {
+                Current = Blocks.empty() ? 0 : Blocks.size() - 1;
+                return nullptr;
+            }
+            Blocks.push_back({ data, BlockSize });
+            Stats::block_added(BlockSize);
+            select(Blocks.size() - 1);
+            return bump(size, align);
+        }
+
+        // There is no deallocate, use rewind() or reset() instead
+        void deallocate(void*) { }
+
+    private:
+        void* bump(size_t size, size_t align) noexcept
+        {
+            size_t alignOffset = (align - size_t(Ptr) % align) % align;
+            if (!Ptr || size_t(End - Ptr) < size + alignOffset)
+                return nullptr;
+            char* mem = Ptr + alignOffset;
+            Ptr = mem + size;
+            Stats::allocated(size, alignOffset);
+            return mem;
+        }
+
+        void select(size_t index) noexcept
+        {
+            Current = index;
+            Ptr = Blocks[index].data;
+            End = Ptr + Blocks[index].size;
+        }
+
+        void* allocate_dedicated(size_t size, size_t align)
+        {
+            auto* data = static_cast<char*>(malloc(size + align));
+            if (!data) return nullptr;
+            Dedicated.push_back({ data, size + align });
+            size_t alignOffset = (align - size_t(data) % align) % align;
+            Stats::block_added(size + align);
+            Stats::allocated(size, alignOffset);
+            return data + alignOffset;
+        }
+    };
+
+    using arena = basic_arena<>;
+
+    /**
+     * @return Arena of the calling thread, for temporaries which don't outlive a request
+     *         or a thread_pool task. Always rewind it with an arena::scope, because
+     *         the next task on the same worker thread uses the same arena.
+     */
+    RPPAPI arena& scratch_arena() noexcept;
+
+
+    namespace detail
+    {
+        struct slab_core;
+
+        /**
+         * Untyped thread-caching slab allocator behind basic_slab_pool
+         */
+        class RPPAPI slab_allocator
+        {
+            std::shared_ptr<slab_core> core;
+
+        public:
+            static constexpr size_t slab_size = 64*1024;
+            static constexpr size_t max_small_size = 32*1024;
+            static constexpr size_t max_slab_align = 64;
+            // 16..128 in steps of 16, then 4 classes per doubling: 160, 192, 224, 256, 320 .. 32K
+            static constexpr int num_size_classes = 40;
+            static constexpr int batch_size = 32; // max objects moved between thread caches and the depot
+
+            slab_allocator();
+            ~slab_allocator() noexcept;
+
+            slab_allocator(slab_allocator&&) noexcept = default;
+            slab_allocator& operator=(slab_allocator&&) noexcept = default;
+            slab_allocator(const slab_allocator&) = delete;
+            slab_allocator& operator=(const slab_allocator&) = delete;
+
+            // @return Size class index for a small allocation size [1, max_small_size]
+            static constexpr int size_class(size_t size) noexcept
+            {
+                if (size <= 128)
+                    return int((size + 15) / 16) - 1;
+                int doubling = 0; // 128 << doubling < size <= 256 << doubling
+                while ((size_t(256) << doubling) < size)
+                    ++doubling;
+                size_t step = size_t(32) << doubling;
+                return 8 + doubling*4 + int((size - (size_t(128) << doubling) - 1) / step);
+            }
+
+            // @return Object size of the size class
+            static constexpr size_t class_size(int sizeClass) noexcept
+            {
+                if (sizeClass < 8)
+                    return size_t(sizeClass + 1) * 16;
+                int doubling = (sizeClass - 8) / 4;
+                return (size_t(128) << doubling) + size_t((sizeClass - 8) % 4 + 1) * (size_t(32) << doubling);
+            }
+
+            // @return Objects moved between thread caches and the depot at once,
+            //         fewer for big classes so idle thread caches don't hold on to much memory
+            static constexpr int batch_count(int sizeClass) noexcept
+            {
+                size_t count = (slab_size / 4) / class_size(sizeClass);
+                return count < 1 ? 1 : count > size_t(batch_size) ? batch_size : int(count);
+            }
+
+            // @return Usable bytes of an allocation: its size class, or the size of a dedicated block
+            static size_t allocation_size(const void* ptr) noexcept;
+
+            // total bytes reserved from the system for slabs and dedicated blocks
+            size_t capacity() const noexcept;
+
+            // slab and dedicated block counts
+            memory_pool_stats block_stats() const;
+
+            NODISCARD void* allocate(size_t size, size_t align = 8);
+
+            // frees memory from allocate(), the calling thread doesn't have to be the allocating thread
+            void deallocate(void* ptr) noexcept;
+
+            // returns all objects cached by the calling thread to the shared depot
+            void flush_thread_cache() noexcept;
+        };
+    }
+
+    /**
+     * Thread-caching slab allocator for small objects with a real deallocate().
+     * Sizes up to max_small_size are rounded up to one of the size classes and carved
+     * from 64KB slabs. Every thread keeps a small free list per size class, so
+     * allocate/deallocate normally touch no locks or atomics at all. Full thread caches
+     * return a batch of objects to the shared depot, and empty ones take a batch from it.
+     * Alignments up to 64 are served from the slabs as well, only bigger or more
+     * aligned requests get a dedicated block.
+     *
+     * Objects can be freed from any thread. When a thread exits, its cached objects
+     * go back to the depot. All memory is released when the pool is destroyed.
+     * @code
+     * rpp::slab_pool pool;
+     * Node* node = pool.construct<Node>(key, value);
+     * pool.destruct(node); // returned to this thread's cache
+     * @endcode
+     * @tparam Stats Statistics policy, no_pool_stats or concurrent_pool_stats, because the pool
+     *               is used from many threads at once. Sizes are recorded as the usable bytes
+     *               of each allocation, since deallocate() only knows the size class.
+     */
+    template<class Stats = no_pool_stats>
+    class basic_slab_pool : public pool_types_constructor<basic_slab_pool<Stats>>,
+                            private detail::slab_allocator, private Stats
+    {
+        static_assert(!Stats::enabled || Stats::thread_safe,
+                      "slab_pool is used from many threads, its stats need the concurrent_pool_stats policy");
+        using base = detail::slab_allocator;
+    public:
+        using base::slab_size;
+        using base::max_small_size;
+        using base::max_slab_align;
+        using base::num_size_classes;
+        using base::batch_size;
+        using base::size_class;
+        using base::class_size;
+        using base::batch_count;
+        using base::allocation_size;
+        using base::capacity;
+        using base::flush_thread_cache;
+
+        basic_slab_pool() = default;
+
+        /**
+         * Slab and dedicated block counts, and with the concurrent_pool_stats policy
+         * allocation counts, bytes in use and their peak for leak and high-water tracking
+         */
+        memory_pool_stats stats() const
+        {
+            memory_pool_stats s;
+            if constexpr (Stats::enabled)
+                s = Stats::snapshot();
+            memory_pool_stats blocks = base::block_stats();
+            s.blocks = blocks.blocks;
+            s.block_bytes = blocks.block_bytes;
+            return s;
+        }
+
+        NODISCARD void* allocate(size_t size, size_t align = 8)
+        {
+            void* ptr = base::allocate(size, align);
+            if constexpr (Stats::enabled)
+                if (ptr) Stats::allocated(uint64(allocation_size(ptr)), 0);
+            return ptr;
+        }
+
+        // frees memory from allocate(), the calling thread doesn't have to be the allocating thread
+        void deallocate(void* ptr) noexcept
+        {
+            if constexpr (Stats::enabled)
+                if (ptr) Stats::deallocated(uint64(allocation_size(ptr)));
+            base::deallocate(ptr);
+        }
+    };
+
+    using slab_pool = basic_slab_pool<>;
+
+    /**
+     * Pool of objects of a single type, with O(1) allocate and deallocate through
+     * an intrusive free list stored in the freed slots themselves. Memory is reserved
+     * in chunks of objectsPerChunk slots, which are never returned before the pool is
+     * destroyed. Chunks can optionally be placed on huge pages to reduce TLB misses.
+     * @note Not thread safe. Destroying the pool does not call destructors of live objects
+     * @code
+     * rpp::object_pool<Node> nodes { 4096 };
+     * Node* n = nodes.construct(key, value);
+     * nodes.destruct(n);
+     * @endcode
+     * @tparam Stats Statistics policy, no_pool_stats or counting_pool_stats
+     */
+    template<class T, class Stats = no_pool_stats> class object_pool : private Stats
+    {
+        union slot
+        {
+            slot* next;
+            alignas(T) char storage[sizeof(T)];
+        };
+
+        struct chunk
+        {
+            slot* slots;
+            size_t bytes;
+        };
+
+        slot* FreeList = nullptr;
+        slot* Next = nullptr; // uncarved slots of the newest chunk
+        slot* End  = nullptr;
+        size_t ObjectsPerChunk;
+        size_t Capacity = 0;
+        size_t Live = 0;
+        bool HugePages;
+        std::vector<chunk> Chunks;
+
+    public:
+        static constexpr size_t slot_size  = sizeof(slot);
+        static constexpr size_t slot_align = alignof(slot);
+
+        /**
+         * @param objectsPerChunk Number of objects reserved at once when the pool is full
+         * @param hugePages If true, chunks are rounded up to huge_page_size and
+         *                  placed on huge pages if the system allows it
+         */
+        explicit object_pool(size_t objectsPerChunk = 256, bool hugePages = false)
+            : ObjectsPerChunk{objectsPerChunk ? objectsPerChunk : 1}, HugePages{hugePages}
+        {
+        }
+
+        ~object_pool() noexcept
+        {
+            for (chunk& c : Chunks)
+                free_pages(c.slots, c.bytes, HugePages);
+        }
+
+        object_pool(object_pool&& pool) noexcept
+            : Stats{static_cast<Stats&&>(pool)}, FreeList{pool.FreeList}, Next{pool.Next}, End{pool.End},
+              ObjectsPerChunk{pool.ObjectsPerChunk}, Capacity{pool.Capacity},
+              Live{pool.Live}, HugePages{pool.HugePages}, Chunks{std::move(pool.Chunks)}
+        {
+            pool.FreeList = pool.Next = pool.End = nullptr;
+            pool.Capacity = pool.Live = 0;
+            pool.Chunks.clear();
+        }
+        object_pool& operator=(object_pool&& pool) noexcept
+        {
+            std::swap(static_cast<Stats&>(*this), static_cast<Stats&>(pool));
+            std::swap(FreeList, pool.FreeList);
+            std::swap(Next, pool.Next);
+            std::swap(End, pool.End);
+            std::swap(ObjectsPerChunk, pool.ObjectsPerChunk);
+            std::swap(Capacity, pool.Capacity);
+            std::swap(Live, pool.Live);
+            std::swap(HugePages, pool.HugePages);
+            std::swap(Chunks, pool.Chunks);
+            return *this;
+        }
+
+        object_pool(const object_pool&) = delete;
+        object_pool& operator=(const object_pool&) = delete;
+
+        // number of object slots reserved
+        size_t capacity() const { return Capacity; }
+
+        // number of allocated objects
+        size_t size() const { return Live; }
+
+        // only available with the counting_pool_stats policy
+        memory_pool_stats stats() const
+        {
+            static_assert(Stats::enabled, "pool statistics need the counting_pool_stats policy");
+            return Stats::snapshot();
+        }
+
+        // @return Uninitialized memory for one T, or nullptr if out of memory
+        NODISCARD T* allocate() noexcept
+        {
+            slot* s = FreeList;
+            if (s) {
+                FreeList = s->next;
+            } else {
+                if (Next == End && !grow())
+                    return nullptr;
+                s = Next++;
+            }
+            ++Live;
+            Stats::allocated(sizeof(T), 0);
+            return reinterpret_cast<T*>(s->storage);
+        }
+
+        void deallocate(T* obj) noexcept
+        {
+            if (!obj) return;
+            slot* s = reinterpret_cast<slot*>(obj);
+            s->next = FreeList;
+            FreeList = s;
+            --Live;
+            Stats::deallocated(sizeof(T));
+        }
+
+        template<class... Args> NODISCARD T* construct(Args&&...args)
+        {
+            T* obj = allocate();
+            if (!obj) throw std::bad_alloc{};
+            try { return new (obj) T{std::forward<Args>(args)...}; }
+            catch (...) { deallocate(obj); throw; }
+        }
+
+        // Calls the destructor on the object and returns its slot to the pool
+        void destruct(T* obj)
+        {
+            if (!obj) return;
+            obj->~T();
+            deallocate(obj);
+        }
+
+        // untyped interface for pool_allocator, only requests which fit in a slot can be served
+        static constexpr bool fits(size_t size, size_t align) noexcept
+        {
+            return size <= slot_size && align <= slot_align;
+        }
+        NODISCARD void* allocate(size_t size, size_t align) noexcept
+        {
+            return fits(size, align) ? allocate() : nullptr;
+        }
+        void deallocate(void* ptr) noexcept { deallocate(static_cast<T*>(ptr)); }
+
+    private:
+        bool grow() noexcept
+        {
+            size_t bytes = ObjectsPerChunk * sizeof(slot);
+            if (HugePages) // use the whole huge page
+                bytes = (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+            auto* slots = static_cast<slot*>(allocate_pages(bytes, HugePages));
+            if (!slots) return false;
+            size_t count = bytes / sizeof(slot);
+            Chunks.push_back({ slots, bytes });
+            Stats::block_added(bytes);
+            Next = slots;
+            End = slots + count;
+            Capacity += count;
+            return true;
+        }
+    };
+
+
+    namespace detail
+    {
+        template<class Pool, class = void> struct is_fixed_size_pool : std::false_type {};
+        template<class Pool> struct is_fixed_size_pool<Pool,
+            std::void_t<decltype(Pool::fits(size_t{}, size_t{}))>> : std::true_type {};
+    }
+
+    /**
+     * Standard allocator adapter, so that STL containers can be backed by any of the pools:
+     * linear pools for request-scoped containers which are dropped all at once,
+     * slab_pool for long lived node-based containers, or an object_pool which serves
+     * the requests that fit into its slots, usually the nodes of std::list, std::map
+     * or std::set. Requests that don't fit an object_pool use the global heap.
+     * @note The pool must outlive all containers which use it
+     * @code
+     * rpp::linear_dynamic_pool scratch;
+     * std::vector<Item, rpp::pool_allocator<Item, rpp::linear_dynamic_pool>> items { scratch };
+     * @endcode
+     */
+    template<class T, class Pool> class pool_allocator
+    {
+        template<class U, class P> friend class pool_allocator;
+        Pool* pool;
+
+        static constexpr bool uses_pool(size_t bytes) noexcept
+        {
+            if constexpr (detail::is_fixed_size_pool<Pool>::value)
+                return Pool::fits(bytes, alignof(T));
+            else
+                return true;
+        }
+
+    public:
+        using value_type = T;
+
+        pool_allocator(Pool& pool) noexcept : pool{&pool} {}
+        template<class U> pool_allocator(const pool_allocator<U, Pool>& other) noexcept : pool{other.pool} {}
+
+        Pool& get_pool() const noexcept { return *pool; }
+
+        NODISCARD T* allocate(size_t n)
+        {
+            size_t bytes = n * sizeof(T);
+            if (!uses_pool(bytes))
+                return static_cast<T*>(::operator new(bytes));
+            void* ptr = pool->allocate(bytes, alignof(T));
+            if (!ptr) throw std::bad_alloc{};
+            return static_cast<T*>(ptr);
+        }
+
+        void deallocate(T* ptr, size_t n) noexcept
+        {
+            if (uses_pool(n * sizeof(T))) pool->deallocate(ptr);
+            else ::operator delete(ptr);
+        }
+
+        template<class U> bool operator==(const pool_allocator<U, Pool>& other) const noexcept
+        {
+            return pool == other.pool;
+        }
+        template<class U> bool operator!=(const pool_allocator<U, Pool>& other) const noexcept
+        {
+            return pool != other.pool;
+        }
+    };
 
 }
@@ -0,0 +1,379 @@
+#pragma once
+/**
+ * Parallel pipeline of typed stages on top of rpp::thread_pool, Copyright (c) 2017-2018, Jorma Rebane
+ * Distributed under MIT Software License
+ */
+#include "thread_pool.h"
+#include "collections.h" // mpmc_ring, spsc_ring
+#include <optional>
+#include <type_traits>
+
+namespace rpp
+{
+    /**
+     * How a pipeline stage processes its items
+     */
+    enum class stage_mode
+    {
+        // items are processed concurrently and may leave the stage in any order
+        parallel,
+
+        // one item at a time, in the exact order the source produced them
+        serial_in_order,
+    };
+
+    template<class In> class pipeline;
+
+    namespace detail
+    {
+        // shared by all stages of a pipeline
+        struct pipeline_state
+        {
+            thread_pool& pool;
+            const int capacity; // maximum number of items in flight
+            mutex m;
+            condition_variable cv;
+            int inFlight = 0;
+            int runningTasks = 0; // stage tasks which may still touch the stages
+            atomic_bool failed { false };
+            exception_ptr error;
+
+            pipeline_state(thread_pool& pool, int capacity) : pool{pool}, capacity{capacity} {}
+
+            void fail(exception_ptr e) noexcept
+            {
+                lock_guard<mutex> lock{m};
+                if (!error) error = move(e);
+                failed = true;
+            }
+
+            // an item has left the last stage, its slot can be given to a new item
+            void item_done() noexcept
+            {
+                lock_guard<mutex> lock{m};
+                --inFlight;
+                cv.notify_all();
+            }
+
+            void task_started() noexcept
+            {
+                lock_guard<mutex> lock{m};
+                ++runningTasks;
+            }
+
+            // must be the last thing a stage task does, the pipeline can be destroyed right after
+            void task_finished() noexcept
+            {
+                lock_guard<mutex> lock{m};
+                --runningTasks;
+                cv.notify_all();
+            }
+        };
+
+        template<class T> struct pipeline_input
+        {
+            virtual ~pipeline_input() noexcept = default;
+            // an empty item means it was dropped because the pipeline failed,
+            // but serial stages still need its sequence number
+            virtual void push(uint64 seq, std::optional<T>&& item) noexcept = 0;
+        };
+
+        struct pipeline_stage_base
+        {
+            virtual ~pipeline_stage_base() noexcept = default;
+        };
+
+        /**
+         * Bounded input queue and worker tasks of a single stage. The queue never
+         * holds more than the pipeline capacity, so it's a fixed lock-free ring:
+         * an spsc_ring if the stage is serial and has a single producer (the source
+         * or a serial stage), otherwise an mpmc_ring. Serial stages put items from
+         * parallel upstream stages back into order with a small reorder buffer.
+         */
+        template<class In, class Out, class Func>
+        class pipeline_stage final : public pipeline_stage_base, public pipeline_input<In>
+        {
+            struct entry
+            {
+                uint64 seq = 0;
+                bool filled = false;
+                std::optional<In> item;
+            };
+
+            pipeline_state& state;
+            Func func;
+            const stage_mode mode;
+            const int maxActive;
+            std::unique_ptr<spsc_ring<entry>> spsc; // serial stage with a single producer
+            std::unique_ptr<mpmc_ring<entry>> mpmc; // everything else
+            std::atomic<int> active { 0 };          // number of running drain tasks
+            // serial_in_order: only touched by the single active drain task
+            vector<entry> reorder; // indexed by seq % size
+            uint64 nextSeq = 0;    // next item to process
+
+        public:
+            pipeline_input<Out>* next = nullptr; // null for the last stage
+
+            pipeline_stage(pipeline_state& state, Func&& func, stage_mode mode,
+                           int maxActive, bool singleProducer)
+                : state{state}, func{move(func)}, mode{mode},
+                  maxActive{mode == stage_mode::serial_in_order ? 1 : maxActive}
+            {
+                if (mode == stage_mode::serial_in_order) {
+                    reorder.resize(size_t(state.capacity));
+                    if (singleProducer)
+                        spsc = std::make_unique<spsc_ring<entry>>(size_t(state.capacity));
+                }
+                if (!spsc)
+                    mpmc = std::make_unique<mpmc_ring<entry>>(size_t(state.capacity));
+            }
+
+            void push(uint64 seq, std::optional<In>&& item) noexcept override
+            {
+                entry e { seq, true, move(item) };
+                // at most `capacity` items are in flight, so this only retries while
+                // a consumer is still finishing its pop of a neighbouring cell
+                while (!(spsc ? spsc->try_push(move(e)) : mpmc->try_push(move(e))))
+                    std::this_thread::yield();
+
+                // pairs with the fence in drain(): either we see the drain task leave,
+                // or it sees our item when it rechecks the queue
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (try_acquire_drain())
+                    start_drain();
+            }
+
+        private:
+            bool try_acquire_drain() noexcept
+            {
+                int n = active.load();
+                while (n < maxActive)
+                    if (active.compare_exchange_weak(n, n + 1))
+                        return true;
+                return false;
+            }
+
+            void start_drain() noexcept
+            {
+                state.task_started();
+                // a pool with a queue limit can refuse the task, then drain right here
+                if (!state.pool.try_parallel_task([this] { drain(); }))
+                    drain();
+            }
+
+            bool pop(entry& e) noexcept
+            {
+                return spsc ? spsc->try_pop(e) : mpmc->try_pop(e);
+            }
+
+            bool queue_empty() const noexcept
+            {
+                return spsc ? spsc->empty_approx() : mpmc->empty_approx();
+            }
+
+            void drain() noexcept
+            {
+                for (;;)
+                {
+                    entry e;
+                    while (pop(e))
+                    {
+                        if (mode == stage_mode::parallel)
+                            process(e.seq, move(e.item));
+                        else
+                            process_in_order(move(e));
+                    }
+                    active.fetch_sub(1);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    // an item pushed while we were leaving is ours if nobody else took over
+                    if (queue_empty() || !try_acquire_drain())
+                        break;
+                }
+                state.task_finished();
+            }
+
+            void process_in_order(entry&& e) noexcept
+            {
+                reorder[e.seq % reorder.size()] = move(e);
+                for (;;)
+                {
+                    entry& ready = reorder[nextSeq % reorder.size()];
+                    if (!ready.filled || ready.seq != nextSeq)
+                        break;
+                    std::optional<In> item = move(ready.item);
+                    ready.item.reset();
+                    ready.filled = false;
+                    process(nextSeq++, move(item));
+                }
+            }
+
+            void process(uint64 seq, std::optional<In>&& item) noexcept
+            {
+                if constexpr (std::is_void_v<Out>)
+                {
+                    if (item && !state.failed) {
+                        try { func(move(*item)); }
+                        catch (...) { state.fail(std::current_exception()); }
+                    }
+                    state.item_done();
+                }
+                else
+                {
+                    std::optional<Out> result;
+                    if (item && !state.failed) {
+                        try { result.emplace(func(move(*item))); }
+                        catch (...) { state.fail(std::current_exception()); }
+                    }
+                    if (next) next->push(seq, move(result));
+                    else      state.item_done(); // the result of the last stage is discarded
+                }
+            }
+        };
+
+        struct pipeline_core
+        {
+            pipeline_state state;
+            vector<unique_ptr<pipeline_stage_base>> stages;
+
+            pipeline_core(thread_pool& pool, int capacity) : state{pool, capacity} {}
+        };
+    }
+
+
+    /**
+     * Attaches further stages after a stage which outputs T
+     */
+    template<class T> class pipeline_builder
+    {
+        detail::pipeline_core* core;
+        detail::pipeline_input<T>** link; // where the next stage is connected
+        bool singleProducer; // items are pushed by the source or by a serial stage
+
+    public:
+        pipeline_builder(detail::pipeline_core* core, detail::pipeline_input<T>** link,
+                         bool singleProducer) noexcept
+            : core{core}, link{link}, singleProducer{singleProducer} {}
+
+        /**
+         * Adds a stage which transforms T into the return type of func
+         * @param mode Whether the stage runs items in parallel or serially in order
+         * @param func Stage function:  R(T item)
+         * @param maxParallelism Limit for parallel stages. If 0, thread_pool::max_workers() is used
+         */
+        template<class Func>
+        auto then(stage_mode mode, Func&& func, int maxParallelism = 0)
+        {
+            static_assert(!std::is_void_v<T>, "a stage which returns void must be the last stage");
+            using R = std::invoke_result_t<std::decay_t<Func>&, T&&>;
+            using Stage = detail::pipeline_stage<T, R, std::decay_t<Func>>;
+            if (maxParallelism <= 0)
+                maxParallelism = core->state.pool.max_workers();
+            auto stage = std::make_unique<Stage>(core->state, std::decay_t<Func>{std::forward<Func>(func)},
+                                                 mode, maxParallelism, singleProducer);
+            Stage* s = stage.get();
+            core->stages.emplace_back(move(stage));
+            *link = s;
+            const bool serial = mode == stage_mode::serial_in_order;
+            if constexpr (std::is_void_v<R>)
+                return pipeline_builder<void>{ core, nullptr, serial };
+            else
+                return pipeline_builder<R>{ core, &s->next, serial };
+        }
+    };
+
+
+    /**
+     * Chain of typed stages, such as read -> parse -> transform -> write, where every stage
+     * can process items in parallel or serially in the source order. Stages run as tasks on
+     * a thread_pool and are connected through bounded queues. The number of items in flight
+     * is limited, so memory use stays bounded no matter how slow the last stage is,
+     * and no pool thread ever blocks on a full queue.
+     * @code
+     * rpp::pipeline<string> ingest { rpp::thread_pool::global(), 64 };
+     * ingest.then(rpp::stage_mode::parallel,        [](string path) { return read_file(path); })
+     *       .then(rpp::stage_mode::parallel,        [](Buffer data)  { return parse(data); })
+     *       .then(rpp::stage_mode::serial_in_order, [&](Record rec)  { writer.write(rec); });
+     *
+     * size_t i = 0;
+     * ingest.run([&]() -> std::optional<string> {
+     *     if (i == paths.size()) return std::nullopt; // end of stream
+     *     return paths[i++];
+     * });
+     * @endcode
+     */
+    template<class In> class pipeline
+    {
+        detail::pipeline_core core;
+        detail::pipeline_input<In>* first = nullptr;
+        uint64 nextSeq = 0;
+
+    public:
+        /**
+         * @param pool Thread pool which runs the stages
+         * @param maxInFlight Maximum number of items inside the pipeline.
+         *                    If 0, 4 * pool.max_workers() is used
+         */
+        explicit pipeline(thread_pool& pool = thread_pool::global(), int maxInFlight = 0)
+            : core{pool, maxInFlight > 0 ? maxInFlight : 4 * pool.max_workers()}
+        {
+        }
+        ~pipeline() noexcept = default;
+        NOCOPY_NOMOVE(pipeline)
+
+        // maximum number of items inside the pipeline
+        int capacity() const noexcept { return core.state.capacity; }
+
+        /**
+         * Adds the first stage, which receives items from the source
+         * @see pipeline_builder::then()
+         */
+        template<class Func>
+        auto then(stage_mode mode, Func&& func, int maxParallelism = 0)
+        {
+            return pipeline_builder<In>{ &core, &first, true }.then(mode, std::forward<Func>(func), maxParallelism);
+        }
+
+        /**
+         * Pulls items from the source on the calling thread and pushes them through
+         * the stages until the source returns an empty optional, which marks the end
+         * of the stream. Blocks until every item has left the last stage.
+         * @note If the source or any stage throws, no new items are pulled, the remaining
+         *       items skip the stages, and the first exception is rethrown here.
+         * @param source Callable:  std::optional<In>()
+         */
+        template<class Source> void run(Source&& source)
+        {
+            detail::pipeline_state& s = core.state;
+            s.failed = false;
+            s.error = nullptr;
+            for (;;)
+            {
+                { unique_lock<mutex> lock{s.m};
+                    while (s.inFlight >= s.capacity)
+                        s.cv.wait(lock);
+                }
+                if (s.failed)
+                    break;
+
+                std::optional<In> item;
+                try { item = source(); }
+                catch (...) { s.fail(std::current_exception()); break; }
+                if (!item)
+                    break; // end of stream
+
+                if (!first)
+                    continue;
+                { lock_guard<mutex> lock{s.m};
+                    ++s.inFlight;
+                }
+                first->push(nextSeq++, move(item));
+            }
+
+            unique_lock<mutex> lock{s.m};
+            while (s.inFlight > 0 || s.runningTasks > 0)
+                s.cv.wait(lock);
+            if (s.error)
+                rethrow_exception(s.error);
+        }
+    };
+}
@@ -3,9 +3,21 @@
 #include <cassert>
 #include <csignal>
 #include <unordered_map>
+#include <algorithm> // std::push_heap
 #if __APPLE__ || __linux__
 # include <pthread.h>
 #endif
+#if __linux__
+# include <sched.h>  // cpu_set_t
+# include <dirent.h> // opendir
+# include <unistd.h> // syscall
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <climits>  // INT_MAX
+#endif
+#if (_M_IX86 || _M_X64 || __i386__ || __x86_64__)
+# include <immintrin.h> // _mm_pause
+#endif
 #if __has_include("debugging.h")
 # include "debugging.h"
 #endif
@@ -23,6 +35,7 @@ namespace rpp
     #  define WIN32_LEAN_AND_MEAN 1
     #endif
     #include <Windows.h>
+    #pragma comment(lib, "Synchronization.lib") // WaitOnAddress
     #pragma pack(push,8)
     struct THREADNAME_INFO
     {
@@ -52,6 +65,272 @@ namespace rpp
         #endif
     }
 
+    bool set_this_thread_affinity(const vector<int>& cpus)
+    {
+        if (cpus.empty())
+            return false;
+        #if __linux__
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : cpus)
+                if (0 <= cpu && cpu < CPU_SETSIZE) CPU_SET(cpu, &set);
+            return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+        #elif _WIN32
+            DWORD_PTR mask = 0;
+            for (int cpu : cpus)
+                if (0 <= cpu && cpu < int(sizeof(mask)*8)) mask |= DWORD_PTR(1) << cpu;
+            return mask && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+        #else
+            return false; // macOS only has affinity hints, which are ignored on Apple Silicon
+        #endif
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+#if __linux__
+    // parses a sysfs cpulist such as "0-3,8-11"
+    static vector<int> read_cpu_list(const char* path)
+    {
+        vector<int> cpus;
+        FILE* f = fopen(path, "rb");
+        if (!f) return cpus;
+        char buf[4096];
+        size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+        fclose(f);
+        buf[n] = '\0';
+
+        for (char* p = buf; *p && *p != '\n';)
+        {
+            char* end;
+            int first = (int)strtol(p, &end, 10);
+            if (end == p) break;
+            int last = first;
+            p = end;
+            if (*p == '-') {
+                last = (int)strtol(p + 1, &end, 10);
+                p = end;
+            }
+            for (int cpu = first; cpu <= last; ++cpu)
+                cpus.push_back(cpu);
+            if (*p == ',') ++p;
+        }
+        return cpus;
+    }
+
+    static cpu_topology query_topology()
+    {
+        cpu_topology topo;
+        vector<int> online = read_cpu_list("/sys/devices/system/cpu/online");
+        if (online.empty())
+            for (int cpu = 0; cpu < (int)thread::hardware_concurrency(); ++cpu)
+                online.push_back(cpu);
+        topo.num_cpus = (int)online.size();
+
+        if (DIR* dir = opendir("/sys/devices/system/node"))
+        {
+            while (dirent* e = readdir(dir))
+            {
+                int id;
+                if (sscanf(e->d_name, "node%d", &id) != 1)
+                    continue;
+                char path[128];
+                snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", id);
+                numa_node node { id, {} };
+                for (int cpu : read_cpu_list(path))
+                    if (std::binary_search(online.begin(), online.end(), cpu))
+                        node.cpus.push_back(cpu);
+                if (!node.cpus.empty()) // skip memory-only nodes
+                    topo.nodes.emplace_back(move(node));
+            }
+            closedir(dir);
+            std::sort(topo.nodes.begin(), topo.nodes.end(),
+                      [](const numa_node& a, const numa_node& b) { return a.id < b.id; });
+        }
+        if (topo.nodes.empty()) // no NUMA support in the kernel
+            topo.nodes.push_back(numa_node{ 0, online });
+        return topo;
+    }
+#else
+    static cpu_topology query_topology()
+    {
+        cpu_topology topo;
+        topo.num_cpus = (int)thread::hardware_concurrency();
+        numa_node node;
+        for (int cpu = 0; cpu < topo.num_cpus; ++cpu)
+            node.cpus.push_back(cpu);
+        topo.nodes.emplace_back(move(node));
+        return topo;
+    }
+#endif
+
+    const cpu_topology& cpu_topology::get()
+    {
+        static cpu_topology topology = query_topology();
+        return topology;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    static void cpu_relax() noexcept
+    {
+    #if (_M_IX86 || _M_X64 || __i386__ || __x86_64__)
+        _mm_pause();
+    #elif __aarch64__ || __arm__
+        asm volatile("yield");
+    #endif
+    }
+
+#if __linux__
+    static void futex_wait(std::atomic<uint>& addr, uint expected, const timespec* timeout) noexcept
+    {
+        syscall(SYS_futex, reinterpret_cast<uint*>(&addr), FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+    }
+    static void futex_wake(std::atomic<uint>& addr, int count) noexcept
+    {
+        syscall(SYS_futex, reinterpret_cast<uint*>(&addr), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+#endif
+
+    void event_count::wait(key k) noexcept
+    {
+    #if __linux__
+        while (epoch.load() == k)
+            futex_wait(epoch, k, nullptr);
+    #elif _WIN32
+        while (epoch.load() == k)
+            WaitOnAddress(&epoch, &k, sizeof(k), INFINITE);
+    #else
+        { unique_lock<mutex> lock{m};
+            while (epoch.load() == k)
+                cv.wait(lock);
+        }
+    #endif
+        --waiters;
+    }
+
+    bool event_count::wait_until(key k, steady_time_t deadline) noexcept
+    {
+        bool notified = true;
+    #if __linux__ || _WIN32
+        while (epoch.load() == k)
+        {
+            auto remaining = deadline - std::chrono::steady_clock::now();
+            if (remaining.count() <= 0) {
+                notified = false;
+                break;
+            }
+        #if __linux__
+            auto secs = std::chrono::duration_cast<seconds_t>(remaining);
+            timespec timeout;
+            timeout.tv_sec  = secs.count();
+            timeout.tv_nsec = long(std::chrono::duration_cast<std::chrono::nanoseconds>(remaining - secs).count());
+            futex_wait(epoch, k, &timeout);
+        #else
+            WaitOnAddress(&epoch, &k, sizeof(k), 
+                DWORD(std::chrono::duration_cast<milliseconds_t>(remaining).count() + 1));
+        #endif
+        }
+    #else
+        { unique_lock<mutex> lock{m};
+            while (epoch.load() == k)
+            {
+                if (cv.wait_until(lock, deadline) == cv_status::timeout) {
+                    notified = epoch.load() != k;
+                    break;
+                }
+            }
+        }
+    #endif
+        --waiters;
+        return notified;
+    }
+
+    void event_count::notify_one() noexcept
+    {
+        ++epoch;
+        if (waiters.load() > 0)
+        {
+        #if __linux__
+            futex_wake(epoch, 1);
+        #elif _WIN32
+            WakeByAddressSingle(&epoch);
+        #else
+            lock_guard<mutex> lock{m};
+            cv.notify_one();
+        #endif
+        }
+    }
+
+    void event_count::notify_all() noexcept
+    {
+        ++epoch;
+        if (waiters.load() > 0)
+        {
+        #if __linux__
+            futex_wake(epoch, INT_MAX);
+        #elif _WIN32
+            WakeByAddressAll(&epoch);
+        #else
+            lock_guard<mutex> lock{m};
+            cv.notify_all();
+        #endif
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    bool semaphore::spin_wait() noexcept
+    {
+        // a permit can only show up during the spin if the notifier runs on another core
+        static const bool multiCore = thread::hardware_concurrency() > 1;
+        if (multiCore)
+        {
+            for (int i = 0; i < 256; ++i)
+            {
+                cpu_relax();
+                if (value.load(std::memory_order_relaxed) > 0 && try_wait())
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    void semaphore::wait_slow() noexcept
+    {
+        if (spin_wait())
+            return;
+        for (;;)
+        {
+            event_count::key key = parked.prepare_wait();
+            if (try_wait()) {
+                parked.cancel_wait();
+                return;
+            }
+            parked.wait(key);
+            if (try_wait())
+                return;
+        }
+    }
+
+    semaphore::wait_result semaphore::wait_until(steady_time_t deadline) noexcept
+    {
+        if (try_wait() || spin_wait())
+            return notified;
+        for (;;)
+        {
+            event_count::key key = parked.prepare_wait();
+            if (try_wait()) {
+                parked.cancel_wait();
+                return notified;
+            }
+            bool woken = parked.wait_until(key, deadline);
+            if (try_wait())
+                return notified;
+            if (!woken)
+                return timeout;
+        }
+    }
+
     ///////////////////////////////////////////////////////////////////////////////
 
 #if POOL_TASK_DEBUG
@@ -70,7 +349,90 @@ namespace rpp
 #  define UnhandledEx(fmt, ...) fprintf(stderr, "pool_task::unhandled_exception $ " fmt "\n", ##__VA_ARGS__)
 #endif
 
-    pool_task::pool_task()
+    static int log2_bucket(uint64 nanos) noexcept
+    {
+    #if __GNUC__ || __clang__
+        int bucket = nanos ? 63 - __builtin_clzll(nanos) : 0;
+    #else
+        int bucket = 0;
+        while (nanos >>= 1) ++bucket;
+    #endif
+        return bucket < duration_histogram::num_buckets ? bucket : duration_histogram::num_buckets - 1;
+    }
+
+    void duration_histogram::record(uint64 nanos) noexcept
+    {
+        buckets[log2_bucket(nanos)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        totalNanos.fetch_add(nanos, std::memory_order_relaxed);
+        uint64 prevMax = maxNanos.load(std::memory_order_relaxed);
+        while (prevMax < nanos && !maxNanos.compare_exchange_weak(prevMax, nanos, std::memory_order_relaxed)) {}
+    }
+
+    duration_histogram::snapshot duration_histogram::get() const noexcept
+    {
+        snapshot s;
+        for (int i = 0; i < num_buckets; ++i)
+            s.buckets[i] = buckets[i].load(std::memory_order_relaxed);
+        s.count    = count.load(std::memory_order_relaxed);
+        s.total_ns = totalNanos.load(std::memory_order_relaxed);
+        s.max_ns   = maxNanos.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    uint64 duration_histogram::snapshot::percentile_ns(double percentile) const noexcept
+    {
+        uint64 total = 0;
+        for (uint64 n : buckets) total += n;
+        const uint64 target = uint64(percentile * total + 0.5);
+        uint64 seen = 0;
+        for (int i = 0; i < num_buckets - 1; ++i)
+        {
+            seen += buckets[i];
+            if (seen >= target && seen > 0)
+            {
+                uint64 upper = 1ull << (i + 1);
+                return upper < max_ns ? upper : max_ns;
+            }
+        }
+        return max_ns;
+    }
+
+    pool_stats::pool_stats() noexcept : enabled{ std::chrono::steady_clock::now() }
+    {
+    }
+
+    void pool_stats::record_task(steady_time_t queued, steady_time_t started, 
+                                 steady_time_t finished, int worker) noexcept
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::nanoseconds;
+        if (queued.time_since_epoch().count() != 0) // enqueued before stats were enabled?
+            queue_latency.record(uint64(duration_cast<nanoseconds>(started - queued).count()));
+        const uint64 runNanos = uint64(duration_cast<nanoseconds>(finished - started).count());
+        run_time.record(runNanos);
+        if (0 <= worker && worker < max_tracked_workers)
+            workerBusy[worker].nanos.fetch_add(runNanos, std::memory_order_relaxed);
+    }
+
+    pool_stats_snapshot pool_stats::get(int numWorkers) const
+    {
+        pool_stats_snapshot s;
+        s.queue_latency   = queue_latency.get();
+        s.run_time        = run_time.get();
+        s.threads_spawned = threads_spawned.load(std::memory_order_relaxed);
+        s.threads_retired = threads_retired.load(std::memory_order_relaxed);
+        s.uptime = dseconds_t{ std::chrono::steady_clock::now() - enabled }.count();
+        if (numWorkers > max_tracked_workers) numWorkers = max_tracked_workers;
+        s.worker_busy.resize(numWorkers);
+        for (int i = 0; i < numWorkers; ++i)
+            s.worker_busy[i] = workerBusy[i].nanos.load(std::memory_order_relaxed) / 1e9;
+        return s;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    pool_task::pool_task(pool_stats* stats) : stats{stats}
     {
         // @note thread must start AFTER mutexes, flags, etc. are initialized, or we'll have a nasty race condition
         th = thread{[this] { run(); }};
@@ -92,6 +454,7 @@ namespace rpp
             error = nullptr;
             if (auto tracer = TraceProvider)
                 trace = tracer();
+            queuedAt = stats ? std::chrono::steady_clock::now() : steady_time_t{};
             genericTask  = {};
             rangeTask    = newTask;
             rangeStart   = start;
@@ -104,8 +467,9 @@ namespace rpp
                 th = thread{[this] { run(); }}; // restart thread if needed
             }
             taskRunning = true;
-            cv.notify_one();
+            signaled = true;
         }
+        taskReady.notify_one();
     }
 
     void pool_task::run_generic(task_delegate<void()>&& newTask) noexcept
@@ -118,6 +482,7 @@ namespace rpp
             error = nullptr;
             if (auto tracer = TraceProvider)
                 trace = tracer();
+            queuedAt = stats ? std::chrono::steady_clock::now() : steady_time_t{};
             genericTask  = move(newTask);
             rangeTask    = {};
             rangeStart   = 0;
@@ -130,8 +495,9 @@ namespace rpp
                 th = thread{[this] { run(); }}; // restart thread if needed
             }
             taskRunning = true;
-            cv.notify_one();
+            signaled = true;
         }
+        taskReady.notify_one();
     }
 
     pool_task::wait_result pool_task::wait(int timeoutMillis)
@@ -167,8 +533,10 @@ namespace rpp
         { unique_lock<mutex> lock{m};
             TaskDebug("killing task");
             killed = true;
+            signaled = true;
         }
         cv.notify_all();
+        taskReady.notify_all();
         wait_result result = wait(timeoutMillis, std::nothrow);
         return join_or_detach(result);
     }
@@ -196,8 +564,12 @@ namespace rpp
         snprintf(name, sizeof(name), "rpp_task_%d", pool_task_id++);
         set_this_thread_name(name);
         //TaskDebug("%s start", name);
+        if (pool_stats* s = stats)
+            ++s->threads_spawned;
         for (;;)
         {
+            pool_stats* s = nullptr;
+            steady_time_t queued, started;
             try
             {
                 decltype(rangeTask)   range;
@@ -208,6 +580,8 @@ namespace rpp
                     //TaskDebug("%s wait for task", name);
                     if (!wait_for_task(lock)) {
                         TaskDebug("%s stop (%s)", name, killed ? "killed" : "timeout");
+                        if (pool_stats* retired = stats; retired && !killed)
+                            ++retired->threads_retired;
                         killed = true;
                         taskRunning = false;
                         cv.notify_all();
@@ -217,8 +591,12 @@ namespace rpp
                     generic = move(genericTask);
                     rangeTask   = {};
                     genericTask = {};
+                    signaled    = false;
                     taskRunning = true;
+                    queued = queuedAt;
                 }
+                if ((s = stats) != nullptr)
+                    started = std::chrono::steady_clock::now();
                 if (range)
                 {
                     //TaskDebug("%s(range_task[%d,%d))", name, rangeStart, rangeEnd);
@@ -234,6 +612,8 @@ namespace rpp
             catch (const exception& e) { unhandled_exception(e.what()); }
             catch (const char* e)      { unhandled_exception(e);        }
             catch (...)                { unhandled_exception("");       }
+            if (s)
+                s->record_task(queued, started, std::chrono::steady_clock::now(), -1);
             { lock_guard<mutex> lock{m};
                 taskRunning = false;
                 cv.notify_all();
@@ -253,22 +633,126 @@ namespace rpp
         return (bool)rangeTask || (bool)genericTask;
     }
 
+    bool pool_task::spin_for_task() noexcept
+    {
+        // spinning only pays off if the submitting thread can run at the same time
+        static const bool multiCore = thread::hardware_concurrency() > 1;
+        if (!multiCore)
+            return false;
+
+        constexpr int MinSpin = 32, MaxSpin = 16*1024;
+        for (int i = 0; i < spinLimit; ++i)
+        {
+            if (signaled.load(std::memory_order_acquire))
+            {
+                spinLimit = spinLimit*2 < MaxSpin ? spinLimit*2 : MaxSpin;
+                return true;
+            }
+            cpu_relax();
+        }
+        spinLimit = spinLimit/2 > MinSpin ? spinLimit/2 : MinSpin;
+        return false;
+    }
+
     bool pool_task::wait_for_task(unique_lock<mutex>& lock) noexcept
     {
+        const bool idleTimeout = maxIdleTime > 0.000001f;
+        const steady_time_t idleDeadline = std::chrono::steady_clock::now() 
+            + std::chrono::duration_cast<std::chrono::steady_clock::duration>(fseconds_t(maxIdleTime));
         for (;;)
         {
             if (killed)
                 return false;
             if (got_task())
                 return true;
-            if (maxIdleTime > 0.000001f)
+
+            // a short adaptive spin catches back-to-back tasks without any syscalls,
+            // after that park on the eventcount until run_range/run_generic/kill notify us
+            lock.unlock();
+            if (!spin_for_task())
             {
-                if (cv.wait_for(lock, fseconds_t(maxIdleTime)) == cv_status::timeout)
+                event_count::key key = taskReady.prepare_wait();
+                if (signaled)
+                {
+                    taskReady.cancel_wait();
+                }
+                else if (!idleTimeout)
+                {
+                    taskReady.wait(key);
+                }
+                else if (!taskReady.wait_until(key, idleDeadline))
+                {
+                    lock.lock();
                     return got_task(); // make sure to check for task even if it timeouts
+                }
             }
+            lock.lock();
+        }
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    // the work-stealing worker that is running on this thread, if any
+    static thread_local pool_worker* CurrentWorker;
+
+    pool_worker::pool_worker(thread_pool& pool, int index)
+        : pool{pool}, seed{unsigned(index) * 2654435761u + 1u}, index{index}
+    {
+    }
+
+    pool_worker::~pool_worker() noexcept
+    {
+        join();
+    }
+
+    void pool_worker::start()
+    {
+        th = thread{[this] { run(); }};
+    }
+
+    void pool_worker::join() noexcept
+    {
+        if (th.joinable())
+        {
+            // can't join if we're on the same thread as the worker itself
+            if (std::this_thread::get_id() == th.get_id())
+                th.detach();
             else
+                th.join();
+        }
+    }
+
+    int pool_worker::next_victim(int numWorkers) noexcept
+    {
+        // xorshift32, good enough to spread thieves across peers
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return int(seed % unsigned(numWorkers));
+    }
+
+    void pool_worker::run() noexcept
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "rpp_worker_%d", index);
+        set_this_thread_name(name);
+        if (!pool.workerCpus.empty())
+            set_this_thread_affinity({ pool.workerCpus[index % pool.workerCpus.size()] });
+        CurrentWorker = this;
+        for (;;)
+        {
+            if (pool_job* job = pool.take_job(this))
             {
-                cv.wait(lock);
+                busy = true;
+                pool.run_job(job);
+                busy = false;
+                continue;
+            }
+            if (!pool.park_worker())
+            {
+                TaskDebug("%s stop", name);
+                CurrentWorker = nullptr;
+                return;
             }
         }
     }
@@ -320,11 +804,58 @@ namespace rpp
         coreCount = num_physical_cores();
     }
 
+    thread_pool::thread_pool(pool_mode mode, int numWorkers) : mode{mode}, maxWorkers{numWorkers}
+    {
+        coreCount = num_physical_cores();
+    }
+
     thread_pool::~thread_pool() noexcept
     {
         // defined destructor to prevent agressive inlining and to manually control task destruction
+        stop_timers(); // periodic jobs which are still running will see timerStopping
+        stop_workers();
+        { lock_guard<mutex> lock{tasksMutex};
+            tasks.clear();
+        }
+        delete statsData.load();
+    }
+
+    int thread_pool::current_worker_index() const noexcept
+    {
+        pool_worker* self = CurrentWorker;
+        return self && &self->pool == this ? self->index : -1;
+    }
+
+    void thread_pool::set_mode(pool_mode newMode, int numWorkers) noexcept
+    {
+        if (newMode != pool_mode::work_stealing || numWorkers != maxWorkers)
+            stop_workers();
+        maxWorkers = numWorkers;
+        mode = newMode;
+    }
+
+    void thread_pool::enable_stats(bool enable) noexcept
+    {
         lock_guard<mutex> lock{tasksMutex};
-        tasks.clear();
+        pool_stats* data = statsData;
+        if (enable && !data)
+            statsData = data = new pool_stats{};
+        stats = enable ? data : nullptr;
+        for (auto& task : tasks)
+            task->set_stats(stats);
+    }
+
+    pool_stats_snapshot thread_pool::stats_snapshot() const
+    {
+        if (pool_stats* data = statsData)
+            return data->get(max_workers());
+        return {};
+    }
+
+    void thread_pool::set_worker_affinity(vector<int> cpus) noexcept
+    {
+        stop_workers(); // workers are pinned when they start
+        workerCpus = move(cpus);
     }
 
     int thread_pool::active_tasks() noexcept
@@ -333,6 +864,9 @@ namespace rpp
         int active = 0;
         for (auto& task : tasks) 
             if (task->running()) ++active;
+        if (workersStarted)
+            for (auto& worker : workers)
+                if (worker->running()) ++active;
         return active;
     }
 
@@ -342,12 +876,15 @@ namespace rpp
         int idle = 0;
         for (auto& task : tasks)
             if (!task->running()) ++idle;
+        if (workersStarted)
+            for (auto& worker : workers)
+                if (!worker->running()) ++idle;
         return idle;
     }
 
     int thread_pool::total_tasks() const noexcept
     {
-        return (int)tasks.size();
+        return (int)tasks.size() + (workersStarted ? (int)workers.size() : 0);
     }
 
     int thread_pool::clear_idle_tasks() noexcept
@@ -383,7 +920,7 @@ namespace rpp
             }
         }
 
-        auto t  = std::make_unique<pool_task>();
+        auto t  = std::make_unique<pool_task>(stats);
         auto* task = t.get();
         task->max_idle_time(taskMaxIdleTime);
         task->run_range(rangeStart, rangeEnd, rangeTask);
@@ -401,48 +938,302 @@ namespace rpp
             task->max_idle_time(taskMaxIdleTime);
     }
 
+    /**
+     * Shared state of a single fork-join parallel_for. Chunks are claimed by the
+     * calling thread and by helper jobs, whoever drops the last reference frees it.
+     * Helpers that start after all chunks were claimed never touch the range task.
+     */
+    struct fork_join_group
+    {
+        thread_pool& pool;
+        action<int, int> body;
+        const int rangeStart;
+        const int rangeEnd;
+        const parallel_schedule schedule;
+        const int numChunks;  // equal_slices and dynamic
+        const int grainSize;  // minimum chunk for guided
+        const int numWorkers; // participants for guided
+        const cancellation_token token;
+        atomic_int nextChunk { 0 };
+        atomic_int nextIndex;
+        atomic_int remaining; // iterations not finished yet
+        atomic_int refs { 1 };
+        atomic_bool skipped { false }; // chunks were dropped because of cancellation
+        mutex m;
+        exception_ptr error;
+
+        fork_join_group(thread_pool& pool, const action<int, int>& body, int rangeStart, int rangeEnd,
+                        parallel_schedule schedule, int numChunks, int grainSize, int numWorkers,
+                        const cancellation_token& token)
+            : pool{pool}, body{body}, rangeStart{rangeStart}, rangeEnd{rangeEnd}, schedule{schedule},
+              numChunks{numChunks}, grainSize{grainSize}, numWorkers{numWorkers}, token{token},
+              nextIndex{rangeStart}, remaining{rangeEnd - rangeStart}
+        {
+        }
+
+        void retain() noexcept { ++refs; }
+        void release() noexcept { if (--refs == 0) delete this; }
+
+        bool claim(int& start, int& end) noexcept
+        {
+            if (schedule == parallel_schedule::guided)
+            {
+                int first = nextIndex;
+                for (;;)
+                {
+                    const int left = rangeEnd - first;
+                    if (left <= 0)
+                        return false;
+                    int len = left / (2 * numWorkers);
+                    if (len < grainSize) len = grainSize;
+                    if (len > left)      len = left;
+                    if (nextIndex.compare_exchange_weak(first, first + len))
+                    {
+                        start = first;
+                        end   = first + len;
+                        return true;
+                    }
+                }
+            }
+
+            const int i = nextChunk++;
+            if (i >= numChunks)
+                return false;
+            // spread the remainder evenly between chunks
+            const int64 range = rangeEnd - rangeStart;
+            start = rangeStart + int(range * i / numChunks);
+            end   = rangeStart + int(range * (i + 1) / numChunks);
+            return true;
+        }
+
+        void run_chunks() noexcept
+        {
+            int start, end;
+            while (claim(start, end))
+            {
+                // cancelled chunks are still claimed, so the remaining count drains to 0
+                if (token.is_cancelled())
+                {
+                    skipped = true;
+                }
+                else try
+                {
+                    body(start, end);
+                }
+                catch (...)
+                {
+                    lock_guard<mutex> lock{m};
+                    if (!error) error = std::current_exception();
+                }
+                if ((remaining -= (end - start)) == 0)
+                {
+                    // the caller waits among the parked workers, so it can be woken for other jobs
+                    lock_guard<mutex> lock{pool.parkMutex};
+                    pool.parkCv.notify_all();
+                }
+            }
+        }
+
+        /**
+         * Runs other queued jobs of the pool until the chunks still running on
+         * other threads are finished, instead of blocking the calling thread
+         */
+        void help_until_done() noexcept
+        {
+            const int index = pool.current_worker_index();
+            pool_worker* self = index >= 0 ? pool.workers[index].get() : nullptr;
+            while (remaining != 0)
+            {
+                if (pool_job* job = pool.take_job(self))
+                {
+                    pool.run_job(job);
+                    continue;
+                }
+                unique_lock<mutex> lock{pool.parkMutex};
+                ++pool.parkedWorkers; // so new jobs wake us up as well
+                while (remaining != 0 && pool.pendingJobs <= 0)
+                    pool.parkCv.wait(lock);
+                --pool.parkedWorkers;
+            }
+        }
+    };
+
+    static int div_round_up(int count, int divisor)
+    {
+        return (count + divisor - 1) / divisor;
+    }
+
     void thread_pool::parallel_for(int rangeStart, int rangeEnd, 
-                                   const action<int, int>& rangeTask) noexcept
+                                   const action<int, int>& rangeTask,
+                                   parallel_schedule schedule, int grainSize)
+    {
+        parallel_for(rangeStart, rangeEnd, rangeTask, cancellation_token{}, schedule, grainSize);
+    }
+
+    void thread_pool::parallel_for(int rangeStart, int rangeEnd, 
+                                   const action<int, int>& rangeTask,
+                                   const cancellation_token& token,
+                                   parallel_schedule schedule, int grainSize)
     {
-        assert(!rangeRunning && "Fatal error: nested parallel loops are forbidden!");
         assert(coreCount > 0 && "There appears to be no hardware concurrency");
 
         const int range = rangeEnd - rangeStart;
         if (range <= 0)
             return;
 
-        const int cores = range < coreCount ? range : coreCount;
-        const int len = range / cores;
+        const int workers = max_workers();
+        int chunks;
+        switch (schedule)
+        {
+            default:
+            case parallel_schedule::equal_slices:
+                chunks = grainSize > 1 ? range / grainSize : range;
+                if (chunks > workers) chunks = workers;
+                break;
+            case parallel_schedule::dynamic:
+                if (grainSize <= 0) grainSize = range / (workers * 8);
+                if (grainSize < 1)  grainSize = 1;
+                chunks = div_round_up(range, grainSize);
+                break;
+            case parallel_schedule::guided:
+                if (grainSize <= 0) grainSize = range / (workers * 32);
+                if (grainSize < 1)  grainSize = 1;
+                chunks = 0; // decided while claiming
+                break;
+        }
+
+        const int participants = schedule == parallel_schedule::guided
+                               ? div_round_up(range, grainSize) : chunks;
 
-        // only one physical core or only one task to run. don't run in a thread
-        if (cores <= 1)
+        // only one physical core or only one chunk to run. don't run in a thread
+        if (participants <= 1 || workers <= 1)
         {
-            rangeTask(0, len);
+            token.throw_if_cancelled();
+            rangeTask(rangeStart, rangeEnd);
             return;
         }
 
-        auto active = (pool_task**)alloca(sizeof(pool_task*) * cores);
-        //vector<pool_task*> active(cores, nullptr);
+        auto* group = new fork_join_group{*this, rangeTask, rangeStart, rangeEnd,
+                                          schedule, chunks, grainSize, workers, token};
+        const int helpers = (participants < workers ? participants : workers) - 1;
+        for (int i = 0; i < helpers; ++i) // the calling thread is the first participant
         {
-            rangeRunning = true;
+            group->retain();
+            enqueue_job(new pool_job{ [group] {
+                group->run_chunks();
+                group->release();
+            }});
+        }
 
-            size_t poolIndex = 0;
-            for (int i = 0; i < cores; ++i)
-            {
-                const int start = i * len;
-                const int end   = i == cores - 1 ? rangeEnd : start + len;
-                active[i] = start_range_task(poolIndex, start, end, rangeTask);
-            }
+        group->run_chunks();
+        group->help_until_done();
+        exception_ptr error = group->error;
+        const bool cancelled = group->skipped;
+        group->release();
+        if (error) rethrow_exception(error);
+        if (cancelled) throw task_cancelled{};
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    numa_thread_pools::numa_thread_pools(const cpu_topology& topology)
+    {
+        cpuOffsets.push_back(0);
+        for (const numa_node& node : topology.nodes)
+        {
+            auto pool = std::make_unique<thread_pool>(pool_mode::work_stealing);
+            pool->set_worker_affinity(node.cpus);
+            pools.emplace_back(move(pool));
+            cpuOffsets.push_back(cpuOffsets.back() + (int)node.cpus.size());
+        }
+    }
+
+    numa_thread_pools::~numa_thread_pools() noexcept = default;
+
+    void numa_thread_pools::node_range(int index, int rangeStart, int rangeEnd, 
+                                       int& start, int& end) const noexcept
+    {
+        const int64 range = rangeEnd - rangeStart;
+        const int64 totalCpus = cpuOffsets.back();
+        start = rangeStart + int(range * cpuOffsets[index] / totalCpus);
+        end   = rangeStart + int(range * cpuOffsets[index + 1] / totalCpus);
+    }
+
+    void numa_thread_pools::parallel_for(int rangeStart, int rangeEnd,
+                                         const action<int, int>& rangeTask,
+                                         parallel_schedule schedule, int grainSize)
+    {
+        if (rangeEnd - rangeStart <= 0)
+            return;
+
+        mutex m;
+        condition_variable cv;
+        int pending = 0;
+        exception_ptr error;
+        auto run_slice = [&](thread_pool& pool, int start, int end) {
+            exception_ptr ex;
+            try { pool.parallel_for(start, end, rangeTask, schedule, grainSize); }
+            catch (...) { ex = std::current_exception(); }
+            lock_guard<mutex> lock{m};
+            if (ex && !error) error = ex;
+            if (--pending == 0) cv.notify_one();
+        };
+
+        // if we're already running on one of the node workers, that node's
+        // slice runs right here instead of blocking one of its workers
+        int local = -1;
+        for (int i = 0; i < node_count(); ++i)
+            if (pools[i]->current_worker_index() >= 0) local = i;
+
+        // count every slice before submitting any, so an early slice can't reach 0 pending
+        for (int i = 0; i < node_count(); ++i)
+        {
+            int start, end;
+            node_range(i, rangeStart, rangeEnd, start, end);
+            if (start != end) ++pending;
+        }
+        for (int i = 0; i < node_count(); ++i)
+        {
+            int start, end;
+            node_range(i, rangeStart, rangeEnd, start, end);
+            if (start == end || i == local)
+                continue;
+            // a full queue must not drop a slice, or we'd wait for it forever
+            thread_pool* pool = pools[i].get();
+            pool->parallel_task([&run_slice, pool, start, end] { run_slice(*pool, start, end); },
+                                overflow_policy::caller_runs);
+        }
+        if (local != -1)
+        {
+            int start, end;
+            node_range(local, rangeStart, rangeEnd, start, end);
+            if (start != end)
+                run_slice(*pools[local], start, end);
         }
 
-        for (int i = 0; i < cores; ++i)
-            active[i]->wait();
+        unique_lock<mutex> lock{m};
+        while (pending > 0)
+            cv.wait(lock);
+        if (error) rethrow_exception(error);
+    }
 
-        rangeRunning = false;
+    ///////////////////////////////////////////////////////////////////////////////
+
+    pool_task* thread_pool::parallel_task(task_delegate<void()>&& genericTask)
+    {
+        return parallel_task(move(genericTask), task_priority::normal);
     }
 
-    pool_task* thread_pool::parallel_task(task_delegate<void()>&& genericTask) noexcept
+    pool_task* thread_pool::parallel_task(task_delegate<void()>&& genericTask, 
+                                          task_priority priority, steady_time_t deadline)
     {
+        if (mode == pool_mode::work_stealing)
+        {
+            if (!submit_job(genericTask, priority, deadline, whenFull))
+                throw task_rejected{};
+            return nullptr;
+        }
+
         { lock_guard<mutex> lock{tasksMutex};
             for (unique_ptr<pool_task>& t : tasks)
             {
@@ -456,7 +1247,7 @@ namespace rpp
         }
         
         // create and run a new task atomically
-        auto t = std::make_unique<pool_task>();
+        auto t = std::make_unique<pool_task>(stats);
         auto* task = t.get();
         task->max_idle_time(taskMaxIdleTime);
         task->run_generic(move(genericTask));
@@ -465,4 +1256,425 @@ namespace rpp
         tasks.emplace_back(move(t));
         return task;
     }
+
+    pool_task* thread_pool::parallel_task(task_delegate<void()>&& genericTask,
+                                          cancellation_token token)
+    {
+        return parallel_task([task=move(genericTask), token=move(token)] {
+            if (!token.is_cancelled())
+                task();
+        });
+    }
+
+    pool_task* thread_pool::parallel_task(task_delegate<void()>&& genericTask,
+                                          overflow_policy policy)
+    {
+        if (mode != pool_mode::work_stealing)
+            return parallel_task(move(genericTask));
+        if (!submit_job(genericTask, task_priority::normal, {}, policy))
+            throw task_rejected{};
+        return nullptr;
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    struct thread_pool::timer_job
+    {
+        steady_time_t due;
+        std::chrono::steady_clock::duration period; // zero for one-shot timers
+        task_delegate<void()> task;
+        cancellation_token token;
+    };
+
+    // heap ordering for timers, the earliest due time ends up on top
+    template<class Job> static bool later_due(const Job* a, const Job* b) noexcept
+    {
+        return a->due > b->due;
+    }
+
+    cancellation_source thread_pool::schedule_timer(steady_time_t due,
+                                                    std::chrono::steady_clock::duration period,
+                                                    task_delegate<void()>&& task)
+    {
+        cancellation_source source;
+        add_timer(new timer_job{ due, period, move(task), source.token() });
+        return source;
+    }
+
+    int thread_pool::scheduled_tasks() noexcept
+    {
+        lock_guard<mutex> lock{timerMutex};
+        return (int)std::count_if(timers.begin(), timers.end(), [](const timer_job* job) {
+            return !job->token.is_cancelled();
+        });
+    }
+
+    // drops cancelled timers from the heap, otherwise timeouts which are nearly
+    // always cancelled would pile up until they come due. Compacting only once the heap
+    // has doubled since the last compaction keeps add_timer amortized O(log n)
+    void thread_pool::compact_timers() noexcept
+    {
+        auto cancelled = std::partition(timers.begin(), timers.end(), [](const timer_job* job) {
+            return !job->token.is_cancelled();
+        });
+        for (auto it = cancelled; it != timers.end(); ++it)
+            delete *it;
+        timers.erase(cancelled, timers.end());
+        std::make_heap(timers.begin(), timers.end(), later_due<timer_job>);
+        timersCompactAt = std::max<size_t>(64, timers.size() * 2);
+    }
+
+    void thread_pool::add_timer(timer_job* job) noexcept
+    {
+        { lock_guard<mutex> lock{timerMutex};
+            if (timerStopping) {
+                delete job;
+                return;
+            }
+            if (!timerThread.joinable())
+                timerThread = thread{[this] { run_timers(); }};
+            timers.push_back(job);
+            std::push_heap(timers.begin(), timers.end(), later_due<timer_job>);
+            if (timers.size() >= timersCompactAt)
+                compact_timers();
+            if (timers.empty() || timers.front() != job)
+                return; // the timer thread is already waiting for an earlier job
+        }
+        timerCv.notify_one();
+    }
+
+    void thread_pool::run_timers() noexcept
+    {
+        set_this_thread_name("rpp_timer");
+        unique_lock<mutex> lock{timerMutex};
+        while (!timerStopping)
+        {
+            if (timers.empty())
+            {
+                timerCv.wait(lock);
+                continue;
+            }
+
+            timer_job* job = timers.front();
+            const bool cancelled = job->token.is_cancelled();
+            if (!cancelled && std::chrono::steady_clock::now() < job->due)
+            {
+                timerCv.wait_until(lock, job->due);
+                continue;
+            }
+            std::pop_heap(timers.begin(), timers.end(), later_due<timer_job>);
+            timers.pop_back();
+            if (cancelled)
+            {
+                delete job;
+                continue;
+            }
+
+            lock.unlock();
+            if (job->period.count() == 0)
+            {
+                // timers must not be dropped by a full queue, at worst the timer thread runs them
+                parallel_task([task=move(job->task), token=move(job->token)] {
+                    if (!token.is_cancelled())
+                        task();
+                }, overflow_policy::caller_runs);
+                delete job;
+            }
+            else
+            {
+                // the job is re-armed only after it finishes, so runs never overlap
+                parallel_task([this, job]
+                {
+                    auto rearm = [this, job] {
+                        if (job->token.is_cancelled()) {
+                            delete job;
+                            return;
+                        }
+                        const steady_time_t now = std::chrono::steady_clock::now();
+                        job->due += job->period;
+                        if (job->due <= now) // skip the periods we missed
+                            job->due += ((now - job->due) / job->period + 1) * job->period;
+                        add_timer(job);
+                    };
+                    if (!job->token.is_cancelled())
+                    {
+                        try { job->task(); }
+                        catch (...) { rearm(); throw; }
+                    }
+                    rearm();
+                }, overflow_policy::caller_runs);
+            }
+            lock.lock();
+        }
+    }
+
+    void thread_pool::stop_timers() noexcept
+    {
+        { lock_guard<mutex> lock{timerMutex};
+            timerStopping = true;
+        }
+        timerCv.notify_one();
+        if (timerThread.joinable())
+            timerThread.join();
+        for (timer_job* job : timers)
+            delete job;
+        timers.clear();
+    }
+
+    ///////////////////////////////////////////////////////////////////////////////
+
+    // heap ordering for job_queue::earliest, the earliest deadline ends up on top
+    static bool later_deadline(const pool_job* a, const pool_job* b) noexcept
+    {
+        return a->deadline > b->deadline;
+    }
+
+    bool thread_pool::try_parallel_task(task_delegate<void()>&& genericTask, 
+                                        task_priority priority) noexcept
+    {
+        if (mode != pool_mode::work_stealing)
+        {
+            parallel_task(move(genericTask));
+            return true;
+        }
+        return submit_job(genericTask, priority, {}, overflow_policy::reject);
+    }
+
+    void thread_pool::set_queue_limit(int maxQueuedJobs, overflow_policy policy) noexcept
+    {
+        maxQueued = maxQueuedJobs;
+        whenFull = policy;
+        if (spaceWaiters > 0) // the limit may have been raised
+        {
+            lock_guard<mutex> lock{spaceMutex};
+            spaceCv.notify_all();
+        }
+    }
+
+    bool thread_pool::submit_job(task_delegate<void()>& task, task_priority priority,
+                                 steady_time_t deadline, overflow_policy policy) noexcept
+    {
+        const bool limited = maxQueued > 0;
+        bool queued = !limited || reserve_job_slot();
+        if (!queued)
+        {
+            if (policy == overflow_policy::reject)
+            {
+                ++rejectedJobs;
+                return false;
+            }
+            // a blocked worker can't free up any slots, so workers always run it inline
+            if (policy == overflow_policy::block && current_worker_index() == -1)
+            {
+                wait_for_job_slot();
+                queued = true;
+            }
+        }
+
+        auto* job = new pool_job{ move(task) };
+        if (auto tracer = TraceProvider)
+            job->trace = tracer();
+        job->priority = priority;
+        job->deadline = deadline;
+        if (queued) enqueue_job(job, /*reserved:*/limited);
+        else        run_job(job); // caller runs
+        return true;
+    }
+
+    bool thread_pool::reserve_job_slot() noexcept
+    {
+        const int limit = maxQueued;
+        int queued = pendingJobs;
+        do {
+            if (queued >= limit)
+                return false;
+        } while (!pendingJobs.compare_exchange_weak(queued, queued + 1));
+        return true;
+    }
+
+    void thread_pool::wait_for_job_slot() noexcept
+    {
+        // take_job checks spaceWaiters after decrementing pendingJobs, so either
+        // we see the free slot here, or the worker sees us waiting and notifies
+        unique_lock<mutex> lock{spaceMutex};
+        ++spaceWaiters;
+        while (!(maxQueued <= 0 ? (++pendingJobs, true) : reserve_job_slot()))
+            spaceCv.wait(lock);
+        --spaceWaiters;
+    }
+
+    void thread_pool::start_workers() noexcept
+    {
+        lock_guard<mutex> lock{workersMutex};
+        if (workersStarted)
+            return;
+        int count = max_workers();
+        if (count < 1) count = 1;
+
+        // all workers must exist before any of them starts stealing from its peers
+        stopping = false;
+        workers.clear();
+        workers.reserve(count);
+        for (int i = 0; i < count; ++i)
+            workers.emplace_back(std::make_unique<pool_worker>(*this, i));
+        for (auto& worker : workers)
+            worker->start();
+        workersStarted = true;
+    }
+
+    void thread_pool::stop_workers() noexcept
+    {
+        lock_guard<mutex> lock{workersMutex};
+        if (!workersStarted)
+            return;
+        { lock_guard<mutex> parkLock{parkMutex};
+            stopping = true;
+        }
+        parkCv.notify_all();
+        for (auto& worker : workers) // workers drain all queued jobs before exiting
+            worker->join();
+        workersStarted = false;
+        workers.clear();
+        stopping = false;
+    }
+
+    void thread_pool::enqueue_job(pool_job* job, bool reserved) noexcept
+    {
+        if (!workersStarted)
+            start_workers();
+
+        if (stats.load(std::memory_order_relaxed))
+            job->queuedAt = std::chrono::steady_clock::now();
+
+        // count it before publishing, so a woken worker never misses the job
+        if (!reserved)
+            ++pendingJobs;
+        ++queuedJobs[int(job->priority)];
+
+        // only plain normal priority jobs go to the local deque, everything else
+        // must be globally visible so it can be ordered by priority and deadline
+        pool_worker* self = CurrentWorker;
+        if (self && &self->pool == this && job->priority == task_priority::normal && !job->has_deadline())
+        {
+            self->jobs.push(job);
+        }
+        else
+        {
+            lock_guard<mutex> lock{injectMutex};
+            job_queue& q = injected[int(job->priority)];
+            if (job->has_deadline())
+            {
+                q.earliest.push_back(job);
+                std::push_heap(q.earliest.begin(), q.earliest.end(), later_deadline);
+            }
+            else
+            {
+                q.fifo.push_back(job);
+            }
+        }
+
+        if (parkedWorkers > 0)
+        {
+            lock_guard<mutex> lock{parkMutex};
+            parkCv.notify_one();
+        }
+    }
+
+    pool_job* thread_pool::pop_injected(task_priority priority) noexcept
+    {
+        lock_guard<mutex> lock{injectMutex};
+        job_queue& q = injected[int(priority)];
+        pool_job* job = nullptr;
+        if (!q.earliest.empty())
+        {
+            std::pop_heap(q.earliest.begin(), q.earliest.end(), later_deadline);
+            job = q.earliest.back();
+            q.earliest.pop_back();
+        }
+        else if (!q.fifo.empty())
+        {
+            job = q.fifo.front();
+            q.fifo.pop_front();
+        }
+        return job;
+    }
+
+    pool_job* thread_pool::take_job(pool_worker* self) noexcept
+    {
+        if (pendingJobs <= 0)
+            return nullptr;
+
+        // high -> own deque -> normal -> steal from peers -> background
+        pool_job* job = nullptr;
+        if (queuedJobs[int(task_priority::high)] > 0)
+            job = pop_injected(task_priority::high);
+        if (!job && self)
+            job = self->jobs.pop();
+        if (!job && queuedJobs[int(task_priority::normal)] > 0)
+            job = pop_injected(task_priority::normal);
+        if (!job)
+        {
+            int numWorkers = (int)workers.size();
+            int start = self ? self->next_victim(numWorkers) : 0;
+            for (int i = 0; i < numWorkers && !job; ++i)
+            {
+                pool_worker* victim = workers[(start + i) % numWorkers].get();
+                if (victim != self)
+                    job = victim->jobs.steal();
+            }
+        }
+        if (!job && queuedJobs[int(task_priority::background)] > 0)
+            job = pop_injected(task_priority::background);
+        if (job)
+        {
+            --queuedJobs[int(job->priority)];
+            --pendingJobs;
+            if (spaceWaiters > 0)
+            {
+                lock_guard<mutex> lock{spaceMutex};
+                spaceCv.notify_one();
+            }
+        }
+        return job;
+    }
+
+    bool thread_pool::park_worker() noexcept
+    {
+        unique_lock<mutex> lock{parkMutex};
+        ++parkedWorkers;
+        while (pendingJobs <= 0 && !stopping)
+            parkCv.wait(lock);
+        --parkedWorkers;
+        return pendingJobs > 0 || !stopping;
+    }
+
+    static void unhandled_job_exception(const pool_job* job, const char* what) noexcept
+    {
+        if (job->trace.empty()) UnhandledEx("%s", what);
+        else                    UnhandledEx("%s\nTask Start Trace:\n%s", what, job->trace.c_str());
+    }
+
+    void thread_pool::run_job(pool_job* job) noexcept
+    {
+        pool_stats* s = stats;
+        const steady_time_t started = s || job->has_deadline()
+                                    ? std::chrono::steady_clock::now() : steady_time_t{};
+        if (job->has_deadline() && started > job->deadline)
+            ++missedDeadlines;
+        try
+        {
+            job->task();
+        }
+        // prevent failures that would terminate the worker
+        catch (const exception& e) { unhandled_job_exception(job, e.what()); }
+        catch (const char* e)      { unhandled_job_exception(job, e);        }
+        catch (...)                { unhandled_job_exception(job, "");       }
+        if (s)
+        {
+            pool_worker* self = CurrentWorker;
+            s->record_task(job->queuedAt, started, std::chrono::steady_clock::now(),
+                           self && &self->pool == this ? self->index : -1);
+        }
+        delete job;
+    }
 }
@@ -7,12 +7,16 @@
 #  pragma warning(disable: 4251) // class 'std::*' needs to have dll-interface to be used by clients of struct 'rpp::*'
 #endif
 #include <vector>
+#include <deque>
 #include <thread>
 #include <string>
 #include <mutex>
 #include <atomic>
 #include <condition_variable>
+#include <memory> // shared_ptr
+#include <stdexcept> // runtime_error
 #include "delegate.h"
+#include "collections.h"
 
 namespace rpp
 {
@@ -21,6 +25,7 @@ namespace rpp
     using std::lock_guard;
     using std::unique_lock;
     using std::atomic_bool;
+    using std::atomic_int;
     using std::string;
     using std::thread;
     using std::vector;
@@ -34,6 +39,7 @@ namespace rpp
     using fseconds_t = std::chrono::duration<float>;
     using dseconds_t = std::chrono::duration<double>;
     using milliseconds_t = std::chrono::milliseconds;
+    using steady_time_t  = std::chrono::steady_clock::time_point;
     template<class T> using duration_t = std::chrono::duration<T>;
 
     //////////////////////////////////////////////////////////////////////////////////////////
@@ -89,13 +95,65 @@ namespace rpp
     //////////////////////////////////////////////////////////////////////////////////////////
 
     /**
-     * Simple semaphore for notifying and waiting on events
+     * Eventcount for lock-free wakeups. Waiters park on a futex (Linux) or WaitOnAddress (Windows),
+     * and notifiers only make a syscall if some thread is actually parked.
+     * The waiter must re-check its condition between prepare_wait() and wait():
+     * @code
+     * // waiter                            // notifier
+     * auto key = ev.prepare_wait();        ready = true;
+     * if (ready) ev.cancel_wait();         ev.notify_one();
+     * else       ev.wait(key);
+     * @endcode
      */
-    class semaphore
+    class RPPAPI event_count
     {
+        std::atomic<uint> epoch { 0 };
+        atomic_int waiters { 0 };
+    #if !__linux__ && !_WIN32
         mutex m;
         condition_variable cv;
-        int value = 0;
+    #endif
+
+    public:
+        using key = uint;
+
+        event_count() = default;
+        NOCOPY_NOMOVE(event_count)
+
+        // registers the calling thread as a waiter, must be followed by cancel_wait() or wait()
+        key prepare_wait() noexcept
+        {
+            ++waiters;
+            return epoch.load();
+        }
+
+        void cancel_wait() noexcept { --waiters; }
+
+        // lets notifiers skip notify_one() if nobody is waiting; safe because
+        // waiters register in prepare_wait() before re-checking their condition
+        bool has_waiters() const noexcept { return waiters.load() > 0; }
+
+        // parks until notified after prepare_wait() returned the key
+        void wait(key k) noexcept;
+
+        // @return false if the deadline was reached before a notification
+        bool wait_until(key k, steady_time_t deadline) noexcept;
+
+        void notify_one() noexcept;
+        void notify_all() noexcept;
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Counting semaphore for notifying and waiting on events. The count is a single atomic,
+     * so notify() and try_wait() never lock, and wait() only parks the thread on an
+     * rpp::event_count after a short spin didn't find a permit.
+     */
+    class RPPAPI semaphore
+    {
+        atomic_int value { 0 };
+        event_count parked;
 
     public:
         enum wait_result {
@@ -104,46 +162,55 @@ namespace rpp
         };
     
         semaphore() = default;
-        explicit semaphore(int initialCount)
-        {
-            reset(initialCount);
-        }
+        explicit semaphore(int initialCount) : value{ initialCount } {}
+        NOCOPY_NOMOVE(semaphore)
 
-        int count() const { return value; }
+        int count() const noexcept { return value.load(std::memory_order_relaxed); }
 
-        void reset(int newCount = 0)
+        void reset(int newCount = 0) noexcept
         {
             value = newCount;
             if (newCount > 0)
-                cv.notify_one();
+                parked.notify_all();
         }
 
-        void notify()
+        void notify() noexcept
         {
-            { lock_guard<mutex> lock{ m };
-                ++value;
+            ++value;
+            if (parked.has_waiters())
+                parked.notify_one();
+        }
+
+        bool notify_once() noexcept // only notify if count <= 0
+        {
+            int v = value.load();
+            while (v <= 0)
+            {
+                if (value.compare_exchange_weak(v, v + 1)) {
+                    if (parked.has_waiters())
+                        parked.notify_one();
+                    return true;
+                }
             }
-            cv.notify_one();
+            return false;
         }
 
-        bool notify_once() // only notify if count <= 0
+        // consumes one permit if the count is positive, never blocks
+        bool try_wait() noexcept
         {
-            bool shouldNotify;
-            { lock_guard<mutex> lock{ m };
-                shouldNotify = value <= 0;
-                if (shouldNotify)
-                    ++value;
+            int v = value.load();
+            while (v > 0)
+            {
+                if (value.compare_exchange_weak(v, v - 1))
+                    return true;
             }
-            if (shouldNotify) cv.notify_one();
-            return shouldNotify;
+            return false;
         }
 
-        void wait()
+        void wait() noexcept
         {
-            unique_lock<mutex> lock{ m };
-            while (value <= 0) // wait until value is actually set
-                cv.wait(lock);
-            --value; // consume the value
+            if (!try_wait())
+                wait_slow();
         }
 
         /**
@@ -155,15 +222,14 @@ namespace rpp
          * @endcode
          * @param taskIsRunning Reference to atomic flag to wait on
          */
-        void wait_barrier_while(atomic_bool& taskIsRunning)
+        void wait_barrier_while(atomic_bool& taskIsRunning) noexcept
         {
-            if (!taskIsRunning) {
-                taskIsRunning = true;
-                return;
-            }
-            unique_lock<mutex> lock{ m };
             while (taskIsRunning)
-                cv.wait(lock);
+            {
+                event_count::key key = parked.prepare_wait();
+                if (!taskIsRunning) parked.cancel_wait();
+                else                parked.wait(key);
+            }
             taskIsRunning = true;
         }
         
@@ -176,15 +242,14 @@ namespace rpp
          * @endcode
          * @param hasFinished Reference to atomic flag to wait on
          */
-        void wait_barrier_until(atomic_bool& hasFinished)
+        void wait_barrier_until(atomic_bool& hasFinished) noexcept
         {
-            if (hasFinished) {
-                hasFinished = false;
-                return;
-            }
-            unique_lock<mutex> lock{ m };
             while (!hasFinished)
-                cv.wait(lock);
+            {
+                event_count::key key = parked.prepare_wait();
+                if (hasFinished) parked.cancel_wait();
+                else             parked.wait(key);
+            }
             hasFinished = false;
         }
         
@@ -193,33 +258,231 @@ namespace rpp
          * @return signalled if wait was successful or timeout if timeoutSeconds had elapsed
          */
         template<class Rep, class Period>
-        wait_result wait(std::chrono::duration<Rep, Period> timeout)
+        wait_result wait(std::chrono::duration<Rep, Period> timeout) noexcept
         {
-            unique_lock<mutex> lock{ m };
-            while (value <= 0)
-            {
-                if (cv.wait_for(lock, timeout) == cv_status::timeout)
-                    return semaphore::timeout;
-            }
-            --value;
-            return notified;
+            if (try_wait())
+                return notified;
+            return wait_until(std::chrono::steady_clock::now() 
+                + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
         }
 
-        bool try_wait()
+        wait_result wait_until(steady_time_t deadline) noexcept;
+
+    private:
+        bool spin_wait() noexcept;
+        void wait_slow() noexcept;
+    };
+
+    //////////////////////////////////////////////////////////////////////////////////////////
+
+    /**
+     * Blocking wrapper over a lock-free rpp::mpmc_ring or rpp::spsc_ring. Free slots and
+     * queued items are counted with two semaphores, so push() blocks while the ring is full
+     * and pop() blocks while it's empty. The try_ variants never block.
+     * @code
+     * rpp::blocking_ring<rpp::mpmc_ring<Job>> jobs { 256 };
+     * producer:  jobs.push(move(job));
+     * consumer:  Job job = jobs.pop();
+     * @endcode
+     */
+    template<class Ring> class blocking_ring
+    {
+    public:
+        using value_type = typename Ring::value_type;
+
+    private:
+        Ring ring;
+        semaphore items;
+        semaphore slots;
+
+        // a permit guarantees a free slot or a queued item, but with several producers the
+        // cell at our position can still be in the middle of another thread's push or pop
+        void push_permitted(value_type&& item)
         {
-            unique_lock<mutex> lock{ m };
-            if (value > 0) {
-                --value;
-                return true;
-            }
-            return false;
+            while (!ring.try_push(std::move(item)))
+                std::this_thread::yield();
+            items.notify();
+        }
+        value_type pop_permitted()
+        {
+            value_type item;
+            while (!ring.try_pop(item))
+                std::this_thread::yield();
+            slots.notify();
+            return item;
+        }
+
+    public:
+        explicit blocking_ring(size_t capacity) : ring{capacity}, slots{int(ring.capacity())} {}
+        NOCOPY_NOMOVE(blocking_ring)
+
+        size_t capacity() const noexcept { return ring.capacity(); }
+        int size() const { return items.count(); }
+
+        // blocks while the ring is full
+        void push(value_type item)
+        {
+            slots.wait();
+            push_permitted(std::move(item));
+        }
+
+        // @return FALSE if the ring is full
+        bool try_push(value_type item)
+        {
+            if (!slots.try_wait()) return false;
+            push_permitted(std::move(item));
+            return true;
+        }
+
+        // blocks while the ring is empty
+        value_type pop()
+        {
+            items.wait();
+            return pop_permitted();
+        }
+
+        // @return FALSE if the ring is empty
+        bool try_pop(value_type& out)
+        {
+            if (!items.try_wait()) return false;
+            out = pop_permitted();
+            return true;
+        }
+
+        /**
+         * @param timeout Maximum time to wait for an item
+         * @return FALSE if no item arrived before the timeout
+         */
+        template<class Rep, class Period>
+        bool pop(value_type& out, std::chrono::duration<Rep, Period> timeout)
+        {
+            if (items.wait(timeout) == semaphore::timeout) return false;
+            out = pop_permitted();
+            return true;
         }
     };
 
+    template<class T> using blocking_mpmc_ring = blocking_ring<mpmc_ring<T>>;
+    template<class T> using blocking_spsc_ring = blocking_ring<spsc_ring<T>>;
+
     //////////////////////////////////////////////////////////////////////////////////////////
 
 
-    template<class Signature> using task_delegate = rpp::delegate<Signature>;
+    /**
+     * Tasks are move-only, so they can capture std::unique_ptr or sockets directly.
+     * rpp::delegate converts into it implicitly, moving one in never allocates.
+     * @note rpp::function_ref is rejected by parallel_task and the timers,
+     *       because a borrowed callable would dangle once the caller returns
+     */
+    template<class Signature> using task_delegate = rpp::unique_delegate<Signature>;
+
+
+    /**
+     * Chase-Lev work-stealing deque of non-owning item pointers.
+     * The owner thread pushes and pops at the bottom (LIFO), while any other thread
+     * can steal from the top (FIFO). Push and pop must only be called by the owner.
+     *
+     * @note The ring buffer grows on demand. Retired buffers are kept alive until the
+     *       deque is destroyed, because a concurrent thief might still be reading them.
+     */
+    template<class T> class work_stealing_deque
+    {
+        struct ring
+        {
+            int64 mask;
+            std::atomic<T*>* items;
+            explicit ring(int64 capacity) : mask{capacity - 1}, items{new std::atomic<T*>[capacity]} {}
+            ~ring() noexcept { delete[] items; }
+            int64 capacity() const noexcept { return mask + 1; }
+            T* get(int64 i) const noexcept { return items[i & mask].load(std::memory_order_relaxed); }
+            void put(int64 i, T* item) noexcept { items[i & mask].store(item, std::memory_order_relaxed); }
+        };
+
+        alignas(64) std::atomic<int64> top { 0 };
+        alignas(64) std::atomic<int64> bottom { 0 };
+        std::atomic<ring*> array;
+        vector<unique_ptr<ring>> retired; // only accessed by the owner
+
+    public:
+        // @param initialCapacity Must be a power of 2
+        explicit work_stealing_deque(int initialCapacity = 256) : array{ new ring{initialCapacity} }
+        {
+        }
+        ~work_stealing_deque() noexcept
+        {
+            delete array.load(std::memory_order_relaxed);
+        }
+        NOCOPY_NOMOVE(work_stealing_deque)
+
+        // approximate number of items, can be stale if thieves are active
+        int size() const noexcept
+        {
+            int64 b = bottom.load(std::memory_order_relaxed);
+            int64 t = top.load(std::memory_order_relaxed);
+            return b > t ? int(b - t) : 0;
+        }
+        bool empty() const noexcept { return size() == 0; }
+
+        // Owner only: pushes a new item to the bottom of the deque
+        void push(T* item) noexcept
+        {
+            int64 b = bottom.load(std::memory_order_relaxed);
+            int64 t = top.load(std::memory_order_acquire);
+            ring* a = array.load(std::memory_order_relaxed);
+            if (b - t > a->mask) // full, double the capacity
+            {
+                auto* bigger = new ring{a->capacity() * 2};
+                for (int64 i = t; i < b; ++i)
+                    bigger->put(i, a->get(i));
+                retired.emplace_back(a);
+                array.store(bigger, std::memory_order_release);
+                a = bigger;
+            }
+            a->put(b, item);
+            // release store instead of a standalone fence, which ThreadSanitizer can't follow
+            bottom.store(b + 1, std::memory_order_release);
+        }
+
+        // Owner only: pops the most recently pushed item, or nullptr if empty
+        T* pop() noexcept
+        {
+            int64 b = bottom.load(std::memory_order_relaxed) - 1;
+            ring* a = array.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64 t = top.load(std::memory_order_relaxed);
+            if (t > b) // deque was empty
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            T* item = a->get(b);
+            if (t == b) // last item, race against thieves
+            {
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                           std::memory_order_relaxed))
+                    item = nullptr;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        // Any thread: steals the oldest item, or nullptr if empty or if we lost a race
+        T* steal() noexcept
+        {
+            int64 t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64 b = bottom.load(std::memory_order_acquire);
+            if (t >= b)
+                return nullptr;
+            ring* a = array.load(std::memory_order_acquire);
+            T* item = a->get(t);
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                       std::memory_order_relaxed))
+                return nullptr;
+            return item;
+        }
+    };
 
 
     /**
@@ -237,6 +500,123 @@ namespace rpp
 
     RPPAPI void set_this_thread_name(const char* name);
 
+    /**
+     * Pins the calling thread to the given set of logical CPUs
+     * @return false if thread affinity is not supported on this platform or the call failed
+     */
+    RPPAPI bool set_this_thread_affinity(const vector<int>& cpus);
+
+
+    /**
+     * A single NUMA node and the online logical CPUs which belong to it
+     */
+    struct numa_node
+    {
+        int id = 0;
+        vector<int> cpus;
+    };
+
+    /**
+     * Logical CPU and NUMA node layout of this machine.
+     * On Linux this is read from /sys/devices/system/node and /sys/devices/system/cpu,
+     * other platforms report a single node with all hardware threads.
+     */
+    struct RPPAPI cpu_topology
+    {
+        vector<numa_node> nodes; // only nodes which have CPUs, ordered by node id
+        int num_cpus = 0; // total number of online logical CPUs
+
+        // queries the topology once and caches it
+        static const cpu_topology& get();
+    };
+
+    /**
+     * Log2-bucketed histogram of durations. Bucket i counts durations in [2^i, 2^(i+1)) nanoseconds,
+     * bucket 0 also counts zero durations. Recording is only a few relaxed atomic increments,
+     * so it can be updated from any number of threads and read at any time without locking.
+     */
+    class RPPAPI duration_histogram
+    {
+    public:
+        static constexpr int num_buckets = 40; // the last bucket covers everything above ~4.5 minutes
+
+        struct snapshot
+        {
+            uint64 buckets[num_buckets] = {};
+            uint64 count = 0;
+            uint64 total_ns = 0;
+            uint64 max_ns = 0;
+
+            double mean_ns() const noexcept { return count ? double(total_ns) / count : 0.0; }
+
+            // @return Upper bound of the bucket which contains the given percentile [0.0 - 1.0]
+            uint64 percentile_ns(double percentile) const noexcept;
+        };
+
+        void record(uint64 nanos) noexcept;
+
+        // reads all buckets with relaxed loads, concurrent records may be partially visible
+        snapshot get() const noexcept;
+
+    private:
+        std::atomic<uint64> buckets[num_buckets] {};
+        std::atomic<uint64> count { 0 };
+        std::atomic<uint64> totalNanos { 0 };
+        std::atomic<uint64> maxNanos { 0 };
+    };
+
+
+    /**
+     * A point-in-time copy of thread pool statistics
+     */
+    struct pool_stats_snapshot
+    {
+        duration_histogram::snapshot queue_latency; // from submission until the task starts running
+        duration_histogram::snapshot run_time;      // task execution time
+        uint64 threads_spawned = 0; // pool_task threads started, including restarts after idling out
+        uint64 threads_retired = 0; // pool_task threads which exited after max_task_idle_time
+        double uptime = 0.0;        // seconds since stats were enabled
+        vector<double> worker_busy; // busy seconds of every work-stealing worker
+
+        // @return Fraction of uptime the given work-stealing worker spent running jobs
+        double worker_busy_ratio(int worker) const noexcept
+        {
+            return uptime > 0.0 ? worker_busy[worker] / uptime : 0.0;
+        }
+    };
+
+
+    /**
+     * Opt-in statistics of a thread_pool and its pool_tasks. All counters are atomics,
+     * so recording never takes a lock and snapshots can be scraped from any thread.
+     * @see thread_pool::enable_stats()
+     */
+    class RPPAPI pool_stats
+    {
+    public:
+        static constexpr int max_tracked_workers = 256;
+
+        duration_histogram queue_latency;
+        duration_histogram run_time;
+        std::atomic<uint64> threads_spawned { 0 };
+        std::atomic<uint64> threads_retired { 0 };
+
+        pool_stats() noexcept;
+        NOCOPY_NOMOVE(pool_stats)
+
+        // records a single finished task, worker is -1 for pool_tasks
+        void record_task(steady_time_t queued, steady_time_t started, steady_time_t finished,
+                         int worker) noexcept;
+
+        pool_stats_snapshot get(int numWorkers) const;
+
+    private:
+        steady_time_t enabled;
+        struct alignas(64) busy_counter { std::atomic<uint64> nanos { 0 }; };
+        busy_counter workerBusy[max_tracked_workers];
+    };
+
+
     /**
      * A simple thread-pool task. Can run owning generic tasks using standard function<> and
      * also range non-owning tasks which use the impossibly fast delegate callback system.
@@ -253,6 +633,12 @@ namespace rpp
         float maxIdleTime = 15;
         string trace;
         exception_ptr error;
+        steady_time_t queuedAt {}; // only set if stats are enabled
+        std::atomic<pool_stats*> stats { nullptr };
+        // new tasks are handed off through a spin-then-park eventcount instead of the cv
+        event_count taskReady;
+        std::atomic_bool signaled { false }; // a new task was assigned or this task was killed
+        int spinLimit = 1024; // adapted to how quickly tasks usually arrive
         volatile bool taskRunning = false; // an active task is being executed
         volatile bool killed      = false; // this pool_task is being destroyed/has been destroyed
 
@@ -265,10 +651,14 @@ namespace rpp
         bool running()  const noexcept { return taskRunning; }
         const char* start_trace() const noexcept { return trace.empty() ? nullptr : trace.c_str(); }
 
-        pool_task();
+        // @param stats [optional] Records queue latency, run time and thread lifetime into these stats
+        explicit pool_task(pool_stats* stats = nullptr);
         ~pool_task() noexcept;
         NOCOPY_NOMOVE(pool_task)
 
+        // enables or disables (nullptr) stats recording for this task
+        void set_stats(pool_stats* newStats) noexcept { stats = newStats; }
+
         // Sets the maximum idle time before this pool task is abandoned to free up thread handles
         // @param maxIdleSeconds Maximum number of seconds to remain idle. If set to 0, the pool task is kept alive forever
         void max_idle_time(float maxIdleSeconds = 15);
@@ -296,20 +686,215 @@ namespace rpp
         void unhandled_exception(const char* what) noexcept;
         void run() noexcept;
         bool got_task() const noexcept;
+        bool spin_for_task() noexcept;
         bool wait_for_task(unique_lock<mutex>& lock) noexcept;
         wait_result join_or_detach(wait_result result = finished) noexcept;
     };
 
 
+    class thread_pool;
+
+
+    /**
+     * Priority classes for tasks queued on the work-stealing scheduler.
+     * Higher priority jobs are always dequeued first, but running jobs are never preempted.
+     */
+    enum class task_priority
+    {
+        high,       // latency sensitive work, taken before any other queued work
+        normal,     // default priority
+        background, // only runs when there is no high or normal priority work queued
+    };
+
+    static constexpr int num_task_priorities = 3;
+
+
+    /**
+     * Thrown by tasks which were cancelled through a cancellation_token, and set
+     * as the exception of futures whose tasks were cancelled before they could run
+     */
+    struct task_cancelled : std::runtime_error
+    {
+        task_cancelled() : std::runtime_error{"task cancelled"} {}
+    };
+
+    /**
+     * Thrown by parallel_task when the work-stealing queue is full and
+     * the pool's overflow_policy is reject. The task was not run.
+     * @see thread_pool::set_queue_limit()
+     */
+    struct task_rejected : std::runtime_error
+    {
+        task_rejected() : std::runtime_error{"task rejected: thread_pool queue is full"} {}
+    };
+
+    /**
+     * Cooperative cancellation flag, shared between a cancellation_source
+     * and any number of tokens. A default constructed token is never cancelled.
+     */
+    class cancellation_token
+    {
+        std::shared_ptr<std::atomic_bool> cancelled;
+
+        friend class cancellation_source;
+        explicit cancellation_token(std::shared_ptr<std::atomic_bool> state) noexcept
+            : cancelled{move(state)} {}
+    public:
+        cancellation_token() noexcept = default;
+
+        bool can_be_cancelled() const noexcept { return (bool)cancelled; }
+
+        bool is_cancelled() const noexcept
+        {
+            return cancelled && cancelled->load(std::memory_order_acquire);
+        }
+
+        // long running tasks can call this to bail out early
+        void throw_if_cancelled() const
+        {
+            if (is_cancelled()) throw task_cancelled{};
+        }
+    };
+
+    /**
+     * Issues cancellation tokens and cancels all of them at once.
+     * Cancellation is cooperative: queued tasks are skipped, parallel_for stops
+     * claiming new chunks, and running tasks stop only if they check their token.
+     * @code
+     * rpp::cancellation_source abandoned;
+     * auto result = rpp::async_task([=] { return render(page); }, abandoned.token());
+     * ...
+     * abandoned.cancel(); // client disconnected, result.get() throws rpp::task_cancelled
+     * @endcode
+     */
+    class cancellation_source
+    {
+        std::shared_ptr<std::atomic_bool> cancelled = std::make_shared<std::atomic_bool>(false);
+    public:
+        cancellation_token token() const noexcept { return cancellation_token{ cancelled }; }
+
+        void cancel() noexcept { cancelled->store(true, std::memory_order_release); }
+
+        bool is_cancelled() const noexcept { return cancelled->load(std::memory_order_acquire); }
+    };
+
+
+    /**
+     * A single unit of work queued on the work-stealing scheduler
+     */
+    struct pool_job
+    {
+        task_delegate<void()> task;
+        string trace; // only set if a task tracer is enabled
+        task_priority priority = task_priority::normal;
+        steady_time_t deadline {}; // jobs with earlier deadlines are dequeued first
+        steady_time_t queuedAt {}; // only set if stats are enabled
+
+        bool has_deadline() const noexcept { return deadline.time_since_epoch().count() != 0; }
+    };
+
+
+    /**
+     * Scheduling modes for the thread pool
+     */
+    enum class pool_mode
+    {
+        /**
+         * Default mode: every parallel_task is bound to an idle pool_task,
+         * or a brand new pool_task thread is spawned for it.
+         */
+        spawn_on_demand,
+
+        /**
+         * A fixed set of workers with per-worker Chase-Lev deques and a global injection queue.
+         * parallel_task becomes an O(1) enqueue and idle workers steal from their peers.
+         * @note In this mode parallel_task does not return a pool_task handle,
+         *       use rpp::async_task if you need to wait for the result.
+         */
+        work_stealing,
+    };
+
+
+    /**
+     * What parallel_task does when a work-stealing pool already has its queue limit of jobs waiting
+     * @see thread_pool::set_queue_limit()
+     */
+    enum class overflow_policy
+    {
+        block,       // wait until a worker frees up a queue slot
+        reject,      // refuse the task: parallel_task throws rpp::task_rejected, try_parallel_task returns false
+        caller_runs, // run the task inline on the submitting thread
+    };
+
+
+    /**
+     * Chunk scheduling strategies for parallel_for
+     */
+    enum class parallel_schedule
+    {
+        /**
+         * Default: the range is split into max_workers() equal slices.
+         * Lowest overhead for uniform workloads. If grainSize is given,
+         * fewer slices are used so that every slice has at least grainSize iterations.
+         */
+        equal_slices,
+
+        /**
+         * Fixed-size chunks of grainSize iterations are claimed through an atomic counter,
+         * so fast threads simply claim more chunks. Absorbs load imbalance.
+         * Default grainSize is range / (max_workers() * 8)
+         */
+        dynamic,
+
+        /**
+         * Chunks start large (remaining / (2 * max_workers())) and shrink towards grainSize
+         * as the range drains. Fewer claims than dynamic, while still balancing the tail.
+         * Default grainSize is range / (max_workers() * 32)
+         */
+        guided,
+    };
+
+
+    /**
+     * A fixed worker thread of the work-stealing scheduler. Jobs submitted from
+     * this worker go to its local deque, where idle peers can steal them.
+     */
+    class RPPAPI pool_worker
+    {
+        thread_pool& pool;
+        thread th;
+        work_stealing_deque<pool_job> jobs;
+        unsigned int seed; // for random victim selection
+        const int index;
+        atomic_bool busy { false };
+
+    public:
+        pool_worker(thread_pool& pool, int index);
+        ~pool_worker() noexcept;
+        NOCOPY_NOMOVE(pool_worker)
+
+        bool running() const noexcept { return busy; }
+        int id() const noexcept { return index; }
+
+        // number of jobs waiting in this worker's local deque
+        int queued_jobs() const noexcept { return jobs.size(); }
+
+    private:
+        friend class thread_pool;
+        void start();
+        void join() noexcept;
+        void run() noexcept;
+        int next_victim(int numWorkers) noexcept;
+    };
+
+
     /**
      * A generic thread pool that can be used to group and control pool lifetimes
      * By default a global thread_pool is also available
      *
-     * By design, nesting parallel for loops is detected as a fatal error, because
-     * creating nested threads will not bring any performance benefits
-     *
-     * Accidentally running nested parallel_for can end up in 8*8=64 threads on an 8-core CPU,
-     * which is why it's considered an error.
+     * Parallel for loops always run as fork-join on the fixed set of pool workers,
+     * so nested or concurrent parallel_for calls never spawn any extra threads.
+     * Running nested parallel_for on an 8-core CPU still uses only 8 workers.
      */
     class RPPAPI thread_pool
     {
@@ -317,7 +902,48 @@ namespace rpp
         vector<unique_ptr<pool_task>> tasks;
         float taskMaxIdleTime = 15; // new task timeout in seconds
         int coreCount = 0;
-        atomic_bool rangeRunning { false }; // whether parallel range is running or not
+
+        // work-stealing scheduler state, workers are started lazily.
+        // The settings are atomic, since submitting threads read them while they are changed
+        std::atomic<pool_mode> mode { pool_mode::spawn_on_demand };
+        atomic_int maxWorkers { 0 };
+        vector<int> workerCpus; // if not empty, worker i is pinned to workerCpus[i % size]
+        mutex workersMutex;
+        vector<unique_ptr<pool_worker>> workers;
+        atomic_bool workersStarted { false };
+        // jobs submitted from non-worker threads or with a non-normal priority
+        struct job_queue
+        {
+            std::deque<pool_job*> fifo; // jobs without a deadline
+            vector<pool_job*> earliest; // min-heap of jobs ordered by deadline
+        };
+        mutex injectMutex;
+        job_queue injected[num_task_priorities];
+        atomic_int queuedJobs[num_task_priorities] { {0}, {0}, {0} };
+        atomic_int missedDeadlines { 0 };
+        mutex parkMutex;
+        condition_variable parkCv;
+        atomic_int parkedWorkers { 0 };
+        atomic_int pendingJobs { 0 }; // jobs waiting in any of the queues
+        atomic_bool stopping { false };
+        // submission backpressure, only enforced if maxQueued > 0
+        atomic_int maxQueued { 0 };
+        std::atomic<overflow_policy> whenFull { overflow_policy::block };
+        mutex spaceMutex;
+        condition_variable spaceCv;
+        atomic_int spaceWaiters { 0 };
+        atomic_int rejectedJobs { 0 };
+        // opt-in stats, never freed before the pool so readers don't need a lock
+        std::atomic<pool_stats*> stats { nullptr };     // set while recording is enabled
+        std::atomic<pool_stats*> statsData { nullptr }; // owned, allocated on first enable
+        // delayed and periodic tasks, the timer thread is started lazily
+        struct timer_job;
+        mutex timerMutex;
+        condition_variable timerCv;
+        vector<timer_job*> timers; // min-heap ordered by due time
+        size_t timersCompactAt = 64; // cancelled timers are dropped once the heap grows this big
+        thread timerThread;
+        bool timerStopping = false;
 
     public:
 
@@ -325,9 +951,90 @@ namespace rpp
         static thread_pool& global();
 
         thread_pool();
+
+        /**
+         * @param mode Scheduling mode to use for parallel tasks
+         * @param numWorkers Number of work-stealing workers. If 0, physical_cores() is used
+         */
+        explicit thread_pool(pool_mode mode, int numWorkers = 0);
         ~thread_pool() noexcept;
         NOCOPY_NOMOVE(thread_pool)
 
+        /**
+         * Changes the scheduling mode. Switching away from work_stealing
+         * waits until all queued jobs have finished and stops the workers.
+         * @param numWorkers Number of work-stealing workers. If 0, physical_cores() is used
+         */
+        void set_mode(pool_mode newMode, int numWorkers = 0) noexcept;
+        pool_mode get_mode() const noexcept { return mode; }
+
+        // number of work-stealing workers that have been started
+        int worker_count() const noexcept { return (int)workers.size(); }
+
+        // number of jobs waiting in the work-stealing queues
+        int queued_jobs() const noexcept { return pendingJobs; }
+
+        // number of jobs of the given priority waiting in the work-stealing queues
+        int queued_jobs(task_priority priority) const noexcept { return queuedJobs[int(priority)]; }
+
+        // number of jobs which started only after their deadline had already passed
+        int missed_deadlines() const noexcept { return missedDeadlines; }
+
+        /**
+         * Bounds the number of jobs waiting in the work-stealing queues, so a submission
+         * burst can't grow memory without limit. Together with the fixed worker count
+         * this caps both threads and queued work under overload.
+         * @note Only applies in work_stealing mode. parallel_for helper jobs are never limited,
+         *       and pool workers never block on a full queue, they run the task inline instead
+         * @param maxQueuedJobs Maximum number of queued jobs, 0 for unbounded (default)
+         * @param whenFull What parallel_task does when the queue is full. Library submissions
+         *                 (futures, timers, coroutines, numa slices) are never dropped,
+         *                 they run on the submitting thread instead
+         */
+        void set_queue_limit(int maxQueuedJobs, overflow_policy whenFull = overflow_policy::block) noexcept;
+        int queue_limit() const noexcept { return maxQueued; }
+
+        // number of tasks refused because the queue was full
+        int rejected_jobs() const noexcept { return rejectedJobs; }
+
+        // maximum number of work-stealing workers this pool will start
+        int max_workers() const noexcept
+        {
+            if (int workers = maxWorkers; workers > 0) return workers;
+            return workerCpus.empty() ? coreCount : (int)workerCpus.size();
+        }
+
+        /**
+         * Pins the work-stealing workers to logical CPUs: worker i runs on cpus[i % cpus.size()].
+         * If the pool was created with numWorkers 0, it starts one worker per listed CPU.
+         * Running workers are stopped first and restarted lazily with the new affinity.
+         * @param cpus Logical CPU indices, an empty list lets the workers float freely
+         */
+        void set_worker_affinity(vector<int> cpus) noexcept;
+        const vector<int>& worker_affinity() const noexcept { return workerCpus; }
+
+        // @return Index of the calling thread if it's a worker of this pool, otherwise -1
+        int current_worker_index() const noexcept;
+
+        /**
+         * Enables recording of queue latency and run time histograms, pool_task
+         * spawn/retire counts and per-worker busy time. Disabled by default,
+         * since recording needs two clock reads per task.
+         * Re-enabling keeps accumulating into the previous stats.
+         */
+        void enable_stats(bool enable = true) noexcept;
+        bool stats_enabled() const noexcept { return stats != nullptr; }
+
+        /**
+         * Lock-free snapshot of the pool stats, safe to call from any thread at any rate.
+         * @code
+         * auto s = pool.stats_snapshot();
+         * LogInfo("p99 queue latency: %lluns", s.queue_latency.percentile_ns(0.99));
+         * @endcode
+         * @return Empty snapshot if stats were never enabled
+         */
+        pool_stats_snapshot stats_snapshot() const;
+
         // number of thread pool tasks that are currently running
         int active_tasks() noexcept;
 
@@ -352,26 +1059,163 @@ namespace rpp
         void max_task_idle_time(float maxIdleSeconds = 15) noexcept;
 
         /**
-         * Runs a new Parallel For range task. Only ONE parallel for can be running, any kind of
-         * parallel nesting is forbidden. This prevents quadratic thread explosion.
+         * Runs a new fork-join Parallel For range task. The range is split into chunks
+         * which are claimed by the calling thread and by stealable helper jobs on the
+         * pool workers. Nested and concurrent parallel_for calls share the same workers.
          *
-         * This function will block until all parallel tasks have finished running
+         * This function will block until all chunks have finished running,
+         * but the calling thread executes chunks itself while it waits. Once every chunk
+         * is claimed, it runs other queued jobs of this pool until the last chunk finishes.
          *
+         * @warning Since the caller can run unrelated queued jobs, don't hold a lock
+         *          during parallel_for which those jobs might need
+         * @note The first exception thrown by rangeTask is rethrown after all chunks finish
          * @param rangeStart Usually 0
          * @param rangeEnd Usually vec.size()
          * @param rangeTask Non-owning callback action.
+         * @param schedule How the range is split into chunks
+         * @param grainSize Minimum number of iterations per chunk. If 0, a default is chosen
          */
-        void parallel_for(int rangeStart, int rangeEnd, const action<int, int>& rangeTask) noexcept;
+        void parallel_for(int rangeStart, int rangeEnd, const action<int, int>& rangeTask,
+                          parallel_schedule schedule = parallel_schedule::equal_slices,
+                          int grainSize = 0);
 
         template<class Func> 
-        void parallel_for(int rangeStart, int rangeEnd, const Func& func) noexcept
+        void parallel_for(int rangeStart, int rangeEnd, const Func& func,
+                          parallel_schedule schedule = parallel_schedule::equal_slices,
+                          int grainSize = 0)
         {
             parallel_for(rangeStart, rangeEnd, 
-                action<int, int>::from_function<Func, &Func::operator()>(&func));
+                action<int, int>::from_function<Func, &Func::operator()>(&func),
+                schedule, grainSize);
         }
 
-        // runs a generic parallel task
-        pool_task* parallel_task(task_delegate<void()>&& genericTask) noexcept;
+        /**
+         * Cancellable fork-join Parallel For. The token is checked before every chunk,
+         * so after cancellation only the chunks which are already running will finish.
+         * @throws task_cancelled if any chunks were skipped because of cancellation
+         */
+        void parallel_for(int rangeStart, int rangeEnd, const action<int, int>& rangeTask,
+                          const cancellation_token& token,
+                          parallel_schedule schedule = parallel_schedule::equal_slices,
+                          int grainSize = 0);
+
+        template<class Func> 
+        void parallel_for(int rangeStart, int rangeEnd, const Func& func,
+                          const cancellation_token& token,
+                          parallel_schedule schedule = parallel_schedule::equal_slices,
+                          int grainSize = 0)
+        {
+            parallel_for(rangeStart, rangeEnd, 
+                action<int, int>::from_function<Func, &Func::operator()>(&func),
+                token, schedule, grainSize);
+        }
+
+        /**
+         * Runs a generic parallel task
+         * @warning In work_stealing mode jobs are not bound to any pool_task, so this returns
+         *          nullptr. Code which can run on such a pool must not call `->wait()` on the
+         *          result: signal completion from the task instead, or use rpp::async_task.
+         * @return pool_task handle which can be waited on, or nullptr in work_stealing mode
+         * @throws task_rejected if the queue is full and the overflow policy is reject
+         */
+        pool_task* parallel_task(task_delegate<void()>&& genericTask);
+
+        /**
+         * Runs a generic parallel task with a priority class and an optional deadline.
+         * Queued high priority jobs are taken before any normal or background jobs,
+         * and within a priority class jobs with the earliest deadline are taken first.
+         * @note Priorities only apply in work_stealing mode, in spawn_on_demand mode
+         *       every task starts immediately on its own thread anyway
+         * @code
+         * pool.parallel_task([=] { handle_request(req); }, rpp::task_priority::high,
+         *                    std::chrono::steady_clock::now() + 50ms);
+         * @endcode
+         * @return pool_task handle which can be waited on, or nullptr in work_stealing mode
+         * @throws task_rejected if the queue is full and the overflow policy is reject
+         */
+        pool_task* parallel_task(task_delegate<void()>&& genericTask, task_priority priority,
+                                 steady_time_t deadline = {});
+
+        /**
+         * Runs a generic parallel task which is skipped if the token
+         * was cancelled before the task could start
+         * @return pool_task handle which can be waited on, or nullptr in work_stealing mode
+         * @throws task_rejected if the queue is full and the overflow policy is reject
+         */
+        pool_task* parallel_task(task_delegate<void()>&& genericTask,
+                                 cancellation_token token);
+
+        /**
+         * Runs a generic parallel task with an explicit overflow policy instead of the
+         * pool's own. Library code which must never lose a task (futures, timers,
+         * coroutine resumption) submits with overflow_policy::caller_runs.
+         * @return pool_task handle which can be waited on, or nullptr in work_stealing mode
+         * @throws task_rejected if the queue is full and whenFull is reject
+         */
+        pool_task* parallel_task(task_delegate<void()>&& genericTask,
+                                 overflow_policy whenFull);
+
+        // tasks outlive the call, so they can't borrow the callable of a function_ref
+        template<class Signature, class... Rest>
+        pool_task* parallel_task(function_ref<Signature>, Rest&&...) = delete;
+
+        /**
+         * Queues a generic parallel task only if the queue limit has not been reached.
+         * @note genericTask is only moved from if the task was accepted
+         * @return false if the work-stealing queue is full, the task was not queued
+         */
+        bool try_parallel_task(task_delegate<void()>&& genericTask,
+                               task_priority priority = task_priority::normal) noexcept;
+        template<class Signature, class... Rest>
+        bool try_parallel_task(function_ref<Signature>, Rest&&...) = delete;
+
+        /**
+         * Runs the task on this pool once the delay has passed. A single timer thread
+         * keeps all scheduled tasks in a min-heap, so scheduling is O(log n) and
+         * cancellation is O(1): cancelled tasks are simply dropped when they come due.
+         * @code
+         * auto timeout = pool.schedule_after(30s, [=] { conn->close(); });
+         * ...
+         * timeout.cancel(); // the connection finished in time
+         * @endcode
+         * @return Handle which cancels the task if it hasn't started yet
+         */
+        template<class Rep, class Period>
+        cancellation_source schedule_after(std::chrono::duration<Rep, Period> delay,
+                                           task_delegate<void()>&& task)
+        {
+            auto due = std::chrono::steady_clock::now()
+                     + std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay);
+            return schedule_timer(due, {}, move(task));
+        }
+        template<class Rep, class Period, class Signature>
+        cancellation_source schedule_after(std::chrono::duration<Rep, Period>, function_ref<Signature>) = delete;
+
+        /**
+         * Runs the task on this pool every period, starting one period from now.
+         * A new run is never started before the previous one has finished, and
+         * periods which were missed because the task ran too long are skipped.
+         * @code
+         * auto flusher = pool.schedule_every(100ms, [this] { flush(); });
+         * ...
+         * flusher.cancel(); // no more runs after the current one
+         * @endcode
+         * @return Handle which stops any further runs of the task
+         */
+        template<class Rep, class Period>
+        cancellation_source schedule_every(std::chrono::duration<Rep, Period> period,
+                                           task_delegate<void()>&& task)
+        {
+            auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+            if (interval.count() <= 0) interval = std::chrono::steady_clock::duration{1};
+            return schedule_timer(std::chrono::steady_clock::now() + interval, interval, move(task));
+        }
+        template<class Rep, class Period, class Signature>
+        cancellation_source schedule_every(std::chrono::duration<Rep, Period>, function_ref<Signature>) = delete;
+
+        // number of delayed and periodic tasks waiting for the timer, cancelled ones are not counted
+        int scheduled_tasks() noexcept;
 
         // return the number of physical cores
         static int physical_cores();
@@ -383,14 +1227,88 @@ namespace rpp
          * @note This will slow down parallel task startup since the call stack is unwound for debugging
          */
         void set_task_tracer(pool_trace_provider traceProvider);
+
+    private:
+        friend class pool_worker;
+        friend struct fork_join_group;
+        void start_workers() noexcept;
+        void stop_workers() noexcept;
+        bool submit_job(task_delegate<void()>& task, task_priority priority,
+                        steady_time_t deadline, overflow_policy policy) noexcept;
+        bool reserve_job_slot() noexcept;
+        void wait_for_job_slot() noexcept;
+        void enqueue_job(pool_job* job, bool reserved = false) noexcept;
+        pool_job* take_job(pool_worker* self) noexcept;
+        pool_job* pop_injected(task_priority priority) noexcept;
+        bool park_worker() noexcept;
+        void run_job(pool_job* job) noexcept;
+        cancellation_source schedule_timer(steady_time_t due, std::chrono::steady_clock::duration period,
+                                           task_delegate<void()>&& task);
+        void add_timer(timer_job* job) noexcept;
+        void compact_timers() noexcept;
+        void run_timers() noexcept;
+        void stop_timers() noexcept;
+    };
+
+
+    /**
+     * One work-stealing thread_pool per NUMA node, with every node's workers pinned
+     * to the CPUs of that node. Ranges are always partitioned between nodes the same way,
+     * so data which was initialized through this parallel_for is first-touched and later
+     * processed by the same node, avoiding cross-node memory traffic.
+     * @code
+     * rpp::numa_thread_pools pools;
+     * pools.parallel_for(0, N, [&](int start, int end) { init(data, start, end); });
+     * pools.parallel_for(0, N, [&](int start, int end) { process(data, start, end); });
+     * @endcode
+     */
+    class RPPAPI numa_thread_pools
+    {
+        vector<unique_ptr<thread_pool>> pools;
+        vector<int> cpuOffsets; // cumulative CPU counts, used as partition weights
+
+    public:
+        explicit numa_thread_pools(const cpu_topology& topology = cpu_topology::get());
+        ~numa_thread_pools() noexcept;
+        NOCOPY_NOMOVE(numa_thread_pools)
+
+        int node_count() const noexcept { return (int)pools.size(); }
+
+        // the pinned thread_pool of the node at the given index
+        thread_pool& node(int index) noexcept { return *pools[index]; }
+
+        /**
+         * Gets the sub-range [start, end) of [rangeStart, rangeEnd) which parallel_for
+         * gives to the node at the given index. Slices are proportional to node CPU counts.
+         */
+        void node_range(int index, int rangeStart, int rangeEnd, int& start, int& end) const noexcept;
+
+        /**
+         * Splits the range into one contiguous slice per node, and runs every slice as
+         * a fork-join parallel_for on that node's workers. Blocks until all nodes finish.
+         * @note The first exception thrown by rangeTask is rethrown after all nodes finish
+         */
+        void parallel_for(int rangeStart, int rangeEnd, const action<int, int>& rangeTask,
+                          parallel_schedule schedule = parallel_schedule::equal_slices,
+                          int grainSize = 0);
+
+        template<class Func> 
+        void parallel_for(int rangeStart, int rangeEnd, const Func& func,
+                          parallel_schedule schedule = parallel_schedule::equal_slices,
+                          int grainSize = 0)
+        {
+            parallel_for(rangeStart, rangeEnd, 
+                action<int, int>::from_function<Func, &Func::operator()>(&func),
+                schedule, grainSize);
+        }
     };
 
 
     /**
      * @brief Runs parallel_for on the default global thread pool
      *
-     * Runs a new Parallel For range task. Only ONE parallel for can be running, any kind of
-     * parallel nesting is forbidden. This prevents quadratic thread explosion.
+     * Runs a new fork-join Parallel For range task. Nesting parallel_for inside
+     * the callback is allowed and reuses the same pool workers.
      *
      * This function will block until all parallel tasks have finished running
      * 
@@ -405,23 +1323,78 @@ namespace rpp
      *     }
      * });
      * @endcode
+     * For skewed workloads, use parallel_schedule::dynamic or guided:
+     * @code
+     * rpp::parallel_for(0, images.size(), [&](int start, int end) {
+     *     ...
+     * }, rpp::parallel_schedule::dynamic, 4);
+     * @endcode
      * @param rangeStart Usually 0
      * @param rangeEnd Usually vec.size()
      * @param func Non-owning callback action:  void(int start, int end)
+     * @param schedule How the range is split into chunks
+     * @param grainSize Minimum number of iterations per chunk. If 0, a default is chosen
+     */
+    template<class Func>
+    inline void parallel_for(int rangeStart, int rangeEnd, const Func& func,
+                             parallel_schedule schedule = parallel_schedule::equal_slices,
+                             int grainSize = 0)
+    {
+        thread_pool::global().parallel_for(rangeStart, rangeEnd,
+            action<int, int>::from_function<Func, &Func::operator()>(&func),
+            schedule, grainSize);
+    }
+
+    /**
+     * @brief Runs a cancellable parallel_for on the default global thread pool
+     * @code
+     * rpp::cancellation_source source;
+     * rpp::parallel_for(0, (int)rows.size(), [&](int start, int end) {
+     *     for (int i = start; i < end; ++i)
+     *         process(rows[i]);
+     * }, source.token());
+     * @endcode
+     * @throws task_cancelled if any chunks were skipped because of cancellation
      */
     template<class Func>
-    inline void parallel_for(int rangeStart, int rangeEnd, const Func& func) noexcept
+    inline void parallel_for(int rangeStart, int rangeEnd, const Func& func,
+                             const cancellation_token& token,
+                             parallel_schedule schedule = parallel_schedule::equal_slices,
+                             int grainSize = 0)
     {
         thread_pool::global().parallel_for(rangeStart, rangeEnd,
-            action<int, int>::from_function<Func, &Func::operator()>(&func));
+            action<int, int>::from_function<Func, &Func::operator()>(&func),
+            token, schedule, grainSize);
+    }
+
+
+    /**
+     * Runs the task on the default global thread pool once the delay has passed
+     * @return Handle which cancels the task if it hasn't started yet
+     */
+    template<class Rep, class Period>
+    inline cancellation_source schedule_after(std::chrono::duration<Rep, Period> delay,
+                                              task_delegate<void()>&& task)
+    {
+        return thread_pool::global().schedule_after(delay, std::move(task));
+    }
+
+    /**
+     * Runs the task on the default global thread pool every period
+     * @return Handle which stops any further runs of the task
+     */
+    template<class Rep, class Period>
+    inline cancellation_source schedule_every(std::chrono::duration<Rep, Period> period,
+                                              task_delegate<void()>&& task)
+    {
+        return thread_pool::global().schedule_every(period, std::move(task));
     }
 
 
     /**
      * @brief Runs parallel_foreach on the default global thread pool
      * 
-     * Runs a new Parallel For range task. Only ONE parallel for can be running, any kind of
-     * parallel nesting is forbidden. This prevents quadratic thread explosion.
+     * Runs a new fork-join Parallel For range task. Nesting is allowed.
      * 
      * This function will block until all parallel tasks have finished running
      * 
@@ -433,32 +1406,312 @@ namespace rpp
      * @endcode
      * @param items A random access container with an operator[](int index) and size()
      * @param foreach Non-owning foreach callback action:  void(auto item)
+     * @param schedule How the items are split into chunks
+     * @param grainSize Minimum number of items per chunk. If 0, a default is chosen
      */
     template<class Container, class ForeachFunc>
-    inline void parallel_foreach(Container& items, const ForeachFunc& foreach) noexcept
+    inline void parallel_foreach(Container& items, const ForeachFunc& foreach,
+                                 parallel_schedule schedule = parallel_schedule::equal_slices,
+                                 int grainSize = 0)
     {
         thread_pool::global().parallel_for(0, (int)items.size(), [&](int start, int end) {
             for (int i = start; i < end; ++i) {
                 foreach(items[i]);
             }
-        });
+        }, schedule, grainSize);
+    }
+
+
+    /**
+     * Ordering of partial results in parallel reductions
+     */
+    enum class reduce_order
+    {
+        /**
+         * Default: every participating thread accumulates into its own cache line padded slot
+         * and the slots are combined at the end. Fastest, but with non-associative operations
+         * such as floating point addition the result can vary between runs.
+         */
+        unordered,
+
+        /**
+         * The range is split into fixed chunks which only depend on the number of items,
+         * and chunk results are combined in index order. Results are reproducible
+         * regardless of the number of workers or thread scheduling.
+         */
+        deterministic,
+    };
+
+    namespace detail
+    {
+        // a partial result that occupies its own cache line to avoid false sharing
+        template<class T> struct alignas(64) padded_partial
+        {
+            T value {};
+            bool valid = false;
+        };
+
+        // number of fixed chunks for deterministic reductions and scans
+        inline int fixed_chunk_count(int numItems) noexcept
+        {
+            return numItems < 256 ? numItems : 256;
+        }
+
+        inline int fixed_chunk_start(int numItems, int numChunks, int chunk) noexcept
+        {
+            return int(int64(numItems) * chunk / numChunks);
+        }
+    }
+
+
+    namespace detail
+    {
+        /**
+         * Reduces items into per-thread or per-chunk partial results and combines them with init.
+         * @param seed Result(const T& item), starts a new partial from its first item
+         * @param step Result(Result&& acc, const T& item), adds an item to a partial
+         * @param combine Result(Result a, Result b), merges the partials
+         */
+        template<class T, class Result, class SeedOp, class StepOp, class CombineOp>
+        Result reduce_partials(element_range<T> items, Result init, const SeedOp& seed,
+                               const StepOp& step, const CombineOp& combine, reduce_order order)
+        {
+            thread_pool& pool = thread_pool::global();
+            const int numItems = items.size();
+            if (numItems <= 0)
+                return init;
+
+            const bool ordered = order == reduce_order::deterministic;
+            const int numSlots = ordered ? fixed_chunk_count(numItems) : pool.max_workers() + 1;
+            vector<padded_partial<Result>> partials(numSlots);
+
+            auto accumulate = [&](padded_partial<Result>& p, int start, int end) {
+                int i = start;
+                if (!p.valid) {
+                    p.value = seed(items[i++]);
+                    p.valid = true;
+                }
+                for (; i < end; ++i)
+                    p.value = step(std::move(p.value), items[i]);
+            };
+
+            if (ordered)
+            {
+                pool.parallel_for(0, numSlots, [&](int first, int last) {
+                    for (int c = first; c < last; ++c)
+                        accumulate(partials[c], fixed_chunk_start(numItems, numSlots, c),
+                                                fixed_chunk_start(numItems, numSlots, c + 1));
+                }, parallel_schedule::dynamic, 1);
+            }
+            else
+            {
+                pool.parallel_for(0, numItems, [&](int start, int end) {
+                    // the calling thread uses slot 0, pool workers use 1..max_workers()
+                    accumulate(partials[pool.current_worker_index() + 1], start, end);
+                }, parallel_schedule::dynamic);
+            }
+
+            Result result = std::move(init);
+            for (padded_partial<Result>& p : partials)
+                if (p.valid) result = combine(std::move(result), std::move(p.value));
+            return result;
+        }
+    }
+
+
+    /**
+     * @brief Runs a parallel transform-reduce on the default global thread pool
+     *
+     * Every item is transformed and the results are combined with the reduce operation.
+     * The reduce operation must be associative, init is combined exactly once.
+     * @code
+     * vector<Image> images = ...;
+     * int64 totalPixels = rpp::parallel_transform_reduce(rpp::range(images), int64(0),
+     *     [](int64 a, int64 b) { return a + b; },
+     *     [](const Image& img) { return int64(img.width) * img.height; });
+     * @endcode
+     * @param items Range of items to reduce
+     * @param init Initial value of the result
+     * @param reduce Result(Result a, Result b)
+     * @param transform Result(const T& item)
+     * @param order Whether partial results are combined in a deterministic order
+     */
+    template<class T, class Result, class ReduceOp, class TransformOp>
+    Result parallel_transform_reduce(element_range<T> items, Result init,
+                                     const ReduceOp& reduce, const TransformOp& transform,
+                                     reduce_order order = reduce_order::unordered)
+    {
+        return detail::reduce_partials(items, std::move(init),
+            [&](const T& item) -> Result { return transform(item); },
+            [&](Result&& acc, const T& item) -> Result { return reduce(std::move(acc), transform(item)); },
+            reduce, order);
+    }
+
+
+    /**
+     * @brief Runs a parallel reduce on the default global thread pool
+     * @note Partial results start from the first item of their range and are combined
+     *       with the same reduce operation, so T must convert into Result and reduce must
+     *       also accept two Results. Use the overload with a combine operation otherwise.
+     * @code
+     * vector<float> values = ...;
+     * float sum = rpp::parallel_reduce(rpp::range(values), 0.0f, std::plus<float>{},
+     *                                  rpp::reduce_order::deterministic);
+     * @endcode
+     * @param items Range of items to reduce
+     * @param init Initial value of the result, combined exactly once
+     * @param reduce Result(Result a, Result b), must be associative
+     * @param order Whether partial results are combined in a deterministic order
+     */
+    template<class T, class Result, class ReduceOp>
+    Result parallel_reduce(element_range<T> items, Result init, const ReduceOp& reduce,
+                           reduce_order order = reduce_order::unordered)
+    {
+        static_assert(std::is_constructible_v<Result, const T&> &&
+                      std::is_invocable_r_v<Result, const ReduceOp&, Result, Result>,
+                      "parallel_reduce: T must convert into Result and reduce must accept (Result, Result), "
+                      "otherwise pass a separate combine operation");
+        return detail::reduce_partials(items, std::move(init),
+            [](const T& item) -> Result { return Result(item); },
+            [&](Result&& acc, const T& item) -> Result { return reduce(std::move(acc), Result(item)); },
+            reduce, order);
+    }
+
+
+    /**
+     * @brief Runs a parallel reduce of items into a different Result type
+     *        on the default global thread pool
+     *
+     * Every partial result starts from a copy of identity and accumulates its items
+     * with reduce. The partial results are then merged with combine.
+     * @code
+     * vector<string> lines = ...;
+     * size_t totalLength = rpp::parallel_reduce(rpp::range(lines), size_t(0),
+     *     [](size_t sum, const string& s) { return sum + s.size(); },
+     *     std::plus<size_t>{});
+     * @endcode
+     * @param items Range of items to reduce
+     * @param identity Identity element of combine, for example 0 for sums
+     * @param reduce Result(Result acc, const T& item)
+     * @param combine Result(Result a, Result b), must be associative
+     * @param order Whether partial results are combined in a deterministic order
+     */
+    template<class T, class Result, class ReduceOp, class CombineOp,
+             class = std::enable_if_t<!std::is_same_v<CombineOp, reduce_order>>>
+    Result parallel_reduce(element_range<T> items, Result identity, const ReduceOp& reduce,
+                           const CombineOp& combine, reduce_order order = reduce_order::unordered)
+    {
+        return detail::reduce_partials(items, identity,
+            [&](const T& item) -> Result { return reduce(Result(identity), item); },
+            [&](Result&& acc, const T& item) -> Result { return reduce(std::move(acc), item); },
+            combine, order);
+    }
+
+
+    /**
+     * @brief Runs a parallel inclusive prefix scan on the default global thread pool
+     *
+     * out[i] = items[0] op items[1] op ... op items[i]
+     * Uses two passes over fixed chunks: chunk totals are computed in parallel,
+     * scanned serially, and then every chunk is scanned in parallel with its carry-in.
+     * @note Scanning in-place is allowed: out can be items.data()
+     * @note Chunk totals are combined with op as well, so T must convert into U
+     *       and op must also accept two U-s
+     * @param items Range of items to scan
+     * @param out Destination array with at least items.size() elements
+     * @param op U(U a, U b), must be associative
+     */
+    template<class T, class U, class ScanOp>
+    void parallel_inclusive_scan(element_range<T> items, U* out, const ScanOp& op)
+    {
+        static_assert(std::is_constructible_v<U, const T&> &&
+                      std::is_invocable_r_v<U, const ScanOp&, U, U>,
+                      "parallel_inclusive_scan: T must convert into U and op must accept (U, U)");
+        thread_pool& pool = thread_pool::global();
+        const int numItems = items.size();
+        if (numItems <= 0)
+            return;
+
+        const int numChunks = detail::fixed_chunk_count(numItems);
+        vector<detail::padded_partial<U>> totals(numChunks);
+
+        pool.parallel_for(0, numChunks, [&](int first, int last) {
+            for (int c = first; c < last; ++c) {
+                const int start = detail::fixed_chunk_start(numItems, numChunks, c);
+                const int end   = detail::fixed_chunk_start(numItems, numChunks, c + 1);
+                U total = U(items[start]);
+                for (int i = start + 1; i < end; ++i)
+                    total = op(std::move(total), U(items[i]));
+                totals[c].value = std::move(total);
+            }
+        }, parallel_schedule::dynamic, 1);
+
+        // totals[c] becomes the carry-in of chunk c+1
+        for (int c = 1; c < numChunks; ++c)
+            totals[c].value = op(totals[c - 1].value, totals[c].value);
+
+        pool.parallel_for(0, numChunks, [&](int first, int last) {
+            for (int c = first; c < last; ++c) {
+                const int start = detail::fixed_chunk_start(numItems, numChunks, c);
+                const int end   = detail::fixed_chunk_start(numItems, numChunks, c + 1);
+                U sum = c > 0 ? op(totals[c - 1].value, U(items[start])) : U(items[start]);
+                out[start] = sum;
+                for (int i = start + 1; i < end; ++i)
+                    out[i] = sum = op(std::move(sum), U(items[i]));
+            }
+        }, parallel_schedule::dynamic, 1);
     }
 
 
     /**
      * Runs a generic parallel task with no arguments on the default global thread pool
      * @note Returns immediately
+     * @warning Returns nullptr if the global pool was switched to pool_mode::work_stealing,
+     *          so don't call `->wait()` on the result in code which doesn't control the pool mode
+     * @throws task_rejected if the global pool's queue is full and its overflow policy is reject
      * @code
      * rpp::parallel_task([s] {
      *     run_slow_work(s);
      * });
      * @endcode
      */
-    inline pool_task* parallel_task(task_delegate<void()>&& genericTask) noexcept
+    inline pool_task* parallel_task(task_delegate<void()>&& genericTask)
     {
         return thread_pool::global().parallel_task(std::move(genericTask));
     }
 
+    // tasks outlive the call, so they can't borrow the callable of a function_ref
+    template<class Signature>
+    pool_task* parallel_task(function_ref<Signature>) = delete;
+
+    /**
+     * Runs a generic parallel task on the default global thread pool,
+     * unless the token is cancelled before the task starts
+     * @note This is a template so it's preferred over the parallel_task(func, arg) overloads
+     */
+    template<class Func>
+    inline pool_task* parallel_task(Func&& func, cancellation_token token) // nullptr in work_stealing mode
+    {
+        static_assert(!detail::is_function_ref<std::decay_t<Func>>::value,
+                      "parallel_task can't borrow a function_ref, the task would outlive it");
+        return thread_pool::global().parallel_task(
+            task_delegate<void()>{ std::forward<Func>(func) }, std::move(token));
+    }
+
+    /**
+     * Runs a generic parallel task on the default global thread pool
+     * with an explicit overflow policy, see thread_pool::parallel_task
+     * @note This is a template so it's preferred over the parallel_task(func, arg) overloads
+     */
+    template<class Func>
+    inline pool_task* parallel_task(Func&& func, overflow_policy whenFull) // nullptr in work_stealing mode
+    {
+        static_assert(!detail::is_function_ref<std::decay_t<Func>>::value,
+                      "parallel_task can't borrow a function_ref, the task would outlive it");
+        return thread_pool::global().parallel_task(
+            task_delegate<void()>{ std::forward<Func>(func) }, whenFull);
+    }
+
 #undef move_args
 #define __get_nth_move_arg(_unused, _8, _7, _6, _5, _4, _3, _2, _1, N_0, ...) N_0
 #define __move_args0(...)
@@ -530,6 +1783,7 @@ namespace rpp
     /**
      * Runs a generic lambda with arguments
      * @note Returns immediately
+     * @return pool_task handle, or nullptr if the global pool is in work_stealing mode
      * @code 
      * rpp::parallel_task([](string s) {
      *     auto r = run_slow_work(s, 42);
@@ -540,6 +1794,8 @@ namespace rpp
     template<class Func, class A>
     inline pool_task* parallel_task(Func&& func, A&& a)
     {
+        static_assert(!detail::is_function_ref<std::decay_t<Func>>::value,
+                      "parallel_task can't borrow a function_ref, the task would outlive it");
         return thread_pool::global().parallel_task([move_args(func, a)]() mutable {
             func(forward_args(a));
         });
@@ -547,6 +1803,8 @@ namespace rpp
     template<class Func, class A, class B>
     inline pool_task* parallel_task(Func&& func, A&& a, B&& b)
     {
+        static_assert(!detail::is_function_ref<std::decay_t<Func>>::value,
+                      "parallel_task can't borrow a function_ref, the task would outlive it");
         return thread_pool::global().parallel_task([move_args(func, a, b)]() mutable {
             func(forward_args(a, b));
         });
@@ -554,6 +1812,8 @@ namespace rpp
     template<class Func, class A, class B, class C>
     inline pool_task* parallel_task(Func&& func, A&& a, B&& b, C&& c)
     {
+        static_assert(!detail::is_function_ref<std::decay_t<Func>>::value,
+                      "parallel_task can't borrow a function_ref, the task would outlive it");
         return thread_pool::global().parallel_task([move_args(func, a, b, c)]() mutable {
             func(forward_args(a, b, c));
         });
@@ -561,6 +1821,8 @@ namespace rpp
     template<class Func, class A, class B, class C, class D>
     inline pool_task* parallel_task(Func&& func, A&& a, B&& b, C&& c, D&& d)
     {
+        static_assert(!detail::is_function_ref<std::decay_t<Func>>::value,
+                      "parallel_task can't borrow a function_ref, the task would outlive it");
         return thread_pool::global().parallel_task([move_args(func, a, b, c, d)]() mutable {
             func(forward_args(a, b, c, d));
         });
@@ -0,0 +1,16 @@
+#include "alloc_counter.h"
+#include <cstdlib> // malloc
+#include <new>
+
+// counts all heap allocations of the test executable
+std::atomic<int64_t> numAllocations { 0 };
+
+void* operator new(size_t size)
+{
+    numAllocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc{};
+}
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
@@ -0,0 +1,6 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+
+// number of global operator new calls so far, for the allocation benchmarks
+extern std::atomic<int64_t> numAllocations;
@@ -1,6 +1,9 @@
 #include <rpp/collections.h>
 #include <rpp/stack_trace.h>
 #include <rpp/tests.h>
+#include <rpp/thread_pool.h> // blocking_ring
+#include <rpp/timer.h> // performance measurement
+#include <deque>
 using namespace rpp;
 using std::unordered_map;
 
@@ -404,6 +407,191 @@ TestImpl(test_collections)
         AssertThat(transformed2, expected);
     }
 
+    TestCase(mpmc_ring)
+    {
+        mpmc_ring<string> ring { 5 };
+        AssertThat(ring.capacity(), 8u); // rounded up to power of two
+        for (int i = 0; i < 8; ++i)
+            AssertThat(ring.try_push(std::to_string(i)), true);
+        string rejected = "rejected";
+        AssertThat(ring.try_push(move(rejected)), false);
+        AssertThat(rejected, "rejected"s); // not moved from
+        AssertThat(ring.size_approx(), 8u);
+
+        string s;
+        AssertThat(ring.try_pop(s), true);
+        AssertThat(s, "0"s);
+
+        string batch[8];
+        AssertThat(ring.pop_n(batch, 3), 3u);
+        AssertThat(batch[0] + batch[1] + batch[2], "123"s);
+        string more[5] = { "a", "b", "c", "d", "e" };
+        AssertThat(ring.push_n(more, 5), 4u); // only 4 free slots
+        AssertThat(ring.pop_n(batch, 8), 8u);
+        AssertThat(batch[0], "4"s);
+        AssertThat(batch[7], "d"s);
+        AssertThat(ring.try_pop(s), false);
+        AssertThat(ring.pop_n(batch, 8), 0u);
+
+        ring.try_push("left in the ring, freed by the destructor"s);
+    }
+
+    TestCase(spsc_ring)
+    {
+        spsc_ring<string> ring { 4 };
+        AssertThat(ring.capacity(), 4u);
+        string items[6] = { "0", "1", "2", "3", "4", "5" };
+        AssertThat(ring.push_n(items, 6), 4u);
+        AssertThat(ring.try_push(items[4]), false);
+
+        string s;
+        AssertThat(ring.try_pop(s), true);
+        AssertThat(s, "0"s);
+        AssertThat(ring.try_push(items[4]), true);
+
+        string batch[4];
+        AssertThat(ring.pop_n(batch, 4), 4u);
+        AssertThat(batch[0] + batch[1] + batch[2] + batch[3], "1234"s);
+        AssertThat(ring.try_pop(s), false);
+
+        // one producer and one consumer thread, items arrive in order
+        constexpr int N = 100'000;
+        spsc_ring<int> ints { 64 };
+        std::thread producer { [&] {
+            for (int i = 0; i < N; ++i)
+                while (!ints.try_push(i)) std::this_thread::yield();
+        }};
+        int expected = 0;
+        while (expected < N)
+        {
+            int chunk[16];
+            size_t n = ints.pop_n(chunk, 16);
+            if (n == 0) { std::this_thread::yield(); continue; }
+            for (size_t i = 0; i < n; ++i)
+                if (chunk[i] != expected++) break;
+            if (!AssertThat(chunk[n-1], expected-1)) break;
+        }
+        producer.join();
+        AssertThat(expected, N);
+    }
+
+    TestCase(mpmc_ring_concurrent)
+    {
+        constexpr int producers = 4, consumers = 4, perProducer = 50'000;
+        mpmc_ring<int> ring { 128 };
+        std::atomic<int64_t> sum { 0 };
+        std::atomic<int> popped { 0 };
+        vector<std::thread> threads;
+        for (int p = 0; p < producers; ++p)
+            threads.emplace_back([&] {
+                for (int i = 1; i <= perProducer; ++i)
+                    while (!ring.try_push(i)) std::this_thread::yield();
+            });
+        for (int c = 0; c < consumers; ++c)
+            threads.emplace_back([&] {
+                int item;
+                while (popped < producers * perProducer) {
+                    if (ring.try_pop(item)) { sum += item; ++popped; }
+                    else std::this_thread::yield();
+                }
+            });
+        for (std::thread& t : threads) t.join();
+        AssertThat((int)popped, producers * perProducer);
+        AssertThat((int64_t)sum, int64_t(producers) * perProducer * (perProducer + 1) / 2);
+    }
+
+    TestCase(blocking_ring)
+    {
+        blocking_mpmc_ring<int> ring { 4 };
+        int item = 0;
+        AssertThat(ring.try_pop(item), false);
+        AssertThat(ring.pop(item, std::chrono::milliseconds{5}), false);
+
+        constexpr int N = 10'000;
+        std::thread producer { [&] {
+            for (int i = 0; i < N; ++i) ring.push(i); // blocks while full
+        }};
+        int64_t sum = 0;
+        for (int i = 0; i < N; ++i) sum += ring.pop(); // blocks while empty
+        producer.join();
+        AssertThat(sum, int64_t(N) * (N - 1) / 2);
+
+        for (int i = 0; i < 4; ++i) AssertThat(ring.try_push(i), true);
+        AssertThat(ring.try_push(4), false);
+        AssertThat(ring.size(), 4);
+
+        blocking_spsc_ring<string> strings { 2 };
+        strings.push("spsc"s);
+        AssertThat(strings.pop(), "spsc"s);
+    }
+
+    // baseline for the throughput benchmark
+    struct locked_deque
+    {
+        std::mutex m;
+        std::deque<int> items;
+        size_t cap;
+        explicit locked_deque(size_t capacity) : cap{capacity} {}
+        bool try_push(int item)
+        {
+            std::lock_guard<std::mutex> lock{m};
+            if (items.size() == cap) return false;
+            items.push_back(item);
+            return true;
+        }
+        bool try_pop(int& out)
+        {
+            std::lock_guard<std::mutex> lock{m};
+            if (items.empty()) return false;
+            out = items.front();
+            items.pop_front();
+            return true;
+        }
+    };
+
+    template<class Queue> static double throughput(Queue& q, int producers, int consumers, int total)
+    {
+        int perProducer = total / producers;
+        total = perProducer * producers;
+        std::atomic<int> popped { 0 };
+        vector<std::thread> threads;
+        Timer timer;
+        for (int p = 0; p < producers; ++p)
+            threads.emplace_back([&] {
+                for (int i = 0; i < perProducer; ++i)
+                    while (!q.try_push(i)) std::this_thread::yield();
+            });
+        for (int c = 0; c < consumers; ++c)
+            threads.emplace_back([&] {
+                int item;
+                while (popped.load(std::memory_order_relaxed) < total) {
+                    if (q.try_pop(item)) popped.fetch_add(1, std::memory_order_relaxed);
+                    else std::this_thread::yield();
+                }
+            });
+        for (std::thread& t : threads) t.join();
+        return total / timer.elapsed() / 1'000'000.0;
+    }
+
+    TestCase(ring_throughput)
+    {
+        constexpr int N = 400'000;
+        {
+            spsc_ring<int> spsc { 1024 };
+            locked_deque locked { 1024 };
+            printf("   1P/ 1C  spsc_ring %6.2f Mops/s   mutex+deque %6.2f Mops/s\n",
+                   throughput(spsc, 1, 1, N), throughput(locked, 1, 1, N));
+        }
+        for (int threads : { 1, 2, 4, 8, 16 })
+        {
+            mpmc_ring<int> mpmc { 1024 };
+            locked_deque locked { 1024 };
+            printf("  %2dP/%2dC  mpmc_ring %6.2f Mops/s   mutex+deque %6.2f Mops/s\n", threads, threads,
+                   throughput(mpmc, threads, threads, N), throughput(locked, threads, threads, N));
+            AssertThat(mpmc.empty_approx(), true);
+        }
+    }
+
     //TestCase(reduce)
     //{
     //    vector<string> v { "1"s, "2"s, "3"s, "4"s, "5"s };
@@ -0,0 +1,128 @@
+#include <rpp/coroutines.h>
+#include <rpp/tests.h>
+#if RPP_HAS_COROUTINES
+using namespace rpp;
+using namespace std::chrono_literals;
+using namespace std::this_thread;
+using std::runtime_error;
+
+TestImpl(test_coroutines)
+{
+    TestInit(test_coroutines)
+    {
+    }
+
+    static task<int> add_async(int a, int b)
+    {
+        co_await schedule_on(thread_pool::global());
+        co_return a + b;
+    }
+
+    static task<int> sum_of_sums()
+    {
+        int x = co_await add_async(1, 2);
+        int y = co_await add_async(3, 4);
+        co_return x + y;
+    }
+
+    TestCase(task_chaining)
+    {
+        AssertThat(sum_of_sums().get(), 10);
+    }
+
+    TestCase(schedule_on_pool)
+    {
+        thread_pool pool;
+        auto caller = get_id();
+        auto resumedOn = [&]() -> task<std::thread::id> {
+            co_await schedule_on(pool);
+            co_return get_id();
+        };
+        AssertThat(resumedOn().get() != caller, true);
+    }
+
+    TestCase(await_cfuture)
+    {
+        auto download = []() -> task<string> {
+            string page = co_await async_task([] {
+                ::sleep_for(5ms);
+                return "page"s;
+            });
+            co_await async_task([] { ::sleep_for(1ms); });
+            co_return page + " loaded";
+        };
+        AssertThat(download().get(), "page loaded");
+
+        auto ready = []() -> task<int> {
+            co_return co_await make_ready_future(42);
+        };
+        AssertThat(ready().get(), 42);
+    }
+
+    TestCaseExpectedEx(task_exception, runtime_error)
+    {
+        auto fails = []() -> task<> {
+            co_await schedule_on(thread_pool::global());
+            throw runtime_error("task failed");
+        };
+        auto awaitsFailure = [&]() -> task<> {
+            co_await fails();
+        };
+        awaitsFailure().get();
+    }
+
+    TestCaseExpectedEx(await_cfuture_exception, runtime_error)
+    {
+        auto awaitsFailure = []() -> task<int> {
+            co_return co_await async_task([]() -> int { throw runtime_error("future failed"); });
+        };
+        (void)awaitsFailure().get();
+    }
+
+    TestCaseExpectedEx(get_moved_from_task, std::future_error)
+    {
+        task<int> first = add_async(1, 2);
+        task<int> second = std::move(first);
+        AssertThat(second.get(), 3);
+        AssertThat(first.valid(), false);
+        (void)first.get();
+    }
+
+    TestCase(schedule_on_full_pool)
+    {
+        thread_pool pool { pool_mode::work_stealing, 1 };
+        pool.set_queue_limit(1, overflow_policy::reject);
+        atomic_int gate {0};
+        pool.parallel_task([&] { gate = 1; while (gate != 2) ::yield(); });
+        while (gate != 1) ::yield();
+        pool.parallel_task([] {}); // the queue is now full
+
+        // the coroutine can't be queued, so it keeps running on the caller
+        auto caller = get_id();
+        auto resumedOn = [&]() -> task<std::thread::id> {
+            co_await schedule_on(pool);
+            co_return get_id();
+        };
+        AssertThat(resumedOn().get() == caller, true);
+        gate = 2;
+    }
+
+    TestCase(start_async)
+    {
+        atomic_int counter {0};
+        auto work = [&](int i) -> task<int> {
+            co_await schedule_on();
+            ++counter;
+            co_return i * 2;
+        };
+        vector<cfuture<int>> futures;
+        for (int i = 0; i < 32; ++i)
+            futures.emplace_back(work(i).start_async());
+        int sum = 0;
+        for (cfuture<int>& f : futures)
+            sum += f.get();
+        AssertThat(sum, 2 * (31 * 32 / 2));
+        AssertThat((int)counter, 32);
+    }
+};
+#endif // RPP_HAS_COROUTINES
@@ -1,7 +1,9 @@
 #define _DEBUG_FUNCTIONAL_MACHINERY
 #include <rpp/delegate.h>
 #include <rpp/stack_trace.h>
+#include <rpp/future.h>
 #include <rpp/tests.h>
+#include "alloc_counter.h"
 using namespace rpp;
 
 
@@ -239,6 +241,220 @@ TestImpl(test_delegate)
         AssertThat(init(data), "move_init");
     }
 
+    TestCase(inline_functors)
+    {
+        int64_t before = numAllocations;
+        int calls = 0;
+        delegate<int(int)> small = [&calls](int x) { ++calls; return x * 2; };
+        AssertThat(small(21), 42);
+        AssertThat(numAllocations - before, 0); // small captures don't allocate
+
+        delegate<int(int)> moved = move(small);
+        AssertThat((bool)small, false);
+        AssertThat(moved(1), 2);
+        delegate<int(int)> copied = moved;
+        AssertThat(copied(2), 4);
+        AssertThat(moved(3), 6);
+        AssertThat(calls, 4);
+        AssertThat(numAllocations - before, 0);
+
+        // move assignment swaps inline functors
+        delegate<int(int)> other = [](int x) { return x + 1; };
+        other = move(copied);
+        AssertThat(other(5), 10);
+        AssertThat(copied(5), 6);
+
+        char big[delegate<void()>::inline_size * 2] = "big";
+        before = numAllocations;
+        delegate<size_t()> dynamic = [big] { return strlen(big); };
+        AssertThat(numAllocations - before, 1); // big captures fall back to the heap
+        delegate<size_t()> stolen = move(dynamic);
+        AssertThat(numAllocations - before, 1); // and are moved without copying
+        AssertThat(stolen(), size_t(3));
+
+        // inline functors with a non-trivial capture, copies must stay independent
+        DataDelegate owner = [x=data](Data a) { return validate("owner", a, x); };
+        DataDelegate copy = owner;
+        owner.reset();
+        AssertThat(copy(data), "owner");
+        owner = copy;
+        AssertThat(owner(data), "owner");
+    }
+
+    TestCase(lvalue_functor_is_copied)
+    {
+        auto lambda = [x=data](Data a) { return validate("lvalue", a, x); };
+        DataDelegate first = lambda;  // binds to Functor&&, must not move from `lambda`
+        DataDelegate second;
+        second.reset(lambda);
+        AssertThat(first(data), "lvalue");
+        AssertThat(second(data), "lvalue");
+        AssertThat(lambda(data), "lvalue");
+    }
+
+    TestCase(unique_delegates)
+    {
+        auto owned = std::make_unique<Data>("unique");
+        unique_delegate<string()> get = [p=move(owned)] { return string{p->data}; };
+        AssertThat(get(), "unique"s);
+
+        unique_delegate<string()> moved = move(get);
+        AssertThat((bool)get, false);
+        AssertThat(moved(), "unique"s);
+
+        // assignment destroys the previous functor right away
+        auto counter = std::make_shared<int>(0);
+        unique_delegate<int()> shared = [counter] { return *counter; };
+        AssertThat(counter.use_count(), 2L);
+        shared = [] { return 42; };
+        AssertThat(counter.use_count(), 1L);
+        AssertThat(shared(), 42);
+
+        // big captures fall back to the heap, but move without copying
+        int64_t before = numAllocations;
+        char big[unique_delegate<void()>::inline_size * 2] = "big";
+        unique_delegate<size_t()> dynamic = [big, p=std::make_unique<int>(1)] { return strlen(big) + *p; };
+        unique_delegate<size_t()> stolen = move(dynamic);
+        AssertThat(numAllocations - before, 2); // the unique_ptr and the functor
+        AssertThat(stolen(), size_t(4));
+
+        // functions, methods and copyable delegates convert too
+        Data (*function)(Data a) = [](Data a) { return validate("function", a); };
+        unique_delegate<Data(Data)> func = function;
+        AssertThat(func(data), "function");
+        Base inst;
+        unique_delegate<Data(Data)> method { inst, &Base::method };
+        AssertThat(method(data), "method");
+        Derived derived;
+        unique_delegate<Data(Data)> virt { (Base*)&derived, &Base::virtual_method };
+        AssertThat(virt(data), "derived_method");
+        unique_delegate<Data(Data)> fromDelegate = DataDelegate{ inst, &Base::const_method };
+        AssertThat(fromDelegate(data), "const_method");
+        unique_delegate<void()> empty = nullptr;
+        AssertThat(empty == nullptr, true);
+    }
+
+    TestCase(delegates_move_into_unique_delegates)
+    {
+        // inline functors are moved over, dynamic ones are stolen, neither allocates
+        auto counter = std::make_shared<int>(7);
+        delegate<int()> small = [counter] { return *counter; };
+        char big[delegate<void()>::inline_size * 2] = "big";
+        delegate<size_t()> dynamic = [big, counter] { return strlen(big) + *counter; };
+        AssertThat(counter.use_count(), 3L);
+
+        int64_t before = numAllocations;
+        unique_delegate<int()> fromSmall = move(small);
+        unique_delegate<size_t()> fromDynamic = move(dynamic);
+        AssertThat(numAllocations - before, 0);
+        AssertThat((bool)small, false);
+        AssertThat((bool)dynamic, false);
+        AssertThat(fromSmall(), 7);
+        AssertThat(fromDynamic(), size_t(10));
+
+        unique_delegate<int()> moved = move(fromSmall); // relocated again inside unique_delegate
+        AssertThat(moved(), 7);
+        AssertThat(counter.use_count(), 3L);
+        moved.reset();
+        fromDynamic.reset();
+        AssertThat(counter.use_count(), 1L); // ownership was transferred, not duplicated
+
+        // functions and bound methods don't own anything
+        Base inst;
+        before = numAllocations;
+        unique_delegate<Data(Data)> method = DataDelegate{ inst, &Base::method };
+        unique_delegate<Data(Data)> func = DataDelegate{ +[](Data a) { return validate("function", a); } };
+        AssertThat(numAllocations - before, 0);
+        AssertThat(method(data), "method");
+        AssertThat(func(data), "function");
+
+        // lvalues are copied and stay usable
+        const DataDelegate original { inst, &Base::const_method };
+        unique_delegate<Data(Data)> copied = original;
+        AssertThat(copied(data), "const_method");
+        AssertThat(original(data), "const_method");
+    }
+
+    static int sum(function_ref<int(int)> fn, int n)
+    {
+        int total = 0;
+        for (int i = 0; i < n; ++i) total += fn(i);
+        return total;
+    }
+
+    TestCase(function_refs)
+    {
+        int64_t before = numAllocations;
+        int offset = 10;
+        AssertThat(sum([&](int i) { return i + offset; }, 4), 46);
+
+        auto twice = [](int i) { return i * 2; };
+        function_ref<int(int)> ref = twice;
+        AssertThat(sum(ref, 4), 12);
+        AssertThat(sum(ref, 0), 0);
+
+        int (*negate)(int) = [](int i) { return -i; };
+        AssertThat(sum(negate, 4), -6);
+        AssertThat((bool)function_ref<int(int)>{}, false);
+        AssertThat(numAllocations - before, 0); // function_ref never allocates
+    }
+
+    TestCase(inline_functor_allocations_per_task)
+    {
+        constexpr int N = 20000;
+        // warm up the pool with a few concurrent tasks, so a task which is still returning
+        // to the pool never forces a new pool_task to be spawned during the measurements
+        std::atomic_int started {0};
+        vector<cfuture<void>> warmup;
+        for (int i = 0; i < 4; ++i)
+            warmup.push_back(async_task([&] { ++started; while (started < 4) std::this_thread::yield(); }));
+        for (cfuture<void>& f : warmup) f.get();
+        for (int i = 0; i < 100; ++i)
+            (void)async_task([i] { return i; }).get();
+
+        int64_t before = numAllocations;
+        for (int i = 0; i < N; ++i)
+            (void)async_task([i] { return i; }).get();
+        int64_t asyncAllocs = numAllocations - before;
+
+        // then() on a pending future runs inline when the promise is set, so the
+        // count doesn't depend on whether the pool had to start another thread
+        before = numAllocations;
+        for (int i = 0; i < N; ++i) {
+            cpromise<int> p;
+            cfuture<int> next = p.get_cfuture().then([](int x) { return x + 1; });
+            p.set_value(i);
+            (void)next.get();
+        }
+        int64_t thenAllocs = numAllocations - before;
+
+        // wait through a semaphore, pool_task handles are null in work_stealing mode.
+        // static because the last notify() may still be returning after the test ends
+        static semaphore done;
+        before = numAllocations;
+        for (int i = 0; i < N; ++i) {
+            parallel_task([i] { (void)i; done.notify(); });
+            done.wait();
+        }
+        int64_t parallelAllocs = numAllocations - before;
+
+        before = numAllocations;
+        for (int i = 0; i < N; ++i) {
+            parallel_task([p=std::make_unique<int>(i)] { (void)*p; done.notify(); });
+            done.wait();
+        }
+        int64_t uniqueAllocs = numAllocations - before;
+
+        printf("  async_task:    %.2f allocs/task\n", double(asyncAllocs) / N);
+        printf("  cpromise+then: %.2f allocs/task\n", double(thenAllocs) / N);
+        printf("  parallel_task: %.2f allocs/task\n", double(parallelAllocs) / N);
+        printf("  parallel_task with unique_ptr: %.2f allocs/task\n", double(uniqueAllocs) / N);
+        AssertThat(asyncAllocs, 3*N); // only the promise state, its result and the continuations
+        AssertThat(thenAllocs, 7*N); // both promises and the stored continuation, the first then() needs no vector
+        AssertThat(parallelAllocs, 0); // the task lambda is stored inline
+        AssertThat(uniqueAllocs, N); // only the unique_ptr, no shared_ptr wrapper
+    }
+
     ////////////////////////////////////////////////////
 
     static void event_func(Data a)
@@ -330,6 +546,28 @@ TestImpl(test_delegate)
         AssertThat(count, 2);
     }
 
+    TestCase(multicast_inline_functors)
+    {
+        // growing and removing must move the inline functors instead of copying their bytes
+        int count = 0;
+        multicast_delegate<Data> evt;
+        multicast_delegate<Data>::deleg handlers[10];
+        for (int i = 0; i < 10; ++i)
+        {
+            handlers[i] = [&count, x=data](Data a) { ++count; validate("evt", a, x); };
+            evt += handlers[i];
+        }
+        evt(data);
+        AssertThat(count, 10);
+
+        evt.add([&count](Data) { count += 100; });
+        evt -= evt.begin()[3];
+        AssertThat(evt.size(), 10);
+        count = 0;
+        evt(data);
+        AssertThat(count, 109);
+    }
+
     TestCase(std_function_args)
     {
         std::function<void(Data, Data&, const Data&, Data&&)> fun =
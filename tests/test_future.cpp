@@ -1,5 +1,6 @@
 #include <rpp/future.h>
 #include <rpp/tests.h>
+#include <rpp/timer.h>
 using namespace rpp;
 using namespace std::chrono_literals;
 using namespace std::this_thread;
@@ -322,4 +323,206 @@ TestImpl(test_future)
         AssertThat(tasks[1], "future stringB"s);
         AssertThat(tasks[2], "future stringC"s);
     }
-};
\ No newline at end of file
+
+    TestCase(non_blocking_continuations)
+    {
+        cpromise<int> p;
+        cfuture<int> source = p.get_cfuture();
+        const int threadsBefore = thread_pool::global().total_tasks();
+
+        vector<cfuture<int>> chains;
+        for (int i = 0; i < 100; ++i)
+        {
+            cfuture<int> chain = cfuture<int>{source}.then([](int x) { return x + 1; });
+            for (int stage = 0; stage < 9; ++stage)
+                chain = chain.then([](int x) { return x + 1; });
+            chains.emplace_back(move(chain));
+        }
+        // pending continuations don't park any pool threads
+        AssertThat(thread_pool::global().total_tasks(), threadsBefore);
+
+        p.set_value(1);
+        for (cfuture<int>& chain : chains)
+            AssertThat(chain.get(), 11);
+    }
+
+    TestCase(long_continuation_chain)
+    {
+        // completing the source must not recurse through the whole chain on one stack
+        cpromise<int> p;
+        cfuture<int> chain = p.get_cfuture();
+        constexpr int N = 100000;
+        for (int i = 0; i < N; ++i)
+            chain = chain.then([](int x) { return x + 1; });
+        p.set_value(0);
+        AssertThat(chain.get(), N);
+    }
+
+    TestCase(throwing_on_ready_callback)
+    {
+        cpromise<int> p;
+        cfuture<int> f = p.get_cfuture();
+        atomic_int called {0};
+        f.on_ready([&] { ++called; throw runtime_error("callback failed"); });
+        f.on_ready([&] { ++called; }); // still runs after the throwing one
+        p.set_value(1);
+        AssertThat((int)called, 2);
+        AssertThat(f.get(), 1);
+    }
+
+    TestCase(continuation_after_completion)
+    {
+        cfuture<string> ready = make_ready_future("ready"s);
+        cfuture<string> result = ready.then([](string s) { return s + "!"; });
+        AssertThat(result.get(), "ready!"s);
+
+        bool called = false;
+        cfuture<void> chained = async_task([]{ return 42; })
+            .then([](int x) { return x * 2; })
+            .then([&](int x) { called = x == 84; });
+        chained.get();
+        AssertThat(called, true);
+    }
+
+    TestCase(continuation_exceptions)
+    {
+        cfuture<int> failed = async_task([]() -> int { throw runtime_error("failed"); })
+            .then([](int x) { return x + 1; }); // skipped
+        cfuture<int> handled = failed.then([](int x) { return x; },
+                                           [](runtime_error&) { return -1; });
+        AssertThat(handled.get(), -1);
+
+        cfuture<int> broken;
+        { cpromise<int> abandoned;
+            broken = abandoned.get_cfuture().then([](int x) { return x; });
+        }
+        bool brokenPromise = false;
+        try { (void)broken.get(); }
+        catch (const std::future_error& e) { brokenPromise = e.code() == std::future_errc::broken_promise; }
+        AssertThat(brokenPromise, true);
+    }
+
+    TestCase(when_all_vector)
+    {
+        vector<cpromise<int>> promises(8);
+        vector<cfuture<int>> futures;
+        for (cpromise<int>& p : promises)
+            futures.emplace_back(p.get_cfuture());
+        const int threadsBefore = thread_pool::global().total_tasks();
+
+        cfuture<vector<int>> all = when_all(move(futures));
+        AssertThat(thread_pool::global().total_tasks(), threadsBefore);
+        AssertThat(all.wait_for(0ms) == std::future_status::ready, false);
+
+        for (int i = (int)promises.size() - 1; i >= 0; --i) // complete out of order
+            promises[i].set_value(i * 10);
+        vector<int> results = all.get();
+        AssertThat(results.size(), 8u);
+        for (int i = 0; i < 8; ++i)
+            AssertThat(results[i], i * 10);
+
+        AssertThat(when_all(vector<cfuture<int>>{}).get().size(), 0u);
+
+        atomic_int finished {0};
+        vector<cfuture<void>> voids;
+        for (int i = 0; i < 4; ++i)
+            voids.emplace_back(async_task([&] { ::sleep_for(1ms); ++finished; }));
+        when_all(move(voids)).get();
+        AssertThat((int)finished, 4);
+    }
+
+    TestCase(when_all_tuple)
+    {
+        cfuture<std::tuple<int, string, double>> all = when_all(
+            async_task([] { ::sleep_for(5ms); return 42; }),
+            make_ready_future("answer"s),
+            async_task([] { return 0.5; }));
+        auto [i, s, d] = all.get();
+        AssertThat(i, 42);
+        AssertThat(s, "answer"s);
+        AssertThat(d, 0.5);
+    }
+
+    TestCase(when_all_exceptions)
+    {
+        cfuture<vector<int>> all = when_all(vector<cfuture<int>>{
+            async_task([] { ::sleep_for(5ms); return 1; }),
+            async_task([]() -> int { throw runtime_error("second failed"); }),
+        });
+        string error;
+        try { (void)all.get(); }
+        catch (const runtime_error& e) { error = e.what(); }
+        AssertThat(error, "second failed"s);
+    }
+
+    TestCase(when_any_first)
+    {
+        vector<cfuture<int>> mirrors;
+        mirrors.emplace_back(async_task([] { ::sleep_for(50ms); return 1; }));
+        mirrors.emplace_back(async_task([] { return 2; }));
+        mirrors.emplace_back(async_task([] { ::sleep_for(50ms); return 3; }));
+
+        size_t fastest = when_any(mirrors).get();
+        AssertThat(fastest, 1u);
+        AssertThat(mirrors[fastest].get(), 2);
+
+        vector<cfuture<void>> failing;
+        failing.emplace_back(async_task([] { throw runtime_error("fails first"); }));
+        size_t failedFirst = when_any(failing).get();
+        AssertThat(failedFirst, 0u);
+
+        bool invalid = false;
+        try { (void)when_any(vector<cfuture<int>>{}).get(); }
+        catch (const std::invalid_argument&) { invalid = true; }
+        AssertThat(invalid, true);
+        when_all(move(mirrors)).get(); // don't leave tasks running past the test
+    }
+
+    TestCase(cancelled_async_task)
+    {
+        cancellation_source source;
+        atomic_bool started { false };
+        atomic_bool release { false };
+        cfuture<int> running = async_task([&] {
+            started = true;
+            while (!release) ::yield();
+            return 42;
+        }, source.token());
+        while (!started) ::yield();
+
+        source.cancel();
+        cfuture<int> skipped = async_task([] { return 1; }, source.token());
+        bool wasCancelled = false;
+        try { (void)skipped.get(); }
+        catch (const task_cancelled&) { wasCancelled = true; }
+        AssertThat(wasCancelled, true);
+
+        release = true; // tasks which already started are not interrupted
+        AssertThat(running.get(), 42);
+
+        cancellation_token token = source.token();
+        cfuture<void> cooperative = async_task([token] {
+            token.throw_if_cancelled();
+        });
+        wasCancelled = false;
+        try { cooperative.get(); }
+        catch (const task_cancelled&) { wasCancelled = true; }
+        AssertThat(wasCancelled, true);
+    }
+
+    TestCase(async_task_after)
+    {
+        Timer timer;
+        cfuture<string> delayed = async_task_after(10ms, [] { return "delayed"s; });
+        AssertThat(delayed.get(), "delayed"s);
+        AssertThat(timer.elapsed_ms() >= 9.0, true);
+
+        cancellation_source source;
+        cfuture<int> cancelled = async_task_after(10ms, [] { return 1; }, source.token());
+        source.cancel();
+        bool wasCancelled = false;
+        try { (void)cancelled.get(); }
+        catch (const task_cancelled&) { wasCancelled = true; }
+        AssertThat(wasCancelled, true);
+    }
+};
@@ -0,0 +1,131 @@
+#include <rpp/lean_future.h>
+#include <rpp/future.h>
+#include <rpp/timer.h>
+#include <rpp/tests.h>
+#include "alloc_counter.h"
+using namespace rpp;
+using namespace std::chrono_literals;
+using namespace std::this_thread;
+using std::runtime_error;
+
+TestImpl(test_lean_future)
+{
+    TestInit(test_lean_future)
+    {
+    }
+
+    TestCase(promise_and_future)
+    {
+        lean_promise<string> p;
+        lean_future<string> f = p.get_future();
+        AssertThat(f.valid(), true);
+        AssertThat(f.is_ready(), false);
+        std::thread producer { [&] {
+            ::sleep_for(5ms);
+            p.set_value("lean");
+        }};
+        AssertThat(f.get(), "lean"s);
+        AssertThat(f.valid(), false); // consumed
+        producer.join();
+
+        lean_promise<void> v;
+        lean_future<void> vf = v.get_future();
+        v.set_value();
+        AssertThat(vf.is_ready(), true);
+        vf.get();
+    }
+
+    TestCase(lean_async_chaining)
+    {
+        lean_future<int> length = lean_async([] {
+            ::sleep_for(2ms);
+            return "future string"s;
+        }).then([](string s) {
+            return (int)s.size();
+        }).then([](int len) {
+            return len * 2;
+        });
+        AssertThat(length.get(), 26);
+
+        // continuations on a finished future run immediately
+        lean_promise<int> p;
+        lean_future<int> ready = p.get_future();
+        p.set_value(41);
+        AssertThat(ready.then([](int x) { return x + 1; }).get(), 42);
+
+        atomic_bool called { false };
+        lean_async([] { return 1; }).continue_with([&](int x) { called = x == 1; });
+        while (!called) ::yield();
+
+        // big captures fall back to the heap, but still work
+        char big[256] = "big capture";
+        lean_future<string> copied = lean_async([big] { return string{big}; });
+        AssertThat(copied.get(), "big capture"s);
+    }
+
+    TestCase(lean_exceptions)
+    {
+        lean_future<int> failed = lean_async([]() -> int { throw runtime_error("failed"); })
+            .then([](int x) { return x + 1; }); // skipped
+        string error;
+        try { (void)failed.get(); }
+        catch (const runtime_error& e) { error = e.what(); }
+        AssertThat(error, "failed"s);
+
+        lean_future<int> abandoned;
+        { lean_promise<int> p;
+            abandoned = p.get_future();
+        }
+        bool brokenPromise = false;
+        try { (void)abandoned.get(); }
+        catch (const std::future_error& e) { brokenPromise = e.code() == std::future_errc::broken_promise; }
+        AssertThat(brokenPromise, true);
+    }
+
+    TestCase(state_freed_during_thread_exit)
+    {
+        int64_t value = 0;
+        std::thread worker { [&] {
+            // constructed before the state pool's thread cache, so it's destroyed after it
+            static thread_local lean_future<int> last;
+            lean_promise<int> p;
+            last = p.get_future();
+            p.set_value(42);
+            value = last.is_ready() ? 42 : 0;
+        }}; // `last` frees its state after the thread cache is gone
+        worker.join();
+        AssertThat(value, 42);
+    }
+
+    template<class Func> static double measure(const char* name, int iterations, Func&& roundTrip)
+    {
+        for (int i = 0; i < 100; ++i) // warm up thread pool and state pools
+            roundTrip(i);
+        int64_t allocsBefore = numAllocations;
+        Timer timer;
+        for (int i = 0; i < iterations; ++i)
+            roundTrip(i);
+        double elapsed = timer.elapsed();
+        double allocs = double(numAllocations - allocsBefore) / iterations;
+        printf("  %-26s %6.2f allocs/task  %6.2f us/task\n",
+               name, allocs, elapsed * 1'000'000 / iterations);
+        return allocs;
+    }
+
+    TestCase(allocations_and_latency)
+    {
+        constexpr int N = 20000;
+        double cfutureAllocs = measure("cfuture async_task+then", N, [](int i) {
+            int r = async_task([i] { return i; }).then([](int x) { return x + 1; }).get();
+            if (r != i + 1) throw runtime_error("unexpected result");
+        });
+        double leanAllocs = measure("lean_future lean_async+then", N, [](int i) {
+            int r = lean_async([i] { return i; }).then([](int x) { return x + 1; }).get();
+            if (r != i + 1) throw runtime_error("unexpected result");
+        });
+        measure("cfuture async_task", N, [](int i) { (void)async_task([i] { return i; }).get(); });
+        measure("lean_future lean_async", N, [](int i) { (void)lean_async([i] { return i; }).get(); });
+        AssertThat(leanAllocs < cfutureAllocs, true);
+        AssertThat(leanAllocs < 0.1, true);
+    }
+};
@@ -1,5 +1,11 @@
 #include <rpp/memory_pool.h>
 #include <rpp/tests.h>
+#include <rpp/timer.h> // performance measurement
+#include <rpp/thread_pool.h> // scratch arenas on workers
+#include <list>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
 using namespace std::literals;
 
 struct TestObject
@@ -149,4 +155,485 @@ TestImpl(memory_pool)
         for (int i = 0; i < 10; ++i)
             AssertThat(strings[i], "hello");
     }
+    TestCase(object_pool)
+    {
+        rpp::object_pool<TestObject> pool { 4 };
+        AssertThat(pool.capacity(), 0ul);
+
+        TestObject* a = pool.construct("A"s, 1.0f);
+        TestObject* b = pool.construct();
+        AssertThat(a->Name, "A");
+        AssertThat(b->Name, "DefaultName");
+        AssertThat(pool.capacity(), 4ul);
+        AssertThat(pool.size(), 2ul);
+
+        pool.destruct(a);
+        TestObject* c = pool.construct("C"s, 3.0f);
+        AssertThat(c, a); // the last freed slot is reused first
+        AssertThat(pool.size(), 2ul);
+
+        // grows in chunks of 4 and reuses every freed slot
+        std::vector<TestObject*> objects;
+        for (int i = 0; i < 100; ++i)
+            objects.push_back(pool.construct(std::to_string(i), float(i)));
+        AssertThat(pool.capacity(), 104ul);
+        AssertThat(objects[99]->Name, "99");
+        for (TestObject* obj : objects) pool.destruct(obj);
+        for (TestObject*& obj : objects) obj = pool.construct();
+        AssertThat(pool.capacity(), 104ul);
+        for (TestObject* obj : objects) pool.destruct(obj);
+        pool.destruct(b);
+        pool.destruct(c);
+        AssertThat(pool.size(), 0ul);
+    }
+
+    TestCase(object_pool_huge_pages)
+    {
+        // falls back to normal pages if huge pages are not available
+        rpp::object_pool<double> pool { 1000, /*hugePages*/true };
+        double* d = pool.construct(42.0);
+        AssertThat(*d, 42.0);
+        AssertThat(pool.capacity(), rpp::huge_page_size / sizeof(double));
+        for (size_t i = 1; i < pool.capacity(); ++i)
+            *pool.allocate() = double(i);
+        AssertThat(pool.capacity(), rpp::huge_page_size / sizeof(double));
+    }
+
+    TestCase(pool_allocator)
+    {
+        // request-scoped containers backed by a linear pool
+        rpp::linear_dynamic_pool scratch { 64*1024 };
+        {
+            std::vector<std::string, rpp::pool_allocator<std::string, rpp::linear_dynamic_pool>> items { scratch };
+            for (int i = 0; i < 100; ++i)
+                items.emplace_back(std::to_string(i));
+            AssertThat(items.size(), 100ul);
+            AssertThat(items[99], "99");
+            AssertThat(scratch.available() < 64*1024, true);
+        }
+
+        // long lived node containers backed by the slab pool
+        rpp::slab_pool slabs;
+        {
+            using alloc = rpp::pool_allocator<std::pair<const int, std::string>, rpp::slab_pool>;
+            std::unordered_map<int, std::string, std::hash<int>, std::equal_to<int>, alloc> map { alloc{slabs} };
+            for (int i = 0; i < 1000; ++i)
+                map.emplace(i, std::to_string(i));
+            AssertThat(map.at(500), "500");
+            AssertThat(slabs.capacity() > 0, true);
+            for (int i = 0; i < 1000; i += 2)
+                map.erase(i);
+            AssertThat(map.size(), 500ul);
+        }
+
+        // list nodes fit into the object pool slots, anything bigger uses the heap
+        rpp::object_pool<std::aligned_storage_t<32, 16>> nodes { 64 };
+        {
+            std::list<int, rpp::pool_allocator<int, decltype(nodes)>> list { nodes };
+            for (int i = 0; i < 200; ++i)
+                list.push_back(i);
+            AssertThat(nodes.size(), 200ul);
+            list.remove_if([](int i) { return i % 2 == 0; });
+            AssertThat(nodes.size(), 100ul);
+        }
+        AssertThat(nodes.size(), 0ul);
+    }
+
+    TestCase(arena_mark_and_rewind)
+    {
+        rpp::arena arena { 1024, 2.0f, 4096 };
+        AssertThat(arena.capacity(), 0ul); // first block is reserved lazily
+
+        TestObject* first = arena.construct<TestObject>("First"s, 1.0f);
+        AssertThat(first->Name, "First");
+        AssertThat(arena.num_blocks(), 1);
+
+        rpp::arena::marker m = arena.mark();
+        void* a = arena.allocate(100, 16);
+        AssertThat(size_t(a) % 16, 0ul);
+        arena.rewind(m);
+        AssertThat(arena.allocate(100, 16), a); // same memory again
+        arena.rewind(m);
+
+        // fill several blocks, growth stops at maxBlockSize
+        for (int i = 0; i < 100; ++i)
+            (void)arena.allocate(300);
+        int blocks = arena.num_blocks();
+        size_t capacity = arena.capacity();
+        AssertThat(blocks > 3, true);
+        arena.rewind(m);
+        AssertThat(first->Name, "First"); // allocations before the mark are untouched
+
+        // blocks are retained and reused after rewind
+        for (int i = 0; i < 100; ++i)
+            (void)arena.allocate(300);
+        AssertThat(arena.num_blocks(), blocks);
+        AssertThat(arena.capacity(), capacity);
+
+        arena.reset();
+        AssertThat(arena.allocate(8), (void*)first);
+        AssertThat(arena.num_blocks(), blocks);
+    }
+
+    TestCase(arena_oversized_allocations)
+    {
+        rpp::arena arena { 1024 };
+        (void)arena.allocate(16);
+        rpp::arena::marker m = arena.mark();
+
+        // never returns nullptr for big requests, they get a dedicated block
+        char* big = (char*)arena.allocate(100'000, 64);
+        AssertNotEqual(big, nullptr);
+        AssertThat(size_t(big) % 64, 0ul);
+        big[99'999] = 'x';
+        AssertThat(arena.num_dedicated(), 1);
+        AssertThat(arena.num_blocks(), 1);
+
+        { rpp::arena::scope scope { arena };
+            (void)arena.allocate(50'000);
+            AssertThat(arena.num_dedicated(), 2);
+        }
+        AssertThat(arena.num_dedicated(), 1);
+        arena.rewind(m);
+        AssertThat(arena.num_dedicated(), 0);
+        AssertThat(arena.capacity(), 1024ul);
+    }
+
+    TestCase(scratch_arena_on_workers)
+    {
+        rpp::thread_pool pool { rpp::pool_mode::work_stealing, 4 };
+        std::atomic_int ok { 0 };
+        pool.parallel_for(0, 1000, [&](int start, int end)
+        {
+            for (int i = start; i < end; ++i)
+            {
+                rpp::arena& tmp = rpp::scratch_arena();
+                rpp::arena::scope scope { tmp };
+                int* values = tmp.construct_array<int>(256, i);
+                if (values[255] == i) ++ok;
+            }
+        }, rpp::parallel_schedule::dynamic, 1);
+        AssertThat((int)ok, 1000);
+
+        // every thread has its own arena
+        rpp::arena* mine = &rpp::scratch_arena();
+        rpp::arena* other = nullptr;
+        std::thread t { [&] { other = &rpp::scratch_arena(); } };
+        t.join();
+        AssertThat(mine != other, true);
+    }
+
+    TestCase(linear_pool_64bit_sizes)
+    {
+        // bigger than 2GB, pages are only mapped when they're touched
+        const int64_t size = 3LL * 1024 * 1024 * 1024;
+        rpp::linear_static_pool pool { size, rpp::pool_backing::pages };
+        AssertThat(pool.capacity(), size);
+
+        char* big = (char*)pool.allocate(size - 4096);
+        AssertNotEqual(big, nullptr);
+        big[0] = 'a';
+        big[size - 4097] = 'z';
+        AssertThat(pool.available(), 4096LL);
+
+        rpp::linear_dynamic_pool dynamic { 1LL << 31, 2.0f, rpp::pool_backing::pages };
+        AssertNotEqual(dynamic.allocate(3LL << 30), nullptr); // the next block is 4GB
+        AssertThat(dynamic.capacity(), (1LL << 31) + (1LL << 32));
+    }
+
+    TestCase(huge_page_pools)
+    {
+        // works with or without huge page support, falling back to normal pages
+        rpp::linear_static_pool pool { 8*1024*1024, rpp::pool_backing::huge_pages, /*prefault*/true };
+        AssertThat(pool.backing() == rpp::pool_backing::huge_pages, true);
+        auto* values = pool.construct_array<int64_t>(1024*1024, 7);
+        AssertNotEqual(values, nullptr);
+        AssertThat(values[1024*1024 - 1], 7LL);
+
+        rpp::arena arena { 4*1024*1024, 2.0f, 64*1024*1024, rpp::pool_backing::huge_pages };
+        rpp::arena::scope scope { arena };
+        AssertNotEqual(arena.allocate(1024*1024), nullptr);
+    }
+
+    // average nanoseconds per dependent random read, which is dominated by cache and TLB misses
+    static double random_access_ns(const uint64_t* data, size_t count, int reads)
+    {
+        uint64_t x = 88172645463325252ULL, sum = 0;
+        rpp::Timer timer;
+        for (int i = 0; i < reads; ++i)
+        {
+            x ^= x << 13; x ^= x >> 7; x ^= x << 17; // xorshift64
+            sum += data[(x + sum) % count];
+        }
+        double ns = timer.elapsed() * 1e9 / reads;
+        if (sum == 42) printf("unlikely\n"); // keep the loop
+        return ns;
+    }
+
+    TestCase(huge_page_tlb_benchmark)
+    {
+        constexpr size_t bytes = 512*1024*1024;
+        constexpr size_t count = bytes / sizeof(uint64_t);
+        const std::pair<rpp::pool_backing, const char*> backings[] = {
+            { rpp::pool_backing::heap,       "heap      " },
+            { rpp::pool_backing::pages,      "pages     " },
+            { rpp::pool_backing::huge_pages, "huge_pages" },
+        };
+        for (auto [backing, name] : backings)
+        {
+            rpp::Timer fault;
+            rpp::linear_static_pool pool { bytes, backing, /*prefault*/true };
+            double prefaultMs = fault.elapsed() * 1000;
+            auto* data = (uint64_t*)pool.allocate(bytes - 64, 64);
+            if (!AssertNotEqual(data, nullptr)) break;
+            for (size_t i = 0; i < count - 8; i += 512) data[i] = i;
+            printf("  %s  prefault 512MB %6.1fms   random read %6.2fns\n",
+                   name, prefaultMs, random_access_ns(data, count - 8, 4'000'000));
+        }
+    }
+
+    TestCase(pool_statistics)
+    {
+        using rpp::memory_pool_stats;
+        AssertThat(memory_pool_stats::size_class(1), 0);
+        AssertThat(memory_pool_stats::size_class(16), 0);
+        AssertThat(memory_pool_stats::size_class(17), 1);
+        AssertThat(memory_pool_stats::size_class(1ULL << 40), memory_pool_stats::num_size_classes - 1);
+
+        // without a policy the pools carry no extra state
+        static_assert(sizeof(rpp::linear_static_pool) == sizeof(rpp::basic_linear_static_pool<rpp::no_pool_stats>));
+
+        rpp::basic_linear_dynamic_pool<rpp::counting_pool_stats> pool { 256, 2.0f };
+        (void)pool.allocate(1, 1);
+        (void)pool.allocate(8, 8); // 7 bytes of padding
+        (void)pool.allocate(100);
+        (void)pool.allocate(200); // needs a second block
+        memory_pool_stats s = pool.stats();
+        AssertThat(s.allocations, 4ull);
+        AssertThat(s.bytes_allocated, 309ull);
+        AssertThat(s.alignment_waste >= 7, true);
+        AssertThat(s.blocks, 2ull);
+        AssertThat(s.block_bytes, 256ull + 512ull);
+        AssertThat(s.count_by_class[0], 2ull);
+        AssertThat(s.count_by_class[memory_pool_stats::size_class(100)], 1ull);
+        AssertThat(s.bytes_by_class[memory_pool_stats::size_class(200)], 200ull);
+
+        rpp::basic_arena<rpp::counting_pool_stats> arena { 1024 };
+        (void)arena.allocate(100);
+        { rpp::basic_arena<rpp::counting_pool_stats>::scope scope { arena };
+            (void)arena.allocate(300);
+            (void)arena.allocate(10'000); // dedicated
+            AssertThat(arena.stats().bytes_in_use, 10'400ull);
+            AssertThat(arena.stats().blocks, 2ull);
+        }
+        memory_pool_stats a = arena.stats();
+        AssertThat(a.bytes_in_use, 100ull);
+        AssertThat(a.peak_bytes_in_use, 10'400ull);
+        AssertThat(a.blocks, 1ull);
+        AssertThat(a.allocations, 3ull);
+
+        rpp::object_pool<TestObject, rpp::counting_pool_stats> objects { 16 };
+        TestObject* o1 = objects.construct();
+        TestObject* o2 = objects.construct();
+        objects.destruct(o1);
+        memory_pool_stats o = objects.stats();
+        AssertThat(o.allocations, 2ull);
+        AssertThat(o.deallocations, 1ull);
+        AssertThat(o.bytes_in_use, (unsigned long long)sizeof(TestObject));
+        AssertThat(o.peak_bytes_in_use, 2ull * sizeof(TestObject));
+        AssertThat(o.blocks, 1ull);
+        objects.destruct(o2);
+
+        rpp::slab_pool slabs;
+        slabs.deallocate(slabs.allocate(32));
+        AssertThat(slabs.stats().blocks, 1ull);
+        AssertThat(slabs.stats().block_bytes, (unsigned long long)rpp::slab_pool::slab_size);
+        AssertThat(slabs.stats().allocations, 0ull); // not recorded without a policy
+
+        // slab pools are shared between threads, so their stats are atomic
+        rpp::basic_slab_pool<rpp::concurrent_pool_stats> tracked;
+        void* small = tracked.allocate(30); // rounded up to the 32 byte class
+        void* big = tracked.allocate(40'000); // dedicated block
+        std::thread other { [&] { tracked.deallocate(tracked.allocate(100)); } };
+        other.join();
+        memory_pool_stats t = tracked.stats();
+        AssertThat(t.allocations, 3ull);
+        AssertThat(t.deallocations, 1ull);
+        AssertThat(t.bytes_in_use, 32ull + 40'000ull); // a leak check would find these two
+        AssertThat(t.peak_bytes_in_use, 32ull + 40'000ull + 112ull);
+        AssertThat(t.count_by_class[memory_pool_stats::size_class(32)], 1ull);
+        AssertThat(t.bytes_by_class[memory_pool_stats::size_class(40'000)], 40'000ull);
+        AssertThat(t.blocks, 3ull);
+        tracked.deallocate(small);
+        tracked.deallocate(big);
+        AssertThat(tracked.stats().bytes_in_use, 0ull);
+        AssertThat(tracked.stats().blocks, 2ull);
+    }
+
+    TestCase(slab_pool_size_classes)
+    {
+        using rpp::slab_pool;
+        AssertThat(slab_pool::size_class(1), 0);
+        AssertThat(slab_pool::size_class(16), 0);
+        AssertThat(slab_pool::size_class(17), 1);
+        AssertThat(slab_pool::size_class(128), 7);
+        AssertThat(slab_pool::size_class(129), 8);
+        AssertThat(slab_pool::size_class(256), 11);
+        AssertThat(slab_pool::size_class(257), 12);
+        AssertThat(slab_pool::class_size(12), 320ul);
+        AssertThat(slab_pool::size_class(slab_pool::max_small_size), slab_pool::num_size_classes - 1);
+        for (int c = 0; c < slab_pool::num_size_classes; ++c)
+        {
+            AssertThat(slab_pool::size_class(slab_pool::class_size(c)), c);
+            if (c > 0) AssertThat(slab_pool::size_class(slab_pool::class_size(c - 1) + 1), c);
+            AssertThat(slab_pool::batch_count(c) >= 1, true);
+        }
+    }
+
+    TestCase(slab_pool_reuse)
+    {
+        rpp::slab_pool pool;
+        AssertThat(pool.capacity(), 0ul);
+
+        void* a = pool.allocate(24);
+        AssertNotEqual(a, nullptr);
+        AssertThat(size_t(a) % 16, 0ul);
+        AssertThat(pool.capacity(), rpp::slab_pool::slab_size);
+        pool.deallocate(a);
+        AssertThat(pool.allocate(30), a); // same size class, freed objects are reused first
+
+        // a lot of objects fill more slabs, which are all reused after deallocate
+        std::vector<void*> objects;
+        for (int i = 0; i < 10000; ++i)
+            objects.push_back(pool.allocate(64));
+        size_t capacity = pool.capacity();
+        for (void* ptr : objects) pool.deallocate(ptr);
+        for (void*& ptr : objects) ptr = pool.allocate(64);
+        AssertThat(pool.capacity(), capacity);
+        for (void* ptr : objects) pool.deallocate(ptr);
+
+        // medium sizes and alignments up to 64 come from slabs too
+        void* medium = pool.allocate(4000);
+        void* aligned = pool.allocate(48, 64);
+        AssertThat(size_t(aligned) % 64, 0ul);
+        size_t slabCapacity = pool.capacity();
+        pool.deallocate(medium);
+        pool.deallocate(aligned);
+        AssertThat(pool.allocate(3900), medium);
+        AssertThat(pool.capacity(), slabCapacity); // kept for reuse
+        pool.deallocate(medium);
+
+        // huge and over-aligned allocations get dedicated blocks which are freed right away
+        void* big = pool.allocate(4000, 256);
+        AssertThat(size_t(big) % 256, 0ul);
+        AssertThat(pool.capacity() > slabCapacity, true);
+        pool.deallocate(big);
+        void* huge = pool.allocate(rpp::slab_pool::max_small_size + 1);
+        AssertThat(pool.capacity() > slabCapacity, true);
+        pool.deallocate(huge);
+        AssertThat(pool.capacity(), slabCapacity);
+        pool.deallocate(nullptr);
+    }
+
+    TestCase(slab_pool_construct)
+    {
+        rpp::slab_pool pool;
+        TestObject* obj = pool.construct<TestObject>("SlabObject"s, 5.0f);
+        AssertThat(obj->Name, "SlabObject");
+        AssertThat(obj->Value, 5.0f);
+        pool.destruct(obj);
+        TestObject* reused = pool.construct<TestObject>();
+        AssertThat(reused, obj);
+        AssertThat(reused->Name, "DefaultName");
+        pool.destruct(reused);
+    }
+
+    TestCase(slab_pool_cross_thread)
+    {
+        rpp::slab_pool pool;
+        constexpr int N = 20000;
+        std::vector<int*> items(N);
+        std::thread producer { [&] {
+            for (int i = 0; i < N; ++i)
+                items[i] = pool.construct<int>(i);
+        }}; // the producer's cache is returned to the depot when it exits
+        producer.join();
+
+        // freed on another thread, the objects flow back through the depot
+        int64_t sum = 0;
+        for (int* item : items) { sum += *item; pool.destruct(item); }
+        AssertThat(sum, int64_t(N) * (N - 1) / 2);
+        size_t capacity = pool.capacity();
+        for (int i = 0; i < N; ++i) items[i] = pool.construct<int>(i);
+        AssertThat(pool.capacity(), capacity);
+        for (int* item : items) pool.destruct(item);
+    }
+
+    TestCase(slab_pool_during_thread_exit)
+    {
+        struct exit_user
+        {
+            rpp::slab_pool* pool = nullptr;
+            void* ptr = nullptr;
+            ~exit_user() noexcept
+            {
+                if (!pool) return;
+                pool->deallocate(ptr);
+                pool->deallocate(pool->allocate(40));
+            }
+        };
+        rpp::slab_pool pool;
+        void* freedOnExit = nullptr;
+        std::thread worker { [&] {
+            // constructed before the slab thread caches, so it's destroyed after them
+            static thread_local exit_user user;
+            user.pool = &pool;
+            user.ptr = freedOnExit = pool.allocate(40);
+        }}; // `user` frees into the pool after the thread caches are gone
+        worker.join();
+
+        // the object freed during thread exit went straight back to the depot
+        void* reused = pool.allocate(40);
+        AssertThat(reused, freedOnExit);
+        pool.deallocate(reused);
+    }
+
+    // nanoseconds per allocate+deallocate pair, with batches of live objects per thread
+    template<class Alloc, class Free>
+    static double alloc_free_ns(int numThreads, size_t size, Alloc alloc, Free dealloc)
+    {
+        constexpr int Live = 256, Rounds = 400;
+        std::vector<std::thread> threads;
+        std::atomic_bool start { false };
+        for (int t = 0; t < numThreads; ++t)
+            threads.emplace_back([&] {
+                void* live[Live];
+                while (!start) std::this_thread::yield();
+                for (int r = 0; r < Rounds; ++r) {
+                    for (void*& p : live) { p = alloc(size); *(char*)p = 1; }
+                    for (void* p : live) dealloc(p);
+                }
+            });
+        rpp::Timer timer;
+        start = true;
+        for (std::thread& t : threads) t.join();
+        return timer.elapsed() * 1e9 / (double(Live) * Rounds * numThreads);
+    }
+
+    TestCase(slab_pool_vs_malloc)
+    {
+        rpp::slab_pool pool;
+        for (int numThreads : { 1, 4 })
+        {
+            for (size_t size : { 16, 32, 64, 128, 256, 1024, 8192 })
+            {
+                double slab = alloc_free_ns(numThreads, size,
+                    [&](size_t n) { return pool.allocate(n); }, [&](void* p) { pool.deallocate(p); });
+                double sys = alloc_free_ns(numThreads, size,
+                    [](size_t n) { return malloc(n); }, [](void* p) { free(p); });
+                printf("  %d threads  %4zuB  slab_pool %5.1fns  malloc %5.1fns\n",
+                       numThreads, size, slab, sys);
+            }
+        }
+    }
 };
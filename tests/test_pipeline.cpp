@@ -0,0 +1,127 @@
+#include <rpp/pipeline.h>
+#include <rpp/tests.h>
+using namespace rpp;
+using namespace std::chrono_literals;
+using namespace std::this_thread;
+using std::runtime_error;
+
+TestImpl(test_pipeline)
+{
+    TestInit(test_pipeline)
+    {
+    }
+
+    // source which produces the integers [0, count)
+    static auto counter(int count)
+    {
+        return [i = 0, count]() mutable -> std::optional<int> {
+            if (i == count) return std::nullopt;
+            return i++;
+        };
+    }
+
+    TestCase(ordered_stage_graph)
+    {
+        thread_pool pool { pool_mode::work_stealing, 4 };
+        constexpr int N = 1000;
+        atomic_int parsed {0};
+        vector<string> written;
+
+        pipeline<int> ingest { pool, 16 };
+        ingest.then(stage_mode::parallel, [](int i) {
+                  if (i % 7 == 0) ::sleep_for(100us); // uneven work reorders items
+                  return std::to_string(i);
+              })
+              .then(stage_mode::parallel, [&](string s) {
+                  ++parsed;
+                  return "#" + s;
+              })
+              .then(stage_mode::serial_in_order, [&](string s) {
+                  written.push_back(move(s)); // only one item at a time here
+              });
+        ingest.run(counter(N));
+
+        AssertThat((int)parsed, N);
+        AssertThat((int)written.size(), N);
+        for (int i = 0; i < N; ++i)
+            if (!AssertThat(written[i], "#" + std::to_string(i))) break;
+
+        // pipelines can be run again, the order is kept between runs
+        written.clear();
+        ingest.run(counter(10));
+        AssertThat((int)written.size(), 10);
+        AssertThat(written.back(), "#9"s);
+    }
+
+    TestCase(bounded_in_flight)
+    {
+        thread_pool pool { pool_mode::work_stealing, 4 };
+        atomic_int alive {0};
+        atomic_int maxAlive {0};
+        int pulled = 0;
+
+        pipeline<int> p { pool, 8 };
+        p.then(stage_mode::parallel, [&](int i) {
+             int now = ++alive;
+             for (int m = maxAlive; now > m && !maxAlive.compare_exchange_weak(m, now);) {}
+             return i;
+         })
+         .then(stage_mode::serial_in_order, [&](int) {
+             ::sleep_for(200us); // slow writer, producer must not run ahead
+             --alive;
+         });
+        p.run([&]() -> std::optional<int> {
+            if (pulled == 200) return std::nullopt;
+            return pulled++;
+        });
+        AssertThat(pulled, 200);
+        AssertThat(maxAlive <= p.capacity(), true);
+        AssertThat((int)alive, 0);
+    }
+
+    TestCase(stage_exception)
+    {
+        thread_pool pool { pool_mode::work_stealing, 4 };
+        atomic_int written {0};
+        pipeline<int> p { pool, 8 };
+        p.then(stage_mode::parallel, [](int i) {
+             if (i == 50) throw runtime_error("bad record");
+             return i;
+         })
+         .then(stage_mode::serial_in_order, [&](int) { ++written; });
+
+        string error;
+        try { p.run(counter(1000)); }
+        catch (const runtime_error& e) { error = e.what(); }
+        AssertThat(error, "bad record"s);
+        AssertThat(written < 1000, true); // the rest of the stream was dropped
+    }
+
+    TestCase(rejecting_pool)
+    {
+        // the pool refuses most drain tasks, so the stages must drain on the caller instead
+        thread_pool pool { pool_mode::work_stealing, 2 };
+        pool.set_queue_limit(1, overflow_policy::reject);
+        constexpr int N = 2000;
+        vector<int> written;
+        pipeline<int> p { pool, 32 };
+        p.then(stage_mode::parallel, [](int i) { return i * 2; })
+         .then(stage_mode::serial_in_order, [](int i) { return i + 1; })
+         .then(stage_mode::serial_in_order, [&](int i) { written.push_back(i); });
+        p.run(counter(N));
+
+        AssertThat((int)written.size(), N);
+        for (int i = 0; i < N; ++i)
+            if (!AssertThat(written[i], i * 2 + 1)) break;
+        AssertThat(pool.rejected_jobs() > 0, true);
+    }
+
+    TestCase(empty_stream)
+    {
+        bool called = false;
+        pipeline<int> p;
+        p.then(stage_mode::serial_in_order, [&](int) { called = true; });
+        p.run(counter(0));
+        AssertThat(called, false);
+    }
+};
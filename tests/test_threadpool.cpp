@@ -3,6 +3,10 @@
 #include <rpp/timer.h> // performance measurement
 #include <atomic>
 #include <unordered_set>
+#include <algorithm> // std::sort
+#if __linux__
+#  include <sched.h> // sched_getcpu
+#endif
 using namespace rpp;
 using std::mutex;
 using std::atomic;
@@ -59,6 +63,38 @@ TestImpl(test_threadpool)
         AssertThat(s, "completed");
     }
 
+    TestCase(move_only_and_borrowed_tasks)
+    {
+        semaphore sync;
+        auto owned = std::make_unique<string>("owned");
+        string* result = nullptr;
+        parallel_task([p=move(owned), &result, &sync] // no shared_ptr wrapping needed
+        {
+            result = p.get();
+            sync.notify();
+        });
+        AssertThat(sync.wait(5s), semaphore::notified);
+        AssertThat(result != nullptr, true); // freed together with the task
+
+        // rpp::delegate moves into the task, function_ref can only be borrowed by blocking calls
+        atomic_int calls {0};
+        for (pool_mode mode : { pool_mode::spawn_on_demand, pool_mode::work_stealing })
+        {
+            thread_pool pool { mode, 2 };
+            delegate<void()> work = [&] { ++calls; sync.notify(); };
+            pool.parallel_task(move(work));
+            AssertThat(sync.wait(5s), semaphore::notified);
+        }
+        AssertThat((int)calls, 2);
+
+        std::vector<int> squares(1000);
+        auto body = [&](int start, int end) {
+            for (int i = start; i < end; ++i) squares[i] = i * i;
+        };
+        parallel_for(0, (int)squares.size(), function_ref<void(int,int)>{ body });
+        AssertThat(squares[999], 999 * 999);
+    }
+
     TestCase(parallel_for_performance)
     {
         auto numbers = vector<int>(13333337);
@@ -202,4 +238,985 @@ TestImpl(test_threadpool)
         AssertThat((int)times_launched, expected);
     }
 
-};
\ No newline at end of file
+    TestCase(event_count)
+    {
+        rpp::event_count ev;
+        atomic_bool ready { false };
+        thread waiter { [&] {
+            while (!ready)
+            {
+                auto key = ev.prepare_wait();
+                if (ready) ev.cancel_wait();
+                else       ev.wait(key);
+            }
+        }};
+        ::sleep_for(5ms);
+        ready = true;
+        ev.notify_one();
+        waiter.join();
+
+        auto key = ev.prepare_wait();
+        auto start = std::chrono::steady_clock::now();
+        AssertThat(ev.wait_until(key, start + 10ms), false);
+        AssertThat(std::chrono::steady_clock::now() - start >= 10ms, true);
+    }
+
+    TestCase(semaphore_semantics)
+    {
+        semaphore sem { 2 };
+        AssertThat(sem.count(), 2);
+        AssertThat(sem.try_wait(), true);
+        AssertThat(sem.try_wait(), true);
+        AssertThat(sem.try_wait(), false);
+        AssertThat(sem.wait(5ms), semaphore::timeout);
+
+        AssertThat(sem.notify_once(), true);
+        AssertThat(sem.notify_once(), false); // already signaled
+        AssertThat(sem.count(), 1);
+        AssertThat(sem.wait(5ms), semaphore::notified);
+
+        // parked waiters are woken by notify()
+        atomic_int woken { 0 };
+        vector<thread> waiters;
+        for (int i = 0; i < 4; ++i)
+            waiters.emplace_back([&] { sem.wait(); ++woken; });
+        ::sleep_for(5ms);
+        for (int i = 0; i < 4; ++i) sem.notify();
+        for (thread& t : waiters) t.join();
+        AssertThat((int)woken, 4);
+        AssertThat(sem.count(), 0);
+
+        thread late { [&] { ::sleep_for(5ms); sem.reset(1); }};
+        AssertThat(sem.wait(5s), semaphore::notified);
+        late.join();
+    }
+
+    // the previous semaphore: mutex + condition_variable on every call
+    struct condvar_semaphore
+    {
+        mutex m;
+        condition_variable cv;
+        int value = 0;
+        void notify()
+        {
+            { lock_guard<mutex> lock{m}; ++value; }
+            cv.notify_one();
+        }
+        void wait()
+        {
+            unique_lock<mutex> lock{m};
+            while (value <= 0) cv.wait(lock);
+            --value;
+        }
+    };
+
+    // round trips per second between two threads signaling each other
+    template<class Semaphore> static double ping_pong(int iterations)
+    {
+        Semaphore ping, pong;
+        thread echo { [&] {
+            for (int i = 0; i < iterations; ++i) { ping.wait(); pong.notify(); }
+        }};
+        rpp::Timer timer;
+        for (int i = 0; i < iterations; ++i) { ping.notify(); pong.wait(); }
+        double elapsed = timer.elapsed();
+        echo.join();
+        return iterations / elapsed;
+    }
+
+    TestCase(semaphore_performance)
+    {
+        constexpr int N = 50'000;
+        printf("ping-pong  semaphore %.0f/s  condvar %.0f/s\n",
+               ping_pong<semaphore>(N), ping_pong<condvar_semaphore>(N));
+
+        // uncontended notify+wait never leaves the fast path
+        semaphore sem;
+        rpp::Timer timer;
+        for (int i = 0; i < 1'000'000; ++i) { sem.notify(); sem.wait(); }
+        printf("uncontended notify+wait  %.2fns\n", timer.elapsed() * 1'000'000'000 / 1'000'000);
+        AssertThat(sem.count(), 0);
+    }
+
+    // the previous pool_task handoff: mutex + condition_variable on both sides
+    struct condvar_handoff
+    {
+        mutex m;
+        condition_variable cv;
+        task_delegate<void()> task;
+        bool running = true;
+        bool busy = false;
+        thread th { [this] {
+            unique_lock<mutex> lock{m};
+            for (;;)
+            {
+                while (running && !task) cv.wait(lock);
+                if (!running) return;
+                auto t = std::move(task);
+                task = {};
+                t();
+                busy = false;
+                cv.notify_all();
+            }
+        }};
+        ~condvar_handoff()
+        {
+            { lock_guard<mutex> lock{m}; running = false; }
+            cv.notify_all();
+            th.join();
+        }
+        void run(task_delegate<void()>&& t)
+        {
+            { lock_guard<mutex> lock{m}; task = std::move(t); busy = true; }
+            cv.notify_one();
+        }
+        void wait()
+        {
+            unique_lock<mutex> lock{m};
+            while (busy) cv.wait(lock);
+        }
+    };
+
+    // median submit-to-start latency in microseconds
+    template<class Submit, class Wait>
+    static double handoff_latency(int iterations, int pauseMicros, Submit submit, Wait wait)
+    {
+        using clock = std::chrono::steady_clock;
+        vector<double> latencies;
+        for (int i = 0; i < iterations; ++i)
+        {
+            if (pauseMicros) ::sleep_for(std::chrono::microseconds(pauseMicros));
+            clock::time_point started;
+            clock::time_point submitted = clock::now();
+            submit([&] { started = clock::now(); });
+            wait();
+            latencies.push_back(std::chrono::duration<double, std::micro>(started - submitted).count());
+        }
+        std::sort(latencies.begin(), latencies.end());
+        return latencies[latencies.size() / 2];
+    }
+
+    TestCase(pool_task_wakeup_latency)
+    {
+        pool_task task;
+        condvar_handoff reference;
+        auto submitTask = [&](auto&& f) { task.run_generic(f); };
+        auto submitRef  = [&](auto&& f) { reference.run(f); };
+        auto waitTask = [&] { task.wait(); };
+        auto waitRef  = [&] { reference.wait(); };
+
+        // back-to-back tasks hit the spinning worker, paused ones wake it from the futex
+        double hotTask = handoff_latency(2000, 0, submitTask, waitTask);
+        double hotRef  = handoff_latency(2000, 0, submitRef, waitRef);
+        double coldTask = handoff_latency(200, 500, submitTask, waitTask);
+        double coldRef  = handoff_latency(200, 500, submitRef, waitRef);
+        printf("submit-to-start median   back-to-back: eventcount %.2fus  condvar %.2fus\n", hotTask, hotRef);
+        printf("submit-to-start median  after parking: eventcount %.2fus  condvar %.2fus\n", coldTask, coldRef);
+    }
+
+    TestCase(work_stealing_tasks)
+    {
+        constexpr int numTasks = 10000;
+        atomic_int completed {0};
+        semaphore allDone;
+        thread_pool pool { pool_mode::work_stealing };
+        for (int i = 0; i < numTasks; ++i)
+        {
+            pool_task* task = pool.parallel_task([&] {
+                if (++completed == numTasks) allDone.notify();
+            });
+            AssertThat(task, nullptr); // work-stealing jobs are not bound to a pool_task
+        }
+        AssertThat(allDone.wait(5s), semaphore::notified);
+        AssertThat(pool.worker_count(), thread_pool::physical_cores());
+        AssertThat(pool.queued_jobs(), 0);
+    }
+
+    TestCase(work_stealing_wait_for_task)
+    {
+        // work-stealing jobs have no pool_task handle, callers which need to wait
+        // must signal completion from the task itself
+        semaphore done; // outlives the pool, notify() may still be returning when wait() wakes up
+        thread_pool pool { pool_mode::work_stealing, 2 };
+        for (int i = 0; i < 100; ++i)
+        {
+            int result = 0;
+            pool_task* task = pool.parallel_task([&, i] { result = i * 2; done.notify(); });
+            if (task) task->wait(); // never taken in this mode, but safe in both
+            else AssertThat(done.wait(5s), semaphore::notified);
+            if (!AssertThat(result, i * 2)) break;
+        }
+
+        // the same code keeps working when the pool switches back to spawn_on_demand
+        pool.set_mode(pool_mode::spawn_on_demand);
+        int result = 0;
+        pool_task* task = pool.parallel_task([&] { result = 42; });
+        AssertThat(task != nullptr, true);
+        task->wait();
+        AssertThat(result, 42);
+    }
+
+    TestCase(work_stealing_nested_tasks)
+    {
+        // jobs spawned from a worker go to its local deque and get stolen by idle peers
+        constexpr int numOuter = 100, numInner = 100;
+        atomic_int completed {0};
+        semaphore allDone;
+        thread_pool pool { pool_mode::work_stealing, 4 };
+        for (int i = 0; i < numOuter; ++i)
+        {
+            pool.parallel_task([&] {
+                for (int j = 0; j < numInner; ++j)
+                    pool.parallel_task([&] {
+                        if (++completed == numOuter*numInner) allDone.notify();
+                    });
+            });
+        }
+        AssertThat(allDone.wait(5s), semaphore::notified);
+        AssertThat(pool.total_tasks(), 4); // no extra threads were spawned
+    }
+
+    static double measure_tiny_tasks(thread_pool& pool, int numTasks)
+    {
+        static atomic_int completed;
+        completed = 0;
+        Timer timer;
+        for (int i = 0; i < numTasks; ++i)
+            pool.parallel_task([] { ++completed; });
+        while (completed != numTasks)
+            std::this_thread::yield();
+        return timer.elapsed();
+    }
+
+    TestCase(work_stealing_performance)
+    {
+        constexpr int numTasks = 20000;
+        thread_pool spawning;
+        thread_pool stealing { pool_mode::work_stealing };
+        double spawnTime = measure_tiny_tasks(spawning, numTasks);
+        double stealTime = measure_tiny_tasks(stealing, numTasks);
+        printf("spawn_on_demand elapsed: %.3fs  threads: %d\n", spawnTime, spawning.total_tasks());
+        printf("work_stealing   elapsed: %.3fs  threads: %d\n", stealTime, stealing.total_tasks());
+    }
+
+    TestCase(work_stealing_mode_switch)
+    {
+        atomic_int completed {0};
+        thread_pool pool { pool_mode::work_stealing, 2 };
+        for (int i = 0; i < 1000; ++i)
+            pool.parallel_task([&] { ++completed; });
+
+        pool.set_mode(pool_mode::spawn_on_demand); // drains all queued jobs
+        AssertThat((int)completed, 1000);
+        AssertThat(pool.worker_count(), 0);
+
+        pool.parallel_task([&] { ++completed; })->wait();
+        AssertThat((int)completed, 1001);
+    }
+
+    TestCase(task_priorities)
+    {
+        thread_pool pool { pool_mode::work_stealing, 1 };
+        atomic_int gate {0};
+        atomic_int completed {0};
+        mutex m;
+        vector<int> order;
+        auto record = [&](int id) {
+            return [&, id] {
+                { lock_guard<mutex> lock{m}; order.push_back(id); }
+                ++completed;
+            };
+        };
+
+        // block the only worker, so everything below gets queued
+        pool.parallel_task([&] { gate = 1; while (gate != 2) ::yield(); });
+        while (gate != 1) ::yield();
+        auto now = std::chrono::steady_clock::now();
+        pool.parallel_task(record(7), task_priority::background);
+        pool.parallel_task(record(4), task_priority::normal);
+        pool.parallel_task(record(3), task_priority::normal, now + 10s);
+        pool.parallel_task(record(1), task_priority::high);
+        pool.parallel_task(record(0), task_priority::high, now + 10s);
+        pool.parallel_task(record(5), task_priority::normal);
+        pool.parallel_task(record(6), task_priority::background, now - 1s);
+        pool.parallel_task(record(2), task_priority::high);
+
+        AssertThat(pool.queued_jobs(task_priority::high), 3);
+        AssertThat(pool.queued_jobs(task_priority::normal), 3);
+        AssertThat(pool.queued_jobs(task_priority::background), 2);
+
+        gate = 2;
+        while (completed < 8) ::yield();
+
+        AssertThat(order, (vector<int>{ 0, 1, 2, 3, 4, 5, 6, 7 }));
+        AssertThat(pool.queued_jobs(), 0);
+        AssertThat(pool.queued_jobs(task_priority::high), 0);
+        AssertThat(pool.missed_deadlines(), 1);
+    }
+
+    // occupies the only worker of the pool until gate is set to 2
+    static void block_worker(thread_pool& pool, atomic_int& gate)
+    {
+        pool.parallel_task([&] { gate = 1; while (gate != 2) ::yield(); });
+        while (gate != 1) ::yield();
+    }
+
+    TestCase(bounded_queue_reject)
+    {
+        thread_pool pool { pool_mode::work_stealing, 1 };
+        pool.set_queue_limit(4, overflow_policy::reject);
+        atomic_int gate {0};
+        atomic_int completed {0};
+        block_worker(pool, gate);
+
+        for (int i = 0; i < 4; ++i)
+            AssertThat(pool.try_parallel_task([&] { ++completed; }), true);
+        AssertThat(pool.try_parallel_task([&] { ++completed; }), false);
+        bool rejected = false;
+        try { pool.parallel_task([&] { ++completed; }); }
+        catch (const task_rejected&) { rejected = true; }
+        AssertThat(rejected, true);
+        AssertThat(pool.queued_jobs(), 4);
+        AssertThat(pool.rejected_jobs(), 2);
+
+        gate = 2;
+        while (completed < 4) ::yield();
+        AssertThat(pool.try_parallel_task([&] { ++completed; }), true);
+        while (completed < 5) ::yield();
+    }
+
+    TestCase(bounded_queue_reject_keeps_internal_work)
+    {
+        thread_pool pool { pool_mode::work_stealing, 1 };
+        pool.set_queue_limit(1, overflow_policy::reject);
+        atomic_int gate {0};
+        atomic_int completed {0};
+        block_worker(pool, gate);
+        pool.parallel_task([&] { ++completed; }); // the queue is now full
+
+        // timers come due on a full queue, they run on the timer thread instead of being lost
+        atomic_int fired {0};
+        pool.schedule_after(1ms, [&] { ++fired; });
+        cancellation_source ticker = pool.schedule_every(1ms, [&] { ++fired; });
+        while (fired < 4) ::sleep_for(1ms);
+        ticker.cancel();
+
+        // a numa slice for a node with a full queue runs on the caller
+        rpp::cpu_topology single;
+        single.nodes = { numa_node{ 0, { rpp::cpu_topology::get().nodes[0].cpus[0] } } };
+        single.num_cpus = 1;
+        numa_thread_pools pools { single };
+        atomic_int nodeGate {0};
+        block_worker(pools.node(0), nodeGate);
+        pools.node(0).set_queue_limit(1, overflow_policy::reject);
+        pools.node(0).parallel_task([] {});
+        atomic_int hits {0};
+        pools.parallel_for(0, 100, [&](int start, int end) { hits += end - start; });
+        AssertThat((int)hits, 100);
+
+        AssertThat(pool.rejected_jobs(), 0);
+        AssertThat(pools.node(0).rejected_jobs(), 0);
+        nodeGate = 2;
+        gate = 2;
+        while (completed < 1) ::yield();
+    }
+
+    TestCase(bounded_queue_caller_runs)
+    {
+        thread_pool pool { pool_mode::work_stealing, 1 };
+        pool.set_queue_limit(2, overflow_policy::caller_runs);
+        atomic_int gate {0};
+        atomic_int completed {0};
+        block_worker(pool, gate);
+
+        pool.parallel_task([&] { ++completed; });
+        pool.parallel_task([&] { ++completed; });
+        thread::id ranOn;
+        pool.parallel_task([&] { ranOn = ::get_id(); ++completed; });
+        AssertThat(ranOn == ::get_id(), true); // ran inline before returning
+        AssertThat((int)completed, 1);
+
+        gate = 2;
+        while (completed < 3) ::yield();
+    }
+
+    TestCase(bounded_queue_block)
+    {
+        thread_pool pool { pool_mode::work_stealing, 1 };
+        pool.set_queue_limit(2, overflow_policy::block);
+        atomic_int gate {0};
+        atomic_int completed {0};
+        block_worker(pool, gate);
+
+        pool.parallel_task([&] { ++completed; });
+        pool.parallel_task([&] { ++completed; });
+        atomic_bool submitted { false };
+        thread producer { [&] {
+            pool.parallel_task([&] { ++completed; });
+            submitted = true;
+        }};
+        ::sleep_for(20ms);
+        AssertThat((bool)submitted, false); // still waiting for a free slot
+
+        gate = 2;
+        producer.join();
+        while (completed < 3) ::yield();
+
+        // a burst is throttled by the queue instead of spawning threads
+        for (int i = 0; i < 5000; ++i)
+            pool.parallel_task([&] { ++completed; });
+        while (completed < 5003) ::yield();
+        AssertThat(pool.total_tasks(), 1);
+    }
+
+    TestCase(settings_change_while_submitting)
+    {
+        thread_pool pool { pool_mode::work_stealing, 2 };
+        atomic_int completed {0};
+        atomic_bool stop { false };
+        thread producer { [&] {
+            for (int i = 0; i < 2000; ++i)
+                pool.parallel_task([&] { ++completed; });
+            stop = true;
+        }};
+        for (int i = 0; !stop; ++i)
+        {
+            pool.set_queue_limit(i % 2 ? 8 : 0, i % 3 ? overflow_policy::caller_runs : overflow_policy::block);
+            (void)pool.max_workers();
+            ::yield();
+        }
+        producer.join();
+        pool.set_queue_limit(0);
+        while (completed < 2000) ::yield();
+        AssertThat(pool.rejected_jobs(), 0);
+    }
+
+    TestCase(cancelled_parallel_task)
+    {
+        thread_pool pool { pool_mode::work_stealing, 1 };
+        atomic_int gate {0};
+        atomic_int completed {0};
+        cancellation_source source;
+        block_worker(pool, gate);
+
+        pool.parallel_task([&] { completed += 1; }, source.token());
+        pool.parallel_task([&] { completed += 10; }, cancellation_token{}); // never cancelled
+        pool.parallel_task([&] { completed += 100; }, source.token());
+        source.cancel();
+        atomic_bool drained { false };
+        pool.parallel_task([&] { drained = true; });
+
+        gate = 2;
+        while (!drained) ::yield();
+        AssertThat((int)completed, 10); // queued jobs of the cancelled source were dropped
+        AssertThat(source.is_cancelled(), true);
+        AssertThat(cancellation_token{}.can_be_cancelled(), false);
+    }
+
+    TestCase(schedule_after)
+    {
+        thread_pool pool;
+        mutex m;
+        vector<int> order;
+        atomic_int completed {0};
+        auto record = [&](int id) {
+            return [&, id] {
+                { lock_guard<mutex> lock{m}; order.push_back(id); }
+                ++completed;
+            };
+        };
+        Timer timer;
+        pool.schedule_after(30ms, record(3));
+        pool.schedule_after(10ms, record(1));
+        pool.schedule_after(20ms, record(2));
+        cancellation_source cancelled = pool.schedule_after(15ms, record(-1));
+        cancelled.cancel();
+        while (completed < 3) ::yield();
+        AssertThat(timer.elapsed_ms() >= 29.0, true);
+        AssertThat(order, (vector<int>{ 1, 2, 3 }));
+
+        // thousands of per-connection timeouts which almost all get cancelled
+        vector<cancellation_source> timeouts;
+        atomic_int expired {0};
+        for (int i = 0; i < 10000; ++i)
+            timeouts.emplace_back(pool.schedule_after(std::chrono::milliseconds{5 + i % 20},
+                                                      [&] { ++expired; }));
+        for (int i = 0; i < 10000; ++i)
+            if (i != 1234) timeouts[i].cancel();
+        while (expired < 1) ::yield();
+        ::sleep_for(30ms);
+        AssertThat((int)expired, 1);
+        AssertThat(pool.scheduled_tasks(), 0);
+    }
+
+    TestCase(cancelled_timers_are_not_kept)
+    {
+        thread_pool pool;
+        atomic_int expired {0};
+        for (int round = 0; round < 10; ++round)
+        {
+            // long timeouts which get cancelled long before they are due
+            vector<cancellation_source> timeouts;
+            for (int i = 0; i < 1000; ++i)
+                timeouts.emplace_back(pool.schedule_after(std::chrono::hours{1}, [&] { ++expired; }));
+            AssertThat(pool.scheduled_tasks(), 1000);
+            for (cancellation_source& timeout : timeouts)
+                timeout.cancel();
+            AssertThat(pool.scheduled_tasks(), 0);
+        }
+        pool.schedule_after(1ms, [&] { ++expired; });
+        AssertThat(pool.scheduled_tasks(), 1);
+        while (expired < 1) ::yield();
+        AssertThat((int)expired, 1);
+    }
+
+    TestCase(schedule_every)
+    {
+        thread_pool pool;
+        atomic_int ticks {0};
+        cancellation_source ticker = pool.schedule_every(5ms, [&] { ++ticks; });
+        while (ticks < 5) ::sleep_for(1ms);
+        ticker.cancel();
+        ::sleep_for(20ms); // a run may still be in progress
+        const int stopped = ticks;
+        ::sleep_for(20ms);
+        AssertThat((int)ticks, stopped);
+
+        // a slow task never overlaps with itself
+        atomic_int running {0};
+        atomic_int maxRunning {0};
+        atomic_int slowTicks {0};
+        cancellation_source slow = pool.schedule_every(1ms, [&] {
+            int now = ++running;
+            if (now > maxRunning) maxRunning = now;
+            ::sleep_for(5ms);
+            --running;
+            ++slowTicks;
+        });
+        while (slowTicks < 3) ::sleep_for(1ms);
+        slow.cancel();
+        AssertThat((int)maxRunning, 1);
+    }
+
+    TestCase(duration_histogram)
+    {
+        rpp::duration_histogram h;
+        h.record(0);
+        for (int i = 0; i < 98; ++i) h.record(1000); // bucket [512, 1024)
+        h.record(1'000'000);
+
+        auto s = h.get();
+        AssertThat(s.count, 100ull);
+        AssertThat(s.buckets[0], 1ull);
+        AssertThat(s.buckets[9], 98ull);
+        AssertThat(s.max_ns, 1'000'000ull);
+        AssertThat(s.percentile_ns(0.5), 1024ull);
+        AssertThat(s.percentile_ns(1.0), 1'000'000ull);
+    }
+
+    TestCase(pool_stats)
+    {
+        thread_pool pool;
+        AssertThat(pool.stats_snapshot().run_time.count, 0ull);
+        pool.enable_stats();
+        pool.max_task_idle_time(0.05f);
+
+        vector<pool_task*> tasks;
+        for (int i = 0; i < 4; ++i)
+            tasks.push_back(pool.parallel_task([] { ::sleep_for(2ms); }));
+        for (pool_task* t : tasks) t->wait();
+        // let the idle pool_tasks retire
+        for (int i = 0; i < 200 && pool.stats_snapshot().threads_retired < 4; ++i)
+            ::sleep_for(10ms);
+
+        pool_stats_snapshot s = pool.stats_snapshot();
+        AssertThat(s.run_time.count, 4ull);
+        AssertThat(s.queue_latency.count, 4ull);
+        AssertThat(s.run_time.mean_ns() >= 2e6, true);
+        AssertThat(s.threads_spawned, 4ull);
+        AssertThat(s.threads_retired, 4ull);
+        AssertThat(s.uptime > 0.05, true);
+    }
+
+    TestCase(work_stealing_stats)
+    {
+        thread_pool pool { pool_mode::work_stealing, 2 };
+        pool.enable_stats();
+
+        atomic_int completed {0};
+        for (int i = 0; i < 50; ++i)
+            pool.parallel_task([&] { spin_work(20); ++completed; });
+        while (completed < 50) ::yield();
+        // the last jobs are recorded only after they return
+        for (int i = 0; i < 1000 && pool.stats_snapshot().run_time.count < 50; ++i)
+            ::sleep_for(1ms);
+
+        pool_stats_snapshot s = pool.stats_snapshot();
+        AssertThat(s.run_time.count, 50ull);
+        AssertThat(s.queue_latency.count, 50ull);
+        AssertThat((int)s.worker_busy.size(), 2);
+        const double busy = s.worker_busy[0] + s.worker_busy[1];
+        AssertThat(busy > 0.0, true);
+        AssertThat(s.worker_busy_ratio(0) <= 1.0, true);
+        printf("busy ratio: %.2f %.2f  p50 queue latency: %lluns  p50 run time: %lluns\n",
+               s.worker_busy_ratio(0), s.worker_busy_ratio(1),
+               s.queue_latency.percentile_ns(0.5), s.run_time.percentile_ns(0.5));
+
+        pool.enable_stats(false);
+        pool.parallel_task([&] { ++completed; });
+        while (completed < 51) ::yield();
+        AssertThat(pool.stats_snapshot().run_time.count, 50ull);
+    }
+
+    TestCase(cpu_topology)
+    {
+        const rpp::cpu_topology& topo = rpp::cpu_topology::get();
+        AssertThat(topo.num_cpus > 0, true);
+        AssertThat(topo.nodes.empty(), false);
+
+        unordered_set<int> seen;
+        for (const numa_node& node : topo.nodes)
+        {
+            printf("numa node%d: %zu cpus\n", node.id, node.cpus.size());
+            AssertThat(node.cpus.empty(), false);
+            for (int cpu : node.cpus)
+                AssertThat(seen.insert(cpu).second, true); // every cpu belongs to one node
+        }
+        AssertThat((int)seen.size(), topo.num_cpus);
+    }
+
+    TestCase(pinned_workers)
+    {
+        const int cpu = rpp::cpu_topology::get().nodes.back().cpus.back();
+        thread_pool pool { pool_mode::work_stealing };
+        pool.set_worker_affinity({ cpu });
+        AssertThat(pool.max_workers(), 1);
+
+        atomic_int completed {0};
+        atomic_int wrongCpu {0};
+        for (int i = 0; i < 100; ++i)
+        {
+            pool.parallel_task([&] {
+            #if __linux__
+                if (sched_getcpu() != cpu) ++wrongCpu;
+            #endif
+                ++completed;
+            });
+        }
+        while (completed < 100) ::yield();
+        AssertThat((int)wrongCpu, 0);
+    }
+
+    TestCase(numa_parallel_for)
+    {
+        numa_thread_pools pools;
+        AssertThat(pools.node_count(), (int)rpp::cpu_topology::get().nodes.size());
+
+        // node slices are contiguous and cover the whole range
+        int expectedStart = 10;
+        for (int i = 0; i < pools.node_count(); ++i)
+        {
+            int start, end;
+            pools.node_range(i, 10, 10010, start, end);
+            AssertThat(start, expectedStart);
+            expectedStart = end;
+        }
+        AssertThat(expectedStart, 10010);
+
+        vector<int> hits(10000, 0);
+        pools.parallel_for(0, (int)hits.size(), [&](int start, int end) {
+            for (int i = start; i < end; ++i)
+                hits[i] += 1;
+        }, parallel_schedule::dynamic);
+        for (int i = 0; i < (int)hits.size(); ++i)
+            if (!AssertThat(hits[i], 1)) break;
+
+        // emulate a dual-socket box: two nodes sharing the first cpu
+        rpp::cpu_topology dual;
+        const int cpu = rpp::cpu_topology::get().nodes[0].cpus[0];
+        dual.nodes = { numa_node{ 0, { cpu, cpu } }, numa_node{ 1, { cpu } } };
+        dual.num_cpus = 3;
+        numa_thread_pools dualPools { dual };
+        AssertThat(dualPools.node_count(), 2);
+        AssertThat(dualPools.node(0).max_workers(), 2);
+
+        mutex m;
+        unordered_set<thread::id> ids;
+        pools.parallel_for(0, (int)hits.size(), [&](int start, int end) {
+            for (int i = start; i < end; ++i)
+                hits[i] += 1;
+        });
+        dualPools.parallel_for(0, (int)hits.size(), [&](int start, int end) {
+            { lock_guard<mutex> lock{m}; ids.insert(::get_id()); }
+            for (int i = start; i < end; ++i)
+                hits[i] += 1;
+        });
+        for (int i = 0; i < (int)hits.size(); ++i)
+            if (!AssertThat(hits[i], 3)) break;
+        AssertThat(ids.count(::get_id()), 0ul); // the caller only waits
+    }
+
+    TestCase(parallel_for_caller_helps_while_waiting)
+    {
+        thread_pool pool { pool_mode::work_stealing, 2 };
+        atomic_int gate {0};
+        block_worker(pool, gate); // only one worker is left for the parallel_for
+
+        const thread::id caller = ::get_id();
+        atomic_int started {0};
+        atomic_bool helped { false };
+        thread::id helpedOn;
+        pool.parallel_for(0, 2, [&](int, int) {
+            ++started;
+            if (::get_id() == caller) { // make sure the worker claims the other chunk
+                while (started < 2) ::yield();
+                return;
+            }
+            // nobody else is free to run this job, so the waiting caller has to
+            pool.parallel_task([&] { helpedOn = ::get_id(); helped = true; });
+            for (int i = 0; i < 2000 && !helped; ++i) ::sleep_for(1ms);
+        });
+        AssertThat(helped == true, true);
+        AssertThat(helpedOn == caller, true);
+        gate = 2;
+    }
+
+    TestCase(nested_parallel_for)
+    {
+        constexpr int N = 64;
+        vector<int> cells(N*N, 0);
+        thread_pool pool { pool_mode::work_stealing, 4 };
+        pool.parallel_for(0, N, [&](int start, int end) {
+            for (int i = start; i < end; ++i) {
+                pool.parallel_for(0, N, [&, i](int s, int e) {
+                    for (int j = s; j < e; ++j)
+                        cells[i*N + j] += 1;
+                });
+            }
+        });
+        for (int i = 0; i < N*N; ++i)
+            if (!AssertThat(cells[i], 1)) break;
+        AssertThat(pool.total_tasks(), 4); // no thread explosion
+    }
+
+    TestCase(concurrent_parallel_for)
+    {
+        constexpr int numCallers = 4;
+        constexpr int len = 100000;
+        int64_t sums[numCallers] = { 0 };
+        thread_pool pool { pool_mode::work_stealing, 4 };
+        vector<thread> callers;
+        for (int c = 0; c < numCallers; ++c)
+        {
+            callers.emplace_back([&pool, &sums, c] {
+                atomic<int64_t> sum { 0 };
+                pool.parallel_for(0, len, [&](int start, int end) {
+                    int64_t isum = 0;
+                    for (int i = start; i < end; ++i)
+                        isum += i;
+                    sum += isum;
+                });
+                sums[c] = sum;
+            });
+        }
+        for (thread& t : callers)
+            t.join();
+        for (int64_t sum : sums)
+            AssertThat(sum, int64_t(len)*(len - 1)/2);
+    }
+
+    TestCaseExpectedEx(parallel_for_exception, std::logic_error)
+    {
+        thread_pool pool { pool_mode::work_stealing, 4 };
+        pool.parallel_for(0, 100, [&](int start, int end) {
+            if (start <= 50 && 50 < end)
+                throw std::logic_error("parallel_for failed");
+        });
+    }
+
+    TestCase(parallel_for_schedules)
+    {
+        thread_pool pool { pool_mode::work_stealing, 4 };
+        const parallel_schedule schedules[] = {
+            parallel_schedule::equal_slices,
+            parallel_schedule::dynamic,
+            parallel_schedule::guided,
+        };
+        for (parallel_schedule schedule : schedules)
+        {
+            for (int grainSize : { 0, 1, 7, 100, 5000 })
+            {
+                constexpr int first = 17, last = 1017;
+                vector<int> visited(last, 0);
+                pool.parallel_for(first, last, [&](int start, int end) {
+                    for (int i = start; i < end; ++i)
+                        visited[i] += 1;
+                }, schedule, grainSize);
+
+                for (int i = 0; i < last; ++i)
+                    if (!AssertThat(visited[i], i < first ? 0 : 1)) break;
+            }
+        }
+    }
+
+    TestCase(cancelled_parallel_for)
+    {
+        thread_pool pool { pool_mode::work_stealing, 4 };
+        cancellation_source source;
+        atomic_int processed {0};
+        bool cancelled = false;
+        try {
+            pool.parallel_for(0, 1000, [&](int start, int end) {
+                for (int i = start; i < end; ++i)
+                    if (++processed == 100) source.cancel();
+                ::sleep_for(100us);
+            }, source.token(), parallel_schedule::dynamic, 10);
+        } catch (const task_cancelled&) {
+            cancelled = true;
+        }
+        AssertThat(cancelled, true);
+        AssertThat(processed >= 100, true);
+        AssertThat(processed < 1000, true); // only chunks which were already running finished
+
+        // an already cancelled token runs nothing, even in the serial fallback
+        for (int range : { 1000, 1 })
+        {
+            processed = 0;
+            cancelled = false;
+            try {
+                pool.parallel_for(0, range, [&](int start, int end) {
+                    processed += end - start;
+                }, source.token());
+            } catch (const task_cancelled&) {
+                cancelled = true;
+            }
+            AssertThat(cancelled, true);
+            AssertThat((int)processed, 0);
+        }
+
+        cancellation_source live;
+        processed = 0;
+        pool.parallel_for(0, 1000, [&](int start, int end) {
+            processed += end - start;
+        }, live.token());
+        AssertThat((int)processed, 1000);
+    }
+
+    static double spin_work(int iterations)
+    {
+        volatile double x = 1.0;
+        for (int i = 0; i < iterations; ++i)
+            x = x * 1.000001 + 0.000001;
+        return x;
+    }
+
+    static double measure_schedule(thread_pool& pool, parallel_schedule schedule, bool skewed)
+    {
+        constexpr int numItems = 2000;
+        Timer timer;
+        pool.parallel_for(0, numItems, [&](int start, int end) {
+            for (int i = start; i < end; ++i)
+                // skewed: the first 1/8th of items is 50x more expensive
+                spin_work(skewed && i < numItems/8 ? 50*200 : 200);
+        }, schedule);
+        return timer.elapsed_ms();
+    }
+
+    TestCase(parallel_for_schedule_performance)
+    {
+        thread_pool pool { pool_mode::work_stealing };
+        const char* names[] = { "equal_slices", "dynamic", "guided" };
+        const parallel_schedule schedules[] = {
+            parallel_schedule::equal_slices,
+            parallel_schedule::dynamic,
+            parallel_schedule::guided,
+        };
+        for (int i = 0; i < 3; ++i)
+        {
+            double uniform = measure_schedule(pool, schedules[i], false);
+            double skewed  = measure_schedule(pool, schedules[i], true);
+            printf("%-12s  uniform: %6.2fms  skewed: %6.2fms\n", names[i], uniform, skewed);
+        }
+    }
+
+    TestCase(parallel_reduce)
+    {
+        vector<int> numbers(100000);
+        for (int i = 0; i < (int)numbers.size(); ++i)
+            numbers[i] = i;
+        const int64_t expected = int64_t(numbers.size()) * (numbers.size() - 1) / 2;
+        auto add = [](int64_t a, int64_t b) { return a + b; };
+
+        AssertThat(parallel_reduce(range(numbers), int64_t(0), add), expected);
+        AssertThat(parallel_reduce(range(numbers), int64_t(0), add, reduce_order::deterministic), expected);
+        AssertThat(parallel_reduce(range(numbers), int64_t(10), add), expected + 10);
+
+        vector<int> empty;
+        AssertThat(parallel_reduce(range(empty), int64_t(42), add), int64_t(42));
+    }
+
+    TestCase(parallel_reduce_into_other_type)
+    {
+        vector<string> lines(5000);
+        size_t expected = 0;
+        for (int i = 0; i < (int)lines.size(); ++i) {
+            lines[i] = string(size_t(i % 37), 'x');
+            expected += lines[i].size();
+        }
+        auto addLength = [](size_t sum, const string& s) { return sum + s.size(); };
+        auto combine   = [](size_t a, size_t b) { return a + b; };
+
+        AssertThat(parallel_reduce(range(lines), size_t(0), addLength, combine), expected);
+        AssertThat(parallel_reduce(range(lines), size_t(0), addLength, combine,
+                                   reduce_order::deterministic), expected);
+        vector<string> empty;
+        AssertThat(parallel_reduce(range(empty), size_t(0), addLength, combine), size_t(0));
+    }
+
+    TestCase(parallel_reduce_deterministic)
+    {
+        vector<float> values(123457);
+        for (int i = 0; i < (int)values.size(); ++i)
+            values[i] = 1.0f / float(1 + (i % 1000));
+
+        auto add = [](float a, float b) { return a + b; };
+        float first = parallel_reduce(range(values), 0.0f, add, reduce_order::deterministic);
+        for (int run = 0; run < 10; ++run)
+        {
+            float again = parallel_reduce(range(values), 0.0f, add, reduce_order::deterministic);
+            if (!AssertThat(again, first)) break; // bitwise identical
+        }
+    }
+
+    TestCase(parallel_transform_reduce)
+    {
+        vector<string> words = { "parallel", "transform", "reduce", "", "x" };
+        int totalLength = parallel_transform_reduce(range(words), 0,
+            [](int a, int b) { return a + b; },
+            [](const string& s) { return (int)s.size(); });
+        AssertThat(totalLength, 8+9+6+0+1);
+    }
+
+    TestCase(parallel_inclusive_scan)
+    {
+        vector<int> numbers(54321);
+        for (int i = 0; i < (int)numbers.size(); ++i)
+            numbers[i] = (i % 7) - 3;
+
+        vector<int> expected(numbers.size());
+        std::partial_sum(numbers.begin(), numbers.end(), expected.begin());
+
+        auto add = [](int a, int b) { return a + b; };
+        vector<int> scanned(numbers.size());
+        parallel_inclusive_scan(range(numbers), scanned.data(), add);
+        AssertThat(scanned, expected);
+
+        parallel_inclusive_scan(range(numbers), numbers.data(), add); // in-place
+        AssertThat(numbers, expected);
+
+        vector<int> small = { 5 };
+        parallel_inclusive_scan(range(small), small.data(), add);
+        AssertThat(small[0], 5);
+    }
+
+};